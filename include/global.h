@@ -81,4 +81,65 @@
 
 #include "wutils.h"
 
+typedef struct _TrackerApp TrackerApp;
+
+// event priorities of the tracker's event base, lower runs first: announce
+// processing, then connection I/O and the rest, bulk work when nothing else is ready
+#define TRACKER_PRIO_ANNOUNCE 0
+#define TRACKER_PRIO_DEFAULT 1
+#define TRACKER_PRIO_BULK 2
+#define TRACKER_PRIORITIES 3
+
+// settings used on the hot path, rebuilt from ConfData and swapped
+// as a whole when configuration is reloaded
+typedef struct {
+    gint default_numwant;
+    gint interval;
+    gboolean trust_real_ip;
+
+    // memory budget in bytes, 0: unlimited
+    guint64 max_memory;
+    // 0: unlimited
+    guint max_peers_per_torrent;
+    // seconds without announce before peer / torrent is removed
+    guint peer_timeout;
+    guint torrent_timeout;
+
+    // plain announces sooner than this after the previous one get
+    // min_interval_reply, without peers, 0: disabled
+    guint min_interval;
+    gchar min_interval_reply[96];
+    size_t min_interval_reply_len;
+    // reply without peers for stopped and numwant=0 announces, from the end
+    // of the interval value on: "e[12:min intervali<n>e]5:peers0:e"
+    gchar empty_reply_suffix[96];
+    size_t empty_reply_suffix_len;
+
+    // announce interval of hot torrents, 0: tracker.interval
+    guint hot_interval;
+
+    // interval is spread by up to +- interval_jitter percent, per peer
+    guint interval_jitter;
+    // during tracker.warmup seconds after start (not upgrade) intervals are
+    // spread between warmup_min_interval and interval
+    guint warmup_min_interval;
+} TrackerSettings;
+
+struct event_base *tracker_app_get_evbase (TrackerApp *app);
+struct evdns_base *tracker_app_get_dnsbase (TrackerApp *app);
+ConfData *tracker_app_get_conf (TrackerApp *app);
+const TrackerSettings *tracker_app_get_settings (TrackerApp *app);
+void tracker_app_get_listen_fds (TrackerApp *app, evutil_socket_t *http_fd, evutil_socket_t *repl_fd, evutil_socket_t *https_fd);
+void tracker_app_stop_accepting (TrackerApp *app);
+
+// max info_hashes of a scrape
+#define TRACKER_MAX_SCRAPE 64
+// FALSE: bad request, nothing is added to evb
+gboolean tracker_app_scrape_reply (TrackerApp *app, uint8_t (*info_hash)[SHA_DIGEST_LENGTH], guint n, struct evbuffer *evb);
+// /stats and /hot pages, FALSE: unknown path, counted as bad request
+gboolean tracker_app_print_page (TrackerApp *app, const gchar *path, struct evbuffer *evb);
+
+typedef struct _AccessTables AccessTables;
+const AccessTables *tracker_app_get_access (TrackerApp *app);
+
 #endif
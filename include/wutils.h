@@ -32,6 +32,7 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sched.h>
 
 #include <glib.h>
 #include <glib/gprintf.h>
@@ -81,6 +82,7 @@ ConfData *conf_create ();
 void conf_destroy ();
 
 gboolean conf_parse_file (ConfData *conf, const gchar *filename);
+guint conf_update_from (ConfData *conf, ConfData *new_conf);
 
 const gchar *conf_get_string (ConfData *conf, const gchar *path);
 void conf_set_string (ConfData *conf, const gchar *full_path, const gchar *val);
@@ -106,6 +108,7 @@ gboolean conf_set_node_change_cb (ConfData *conf, const gchar *path, ConfNodeCha
 gboolean uri_is_https (const struct evhttp_uri *uri);
 gint uri_get_port (const struct evhttp_uri *uri);
 const gchar *http_find_header (const struct evkeyvalq *headers, const gchar *key);
+guint http_query_find_sha1 (const gchar *query, const gchar *key, uint8_t (*out)[SHA_DIGEST_LENGTH], guint max);
 
 // string_utils
 gchar *get_random_string (size_t len, gboolean readable);
@@ -113,9 +116,28 @@ gboolean get_md5_sum (const gchar *buf, size_t len, gchar **md5str, gchar **md5b
 gchar *get_base64 (const gchar *buf, size_t len);
 gchar *str_remove_quotes (gchar *str);
 
-void sha1_to_hexstr (gchar *out, const uint8_t *sha1);
-void hexstr_to_sha1 (uint8_t *out, const char *in);
 void escape_sha1 (char * out, const uint8_t *sha1);
+guint64 sha1_hash64 (const uint8_t *sha1);
+
+// simd utils, kernels are picked by CPU features on the first call
+typedef enum {
+    SIMD_scalar = 0,
+    SIMD_ssse3,
+    SIMD_avx2,
+    SIMD_max,
+} SimdLevel;
+
+SimdLevel simd_get_best_level (void);
+SimdLevel simd_get_level (void);
+// FALSE if CPU doesn't support it
+gboolean simd_set_level (SimdLevel level);
+const gchar *simd_level_to_str (SimdLevel level);
+
+void sha1_to_hexstr (gchar *out, const uint8_t *sha1);
+gboolean hexstr_to_sha1 (uint8_t *out, const char *in);
+// percent-decodes in[0..len) to exactly SHA_DIGEST_LENGTH bytes,
+// in[len] must be readable ('&' or '\0' of a query string)
+gboolean sha1_unescape (uint8_t *out, const gchar *in, size_t len);
 
 // file utils
 // remove directory tree
@@ -123,6 +145,15 @@ int utils_del_tree (const gchar *path);
 
 // sys utils
 int wutils_daemonize (void);
+gboolean sys_parse_cpu_list (const gchar *str, cpu_set_t *set);
+gint sys_cpu_set_get_nth (const cpu_set_t *set, gint n);
+gchar *sys_cpu_set_to_str (const cpu_set_t *set);
+gboolean sys_pin_thread (const cpu_set_t *set);
+gint sys_cpu_get_numa_node (gint cpu);
+gint sys_cpu_set_get_numa_node (const cpu_set_t *set);
+gboolean sys_bind_memory_to_node (gint node);
+gboolean sys_get_nic_irq_cpus (const gchar *nic, cpu_set_t *set);
+void sys_log_topology (const gchar *nic);
 
 // get min / max of integer types
 #define type_bits(t) ((t) (sizeof(t) * (CHAR_BIT)))
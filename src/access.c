@@ -0,0 +1,268 @@
+/*
+ * Copyright (C) 2012-2013 Paul Ionkin <paul.ionkin@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include "access.h"
+#include <sys/mman.h>
+
+#define ACCESS_LOG "access"
+
+// blocked Bloom filter: all bits of a key are in one cache line
+#define BLOOM_BLOCK_WORDS 8
+#define BLOOM_BLOCK_BITS (BLOOM_BLOCK_WORDS * 64)
+#define BLOOM_BITS_PER_KEY 12
+#define BLOOM_HASHES 6
+
+struct _AccessList {
+    gchar *path;
+    uint8_t *map;
+    size_t map_len;
+
+    const uint8_t *keys;
+    guint32 key_size;
+    guint32 count;
+
+    guint64 *bloom;
+    guint32 bloom_blocks_mask;
+};
+
+struct _AccessTables {
+    AccessList *passkeys;
+    // NULL: any torrent is allowed
+    AccessList *torrents;
+};
+
+/*{{{ Bloom filter */
+// FNV-1a with murmur3 finalizer, keys can be short printable strings
+static guint64 access_key_hash (const uint8_t *key, size_t len)
+{
+    guint64 h = 0xcbf29ce484222325ULL;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        h ^= key[i];
+        h *= 0x100000001b3ULL;
+    }
+
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+
+    return h;
+}
+
+static void access_bloom_add (AccessList *list, const uint8_t *key)
+{
+    guint64 h = access_key_hash (key, list->key_size);
+    guint64 *block = list->bloom + ((h >> 40) & list->bloom_blocks_mask) * BLOOM_BLOCK_WORDS;
+    guint32 h1 = (guint32) h, h2 = (guint32) (h >> 16) | 1;
+    gint i;
+
+    for (i = 0; i < BLOOM_HASHES; i++) {
+        guint32 bit = (h1 + i * h2) % BLOOM_BLOCK_BITS;
+        block[bit / 64] |= 1ULL << (bit % 64);
+    }
+}
+
+static gboolean access_bloom_check (const AccessList *list, const uint8_t *key)
+{
+    guint64 h = access_key_hash (key, list->key_size);
+    const guint64 *block = list->bloom + ((h >> 40) & list->bloom_blocks_mask) * BLOOM_BLOCK_WORDS;
+    guint32 h1 = (guint32) h, h2 = (guint32) (h >> 16) | 1;
+    gint i;
+
+    for (i = 0; i < BLOOM_HASHES; i++) {
+        guint32 bit = (h1 + i * h2) % BLOOM_BLOCK_BITS;
+        if (!(block[bit / 64] & (1ULL << (bit % 64))))
+            return FALSE;
+    }
+
+    return TRUE;
+}
+/*}}}*/
+
+/*{{{ AccessList */
+AccessList *access_list_open (const gchar *path)
+{
+    AccessList *list;
+    const AccessListHeader *hdr;
+    struct stat st;
+    gint fd;
+    guint32 i, blocks;
+    void *map;
+
+    fd = open (path, O_RDONLY);
+    if (fd < 0) {
+        LOG_err (ACCESS_LOG, "Failed to open %s: %s", path, strerror (errno));
+        return NULL;
+    }
+
+    if (fstat (fd, &st) < 0 || (size_t) st.st_size < sizeof (AccessListHeader)) {
+        LOG_err (ACCESS_LOG, "Invalid access list file: %s", path);
+        close (fd);
+        return NULL;
+    }
+
+    // tables are small enough to be kept resident, checks must not fault
+    map = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED | MAP_POPULATE, fd, 0);
+    close (fd);
+    if (map == MAP_FAILED) {
+        LOG_err (ACCESS_LOG, "Failed to mmap %s: %s", path, strerror (errno));
+        return NULL;
+    }
+
+    hdr = (const AccessListHeader *) map;
+    if (memcmp (hdr->magic, ACCESS_LIST_MAGIC, sizeof (hdr->magic)) ||
+        g_ntohl (hdr->version) != ACCESS_LIST_VERSION ||
+        !g_ntohl (hdr->key_size) || g_ntohl (hdr->key_size) > ACCESS_LIST_MAX_KEY_SIZE ||
+        (guint64) g_ntohl (hdr->count) * g_ntohl (hdr->key_size) != st.st_size - sizeof (AccessListHeader)) {
+        LOG_err (ACCESS_LOG, "Invalid access list file: %s", path);
+        munmap (map, st.st_size);
+        return NULL;
+    }
+
+    list = g_new0 (AccessList, 1);
+    list->path = g_strdup (path);
+    list->map = map;
+    list->map_len = st.st_size;
+    list->keys = list->map + sizeof (AccessListHeader);
+    list->key_size = g_ntohl (hdr->key_size);
+    list->count = g_ntohl (hdr->count);
+
+    // power of two number of blocks
+    for (blocks = 1; (guint64) blocks * BLOOM_BLOCK_BITS < (guint64) list->count * BLOOM_BITS_PER_KEY; blocks <<= 1);
+    list->bloom = g_new0 (guint64, (gsize) blocks * BLOOM_BLOCK_WORDS);
+    list->bloom_blocks_mask = blocks - 1;
+
+    for (i = 0; i < list->count; i++) {
+        const uint8_t *key = list->keys + (gsize) i * list->key_size;
+
+        if (i && memcmp (key - list->key_size, key, list->key_size) >= 0) {
+            LOG_err (ACCESS_LOG, "Access list is not sorted: %s", path);
+            access_list_close (list);
+            return NULL;
+        }
+        access_bloom_add (list, key);
+    }
+
+    LOG_msg (ACCESS_LOG, "Loaded %s: %u keys of %u bytes", path, list->count, list->key_size);
+
+    return list;
+}
+
+void access_list_close (AccessList *list)
+{
+    munmap (list->map, list->map_len);
+    g_free (list->bloom);
+    g_free (list->path);
+    g_free (list);
+}
+
+gboolean access_list_contains (const AccessList *list, const void *key, size_t len)
+{
+    guint32 lo, hi;
+
+    if (len != list->key_size)
+        return FALSE;
+
+    if (!access_bloom_check (list, key))
+        return FALSE;
+
+    lo = 0;
+    hi = list->count;
+    while (lo < hi) {
+        guint32 mid = lo + (hi - lo) / 2;
+        gint cmp = memcmp (list->keys + (gsize) mid * list->key_size, key, len);
+
+        if (!cmp)
+            return TRUE;
+        else if (cmp < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return FALSE;
+}
+
+guint32 access_list_get_count (const AccessList *list)
+{
+    return list->count;
+}
+/*}}}*/
+
+/*{{{ AccessTables */
+AccessTables *access_tables_load (ConfData *conf)
+{
+    AccessTables *tables;
+    const gchar *path;
+
+    tables = g_new0 (AccessTables, 1);
+
+    path = conf_get_string (conf, "private.passkeys");
+    if (!path || !*path) {
+        LOG_err (ACCESS_LOG, "private.passkeys is not set !");
+        access_tables_destroy (tables);
+        return NULL;
+    }
+
+    tables->passkeys = access_list_open (path);
+    if (!tables->passkeys) {
+        access_tables_destroy (tables);
+        return NULL;
+    }
+
+    path = conf_get_string (conf, "private.torrents");
+    if (path && *path) {
+        tables->torrents = access_list_open (path);
+        if (!tables->torrents) {
+            access_tables_destroy (tables);
+            return NULL;
+        }
+
+        if (tables->torrents->key_size != SHA_DIGEST_LENGTH) {
+            LOG_err (ACCESS_LOG, "Torrents list %s must contain binary info_hashes !", path);
+            access_tables_destroy (tables);
+            return NULL;
+        }
+    }
+
+    return tables;
+}
+
+void access_tables_destroy (AccessTables *tables)
+{
+    if (tables->passkeys)
+        access_list_close (tables->passkeys);
+    if (tables->torrents)
+        access_list_close (tables->torrents);
+    g_free (tables);
+}
+
+gboolean access_tables_check_passkey (const AccessTables *tables, const gchar *passkey)
+{
+    return access_list_contains (tables->passkeys, passkey, strlen (passkey));
+}
+
+gboolean access_tables_check_torrent (const AccessTables *tables, const uint8_t *info_hash)
+{
+    if (!tables->torrents)
+        return TRUE;
+
+    return access_list_contains (tables->torrents, info_hash, SHA_DIGEST_LENGTH);
+}
+/*}}}*/
@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) 2012-2013 Paul Ionkin <paul.ionkin@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#ifndef _ACCESS_H_
+#define _ACCESS_H_
+
+#include "global.h"
+
+/*
+ * Access list file: header followed by count keys of key_size bytes,
+ * sorted (memcmp order) and unique. Integers are in network byte order.
+ * Files are mmap'd, replace them with rename () and never rewrite in place.
+ */
+#define ACCESS_LIST_MAGIC "TBAL"
+#define ACCESS_LIST_VERSION 1
+#define ACCESS_LIST_MAX_KEY_SIZE 255
+
+typedef struct {
+    char magic[4];
+    guint32 version;
+    guint32 key_size;
+    guint32 count;
+} __attribute__((packed)) AccessListHeader;
+
+typedef struct _AccessList AccessList;
+
+AccessList *access_list_open (const gchar *path);
+void access_list_close (AccessList *list);
+gboolean access_list_contains (const AccessList *list, const void *key, size_t len);
+guint32 access_list_get_count (const AccessList *list);
+
+// passkeys and info_hash whitelist of private tracker, see global.h
+AccessTables *access_tables_load (ConfData *conf);
+void access_tables_destroy (AccessTables *tables);
+gboolean access_tables_check_passkey (const AccessTables *tables, const gchar *passkey);
+// info_hash: binary, SHA_DIGEST_LENGTH bytes
+gboolean access_tables_check_torrent (const AccessTables *tables, const uint8_t *info_hash);
+
+#endif
@@ -0,0 +1,192 @@
+/*
+ * Copyright (C) 2012-2013 Paul Ionkin <paul.ionkin@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include "accounting.h"
+
+/*
+ * Totals are kept in a table which is swapped by the flush thread,
+ * announce only holds the lock for a hash table lookup.
+ * Each flush appends one batch to the file, a line per passkey:
+ *   <unix time>\t<passkey>\t<uploaded>\t<downloaded>\t<announces>\n
+ */
+
+#define ACC_LOG "accounting"
+
+typedef struct {
+    guint64 uploaded;
+    guint64 downloaded;
+    guint32 announces;
+} AccountingEntry;
+
+struct _Accounting {
+    TrackerApp *app;
+    gchar *path;
+    gint fd;
+    guint flush_interval;
+
+    GMutex lock;
+    GCond cond;
+    // passkey -> AccountingEntry, protected by lock
+    GHashTable *h_users;
+    gboolean stop;
+
+    GThread *thread;
+};
+
+static GHashTable *accounting_table_create (void)
+{
+    return g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+}
+
+/*{{{ flush */
+static gboolean accounting_write (Accounting *acc, const gchar *buf, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = write (acc->fd, buf, len);
+
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return FALSE;
+        }
+        buf += n;
+        len -= n;
+    }
+
+    return fdatasync (acc->fd) == 0;
+}
+
+// called without lock held
+static void accounting_flush_table (Accounting *acc, GHashTable *h_users)
+{
+    GHashTableIter iter;
+    const gchar *passkey;
+    AccountingEntry *entry;
+    GString *batch;
+    time_t now = time (NULL);
+
+    if (!g_hash_table_size (h_users))
+        return;
+
+    batch = g_string_sized_new (g_hash_table_size (h_users) * 80);
+
+    g_hash_table_iter_init (&iter, h_users);
+    while (g_hash_table_iter_next (&iter, (gpointer *)&passkey, (gpointer *)&entry)) {
+        g_string_append_printf (batch, "%ld\t%s\t%"G_GUINT64_FORMAT"\t%"G_GUINT64_FORMAT"\t%u\n",
+            (long) now, passkey, entry->uploaded, entry->downloaded, entry->announces);
+    }
+
+    if (!accounting_write (acc, batch->str, batch->len))
+        LOG_err (ACC_LOG, "Failed to write to %s: %s, %u users are lost", acc->path, strerror (errno), g_hash_table_size (h_users));
+    else
+        LOG_debug (ACC_LOG, "Flushed %u users", g_hash_table_size (h_users));
+
+    g_string_free (batch, TRUE);
+}
+
+static gpointer accounting_thread (gpointer data)
+{
+    Accounting *acc = (Accounting *) data;
+    GHashTable *h_users;
+    gint64 end_time;
+
+    g_mutex_lock (&acc->lock);
+    for (;;) {
+        gboolean stop;
+
+        end_time = g_get_monotonic_time () + (gint64) acc->flush_interval * G_USEC_PER_SEC;
+        while (!acc->stop && g_cond_wait_until (&acc->cond, &acc->lock, end_time));
+        stop = acc->stop;
+
+        h_users = acc->h_users;
+        acc->h_users = accounting_table_create ();
+        g_mutex_unlock (&acc->lock);
+
+        accounting_flush_table (acc, h_users);
+        g_hash_table_destroy (h_users);
+
+        if (stop)
+            break;
+        g_mutex_lock (&acc->lock);
+    }
+
+    return NULL;
+}
+/*}}}*/
+
+Accounting *accounting_create (TrackerApp *app)
+{
+    ConfData *conf = tracker_app_get_conf (app);
+    Accounting *acc;
+
+    acc = g_new0 (Accounting, 1);
+    acc->app = app;
+    acc->path = g_strdup (conf_get_string (conf, "accounting.file"));
+    acc->flush_interval = MAX (1, conf_get_uint (conf, "accounting.flush_interval"));
+
+    acc->fd = open (acc->path, O_WRONLY | O_APPEND | O_CREAT, 0640);
+    if (acc->fd < 0) {
+        LOG_err (ACC_LOG, "Failed to open %s: %s", acc->path, strerror (errno));
+        g_free (acc->path);
+        g_free (acc);
+        return NULL;
+    }
+
+    g_mutex_init (&acc->lock);
+    g_cond_init (&acc->cond);
+    acc->h_users = accounting_table_create ();
+
+    acc->thread = g_thread_new ("accounting", accounting_thread, acc);
+
+    LOG_debug (ACC_LOG, "Writing accounting to %s every %u seconds", acc->path, acc->flush_interval);
+
+    return acc;
+}
+
+void accounting_destroy (Accounting *acc)
+{
+    g_mutex_lock (&acc->lock);
+    acc->stop = TRUE;
+    g_cond_signal (&acc->cond);
+    g_mutex_unlock (&acc->lock);
+
+    g_thread_join (acc->thread);
+
+    g_hash_table_destroy (acc->h_users);
+    g_cond_clear (&acc->cond);
+    g_mutex_clear (&acc->lock);
+    close (acc->fd);
+    g_free (acc->path);
+    g_free (acc);
+}
+
+void accounting_add (Accounting *acc, const gchar *passkey, guint64 uploaded, guint64 downloaded)
+{
+    AccountingEntry *entry;
+
+    g_mutex_lock (&acc->lock);
+
+    entry = g_hash_table_lookup (acc->h_users, passkey);
+    if (!entry) {
+        entry = g_new0 (AccountingEntry, 1);
+        g_hash_table_insert (acc->h_users, g_strdup (passkey), entry);
+    }
+    entry->uploaded += uploaded;
+    entry->downloaded += downloaded;
+    entry->announces++;
+
+    g_mutex_unlock (&acc->lock);
+}
@@ -0,0 +1,32 @@
+/*
+ * Copyright (C) 2012-2013 Paul Ionkin <paul.ionkin@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#ifndef _ACCOUNTING_H_
+#define _ACCOUNTING_H_
+
+#include "global.h"
+
+typedef struct _Accounting Accounting;
+
+// starts flush thread, appending per-passkey totals to accounting.file
+Accounting *accounting_create (TrackerApp *app);
+// stops flush thread, flushing remaining totals
+void accounting_destroy (Accounting *acc);
+
+// adds transfer delta of a peer to passkey totals
+void accounting_add (Accounting *acc, const gchar *passkey, guint64 uploaded, guint64 downloaded);
+
+#endif
@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2012-2013 Paul Ionkin <paul.ionkin@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include "announce.h"
+
+#define ANNOUNCE_LOG "announce"
+
+void announce_request_parse (AnnounceRequest *areq, struct evhttp_request *req, const gchar *passkey)
+{
+    const gchar *query;
+    const char *info_hash;
+    const char *tmp;
+    uint8_t info_hash_bin[1][SHA_DIGEST_LENGTH];
+
+    TRACE_BEGIN (areq->trace);
+
+    LOG_debug (ANNOUNCE_LOG, "[%s:%d] URL: %s", req->remote_host, req->remote_port, req->uri);
+
+    areq->req = req;
+    areq->valid = FALSE;
+    areq->code = HTTP_NOCONTENT;
+    areq->evb = NULL;
+    TAILQ_INIT (&areq->q_params);
+
+    g_strlcpy (areq->remote_host, req->remote_host ? req->remote_host : "", sizeof (areq->remote_host));
+    tmp = http_find_header (evhttp_request_get_input_headers (req), "X-Real-IP");
+    g_strlcpy (areq->real_ip, tmp ? tmp : "", sizeof (areq->real_ip));
+
+    if (passkey)
+        g_strlcpy (areq->passkey, passkey, sizeof (areq->passkey));
+    else
+        areq->passkey[0] = '\0';
+
+    query = evhttp_uri_get_query (evhttp_request_get_evhttp_uri (req));
+    if (!query)
+        return;
+
+    evhttp_parse_query_str (query, &areq->q_params);
+
+    areq->port = 0;
+    areq->numwant = -1;
+    areq->uploaded = areq->downloaded = areq->left = 0;
+
+    info_hash = http_find_header (&areq->q_params, "info_hash");
+    areq->peer_id = http_find_header (&areq->q_params, "peer_id");
+    tmp = http_find_header (&areq->q_params, "port");
+    if (tmp)
+        areq->port = atoi (tmp);
+    tmp = http_find_header (&areq->q_params, "uploaded");
+    if (tmp)
+        areq->uploaded = g_ascii_strtoll (tmp, NULL, 10);
+    tmp = http_find_header (&areq->q_params, "downloaded");
+    if (tmp)
+        areq->downloaded = g_ascii_strtoll (tmp, NULL, 10);
+    tmp = http_find_header (&areq->q_params, "left");
+    if (tmp)
+        areq->left = g_ascii_strtoll (tmp, NULL, 10);
+    tmp = http_find_header (&areq->q_params, "numwant");
+    if (tmp)
+        areq->numwant = atoi (tmp);
+    areq->compact = http_find_header (&areq->q_params, "compact");
+    areq->event = http_find_header (&areq->q_params, "event");
+    areq->key = http_find_header (&areq->q_params, "key");
+
+    // sanity check, info_hash can contain zero bytes, decode it separately
+    if (!info_hash || !areq->peer_id || !http_query_find_sha1 (query, "info_hash", info_hash_bin, 1))
+        return;
+
+    memcpy (areq->info_hash, info_hash_bin[0], SHA_DIGEST_LENGTH);
+    areq->hash = sha1_hash64 (areq->info_hash);
+    areq->valid = TRUE;
+}
+
+void announce_request_send_reply (AnnounceRequest *areq)
+{
+    if (areq->code == HTTP_OK)
+        evhttp_send_reply (areq->req, HTTP_OK, "OK", areq->evb);
+    else
+        evhttp_send_reply (areq->req, areq->code, "Not Found", NULL);
+    TRACE_PHASE (areq->trace, TP_send);
+
+    announce_request_clear (areq);
+}
+
+void announce_request_clear (AnnounceRequest *areq)
+{
+    if (areq->evb) {
+        evbuffer_free (areq->evb);
+        areq->evb = NULL;
+    }
+    evhttp_clear_headers (&areq->q_params);
+    areq->req = NULL;
+}
@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2012-2013 Paul Ionkin <paul.ionkin@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#ifndef _ANNOUNCE_H_
+#define _ANNOUNCE_H_
+
+#include "global.h"
+#include "access.h"
+#include "trace.h"
+
+/*
+ * Announce request between its stages: parsed from the query (any thread),
+ * processed against the swarm state (tracker_app_announce_process, thread
+ * owning torrents) which leaves the reply in it, then sent (thread owning the
+ * connection).
+ */
+typedef struct {
+    struct evhttp_request *req;
+    struct evkeyvalq q_params;
+    // copy of the verified passkey, empty if private mode is disabled
+    gchar passkey[ACCESS_LIST_MAX_KEY_SIZE + 1];
+
+    // query has info_hash and peer_id
+    gboolean valid;
+    uint8_t info_hash[SHA_DIGEST_LENGTH];
+    // sha1_hash64 of info_hash
+    guint64 hash;
+    // point to q_params values
+    const gchar *peer_id;
+    const gchar *compact;
+    const gchar *event;
+    // BEP 3 / 7 key, NULL if not sent
+    const gchar *key;
+    gint port;
+    // -1 if not sent
+    gint numwant;
+    gint64 uploaded;
+    gint64 downloaded;
+    gint64 left;
+    // connection peer and X-Real-IP header, empty if not set
+    gchar remote_host[INET6_ADDRSTRLEN];
+    gchar real_ip[INET6_ADDRSTRLEN];
+
+    // reply: HTTP_OK with body or HTTP_NOCONTENT without
+    gint code;
+    struct evbuffer *evb;
+    TRACE_DECLARE (trace)
+} AnnounceRequest;
+
+// passkey: already verified, NULL if private mode is disabled
+void announce_request_parse (AnnounceRequest *areq, struct evhttp_request *req, const gchar *passkey);
+// sends the reply and clears areq
+void announce_request_send_reply (AnnounceRequest *areq);
+// client has gone: clears areq without reply
+void announce_request_clear (AnnounceRequest *areq);
+
+// main.c, called by the thread owning torrents
+// cache hint for the torrent table slot of areq or, once it's cached, the torrent
+void tracker_app_announce_prefetch (TrackerApp *app, const AnnounceRequest *areq, gboolean torrent);
+// leaves the reply in areq
+void tracker_app_announce_process (TrackerApp *app, AnnounceRequest *areq);
+// records the trace of a processed announce once its reply is sent, any thread
+void tracker_app_announce_done (TrackerApp *app, AnnounceRequest *areq);
+
+#endif
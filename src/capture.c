@@ -0,0 +1,183 @@
+/*
+ * Copyright (C) 2012-2013 Paul Ionkin <paul.ionkin@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include "capture.h"
+#include <openssl/sha.h>
+#include <openssl/rand.h>
+
+#define CAPTURE_LOG "capture"
+
+// records are buffered and written when buffer is full or every second
+#define CAPTURE_BUFFER_RECORDS 4096
+#define CAPTURE_KEY_SIZE 16
+
+struct _Capture {
+    TrackerApp *app;
+    gchar *path;
+    gint fd;
+
+    uint8_t key[CAPTURE_KEY_SIZE];
+    gint64 start_us;
+
+    CaptureRecord *buf;
+    guint n_buf;
+    guint64 records;
+
+    struct event *ev_flush;
+};
+
+static void capture_flush (Capture *capture)
+{
+    const uint8_t *p = (const uint8_t *) capture->buf;
+    size_t len = capture->n_buf * sizeof (CaptureRecord);
+
+    while (len > 0) {
+        ssize_t n = write (capture->fd, p, len);
+
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            LOG_err (CAPTURE_LOG, "Failed to write to %s: %s, %u records are lost", capture->path, strerror (errno), capture->n_buf);
+            break;
+        }
+        p += n;
+        len -= n;
+    }
+
+    capture->n_buf = 0;
+}
+
+static void capture_on_flush_cb (G_GNUC_UNUSED evutil_socket_t fd, G_GNUC_UNUSED short event, void *ctx)
+{
+    Capture *capture = (Capture *) ctx;
+
+    if (capture->n_buf)
+        capture_flush (capture);
+}
+
+Capture *capture_create (TrackerApp *app)
+{
+    ConfData *conf = tracker_app_get_conf (app);
+    Capture *capture;
+    CaptureFileHeader hdr;
+    struct timeval tv = { 1, 0 };
+
+    capture = g_new0 (Capture, 1);
+    capture->app = app;
+    capture->path = g_strdup (conf_get_string (conf, "capture.file"));
+
+    capture->fd = open (capture->path, O_WRONLY | O_CREAT | O_TRUNC, 0640);
+    if (capture->fd < 0) {
+        LOG_err (CAPTURE_LOG, "Failed to create %s: %s", capture->path, strerror (errno));
+        g_free (capture->path);
+        g_free (capture);
+        return NULL;
+    }
+
+    if (RAND_bytes (capture->key, sizeof (capture->key)) != 1) {
+        LOG_err (CAPTURE_LOG, "Failed to generate anonymization key !");
+        close (capture->fd);
+        g_free (capture->path);
+        g_free (capture);
+        return NULL;
+    }
+
+    memset (&hdr, 0, sizeof (hdr));
+    memcpy (hdr.magic, CAPTURE_FILE_MAGIC, sizeof (hdr.magic));
+    hdr.version = g_htonl (CAPTURE_FILE_VERSION);
+    hdr.record_size = g_htonl (sizeof (CaptureRecord));
+    hdr.start_time = GUINT64_TO_BE ((guint64) time (NULL));
+    if (write (capture->fd, &hdr, sizeof (hdr)) != sizeof (hdr)) {
+        LOG_err (CAPTURE_LOG, "Failed to write to %s: %s", capture->path, strerror (errno));
+        close (capture->fd);
+        g_free (capture->path);
+        g_free (capture);
+        return NULL;
+    }
+
+    capture->start_us = g_get_monotonic_time ();
+    capture->buf = g_new0 (CaptureRecord, CAPTURE_BUFFER_RECORDS);
+
+    capture->ev_flush = event_new (tracker_app_get_evbase (app), -1, EV_PERSIST, capture_on_flush_cb, capture);
+    event_priority_set (capture->ev_flush, TRACKER_PRIO_BULK);
+    event_add (capture->ev_flush, &tv);
+
+    LOG_msg (CAPTURE_LOG, "Capturing announces to %s", capture->path);
+
+    return capture;
+}
+
+void capture_destroy (Capture *capture)
+{
+    if (capture->n_buf)
+        capture_flush (capture);
+
+    LOG_msg (CAPTURE_LOG, "Captured %"G_GUINT64_FORMAT" announces to %s", capture->records, capture->path);
+
+    event_free (capture->ev_flush);
+    close (capture->fd);
+    g_free (capture->buf);
+    g_free (capture->path);
+    g_free (capture);
+}
+
+// SHA1 (key | value), keeps equal values equal within the capture
+static void capture_anonymize (Capture *capture, const void *data, size_t len, uint8_t *out)
+{
+    SHA_CTX ctx;
+
+    SHA1_Init (&ctx);
+    SHA1_Update (&ctx, capture->key, sizeof (capture->key));
+    SHA1_Update (&ctx, data, len);
+    SHA1_Final (out, &ctx);
+}
+
+void capture_announce (Capture *capture, const uint8_t *info_hash, const gchar *peer_id, const gchar *remote_host,
+    gint port, gint event, gint numwant, gint64 uploaded, gint64 downloaded, gint64 left, gboolean compact)
+{
+    CaptureRecord *rec = &capture->buf[capture->n_buf];
+    struct in_addr addr;
+    uint8_t digest[SHA_DIGEST_LENGTH];
+    static const gchar hex[] = "0123456789abcdef";
+    size_t i;
+
+    rec->time_us = GUINT64_TO_BE ((guint64) (g_get_monotonic_time () - capture->start_us));
+
+    capture_anonymize (capture, info_hash, SHA_DIGEST_LENGTH, rec->info_hash);
+    // peer_id is read back as a C string: keep it printable, hex of half the digest
+    capture_anonymize (capture, peer_id, strlen (peer_id), digest);
+    for (i = 0; i < sizeof (rec->peer_id) / 2; i++) {
+        rec->peer_id[i * 2] = hex[digest[i] >> 4];
+        rec->peer_id[i * 2 + 1] = hex[digest[i] & 0x0f];
+    }
+
+    memset (&addr, 0, sizeof (addr));
+    evutil_inet_pton (AF_INET, remote_host, &addr);
+    capture_anonymize (capture, &addr, sizeof (addr), digest);
+    memcpy (&rec->addr, digest, sizeof (rec->addr));
+
+    rec->port = g_htons (port);
+    rec->event = event;
+    rec->flags = (compact ? CAPTURE_FLAG_COMPACT : 0) | (numwant >= 0 ? CAPTURE_FLAG_NUMWANT : 0);
+    rec->numwant = g_htonl (MAX (numwant, 0));
+    rec->uploaded = GUINT64_TO_BE ((guint64) MAX (uploaded, 0));
+    rec->downloaded = GUINT64_TO_BE ((guint64) MAX (downloaded, 0));
+    rec->left = GUINT64_TO_BE ((guint64) MAX (left, 0));
+
+    capture->records++;
+    if (++capture->n_buf == CAPTURE_BUFFER_RECORDS)
+        capture_flush (capture);
+}
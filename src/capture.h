@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2012-2013 Paul Ionkin <paul.ionkin@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#ifndef _CAPTURE_H_
+#define _CAPTURE_H_
+
+#include "global.h"
+
+/*
+ * Announce capture file, replayed with tbfs_replay: header followed by
+ * records, integers in network byte order. info_hash, peer_id and address
+ * are replaced by SHA1 of a random per-capture key and the value, so swarms
+ * and peers keep their identity but can't be traced back. peer_id holds the
+ * first half of its digest in hex, as the tracker takes it for a C string.
+ */
+#define CAPTURE_FILE_MAGIC "TBCP"
+#define CAPTURE_FILE_VERSION 1
+
+typedef struct {
+    char magic[4];
+    guint32 version;
+    guint32 record_size;
+    guint32 reserved;
+    // unix time of the first record
+    guint64 start_time;
+} __attribute__((packed)) CaptureFileHeader;
+
+enum {
+    CAPTURE_FLAG_COMPACT = 1 << 0,
+    // numwant was sent, older captures have 0 for both "not sent" and numwant=0
+    CAPTURE_FLAG_NUMWANT = 1 << 1,
+};
+
+typedef struct {
+    // since capture start
+    guint64 time_us;
+    uint8_t info_hash[SHA_DIGEST_LENGTH];
+    uint8_t peer_id[SHA_DIGEST_LENGTH];
+    guint32 addr;
+    guint16 port;
+    // AnnounceEvent
+    guint8 event;
+    guint8 flags;
+    // as requested, valid if CAPTURE_FLAG_NUMWANT is set
+    guint32 numwant;
+    guint64 uploaded;
+    guint64 downloaded;
+    guint64 left;
+} __attribute__((packed)) CaptureRecord;
+
+typedef struct _Capture Capture;
+
+Capture *capture_create (TrackerApp *app);
+// flushes buffered records
+void capture_destroy (Capture *capture);
+
+// numwant: -1 if not sent
+void capture_announce (Capture *capture, const uint8_t *info_hash, const gchar *peer_id, const gchar *remote_host,
+    gint port, gint event, gint numwant, gint64 uploaded, gint64 downloaded, gint64 left, gboolean compact);
+
+#endif
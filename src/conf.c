@@ -46,6 +46,7 @@ struct _ConfNode {
 };
 
 static void conf_data_destroy (gpointer data);
+static void conf_node_replace (ConfData *conf, ConfNode *conf_node);
 
 #define CONF "conf"
 
@@ -153,8 +154,9 @@ static void end_element_handler (G_GNUC_UNUSED GMarkupParseContext *context, G_G
     if (!conf_node)
         return;
     
+    // replace default value, if any
     if (conf_node->type != CT_NODE)
-        g_hash_table_insert (conf->h_conf, conf_node->full_name, conf_node);
+        conf_node_replace (conf, conf_node);
     else 
         conf_data_destroy (conf_node);
 }
@@ -262,6 +264,20 @@ gboolean conf_parse_file (ConfData *conf, const gchar *filename)
     return TRUE;
 }
 
+// adds node to the table, keeps change callback of the node it replaces
+static void conf_node_replace (ConfData *conf, ConfNode *conf_node)
+{
+    ConfNode *old_node;
+
+    old_node = g_hash_table_lookup (conf->h_conf, conf_node->full_name);
+    if (old_node && !conf_node->change_cb) {
+        conf_node->change_cb = old_node->change_cb;
+        conf_node->user_data = old_node->user_data;
+    }
+
+    g_hash_table_replace (conf->h_conf, conf_node->full_name, conf_node);
+}
+
 /**
  * "section.name"
  */
@@ -287,7 +303,7 @@ void conf_set_string (ConfData *conf, const gchar *full_path, const gchar *val)
     conf_node->type = CT_STRING;
     conf_node->value = g_strdup (val);
 
-    g_hash_table_replace (conf->h_conf, conf_node->full_name, conf_node);
+    conf_node_replace (conf, conf_node);
 }
 
 gboolean conf_get_boolean (ConfData *conf, const gchar *path)
@@ -316,7 +332,7 @@ void conf_set_boolean (ConfData *conf, const gchar *full_path, gboolean val)
     conf_node->type = CT_BOOLEAN;
     conf_node->value = GINT_TO_POINTER (val);
 
-    g_hash_table_replace (conf->h_conf, conf_node->full_name, conf_node);
+    conf_node_replace (conf, conf_node);
 }
 
 gint32 conf_get_int (ConfData *conf, const gchar *path)
@@ -342,7 +358,7 @@ void conf_set_int (ConfData *conf, const gchar *full_path, gint32 val)
     conf_node->type = CT_INT;
     conf_node->value = GINT_TO_POINTER (val);
 
-    g_hash_table_replace (conf->h_conf, conf_node->full_name, conf_node);
+    conf_node_replace (conf, conf_node);
 }
 
 
@@ -368,7 +384,7 @@ void conf_set_uint (ConfData *conf, const gchar *full_path, guint32 val)
     conf_node->type = CT_UINT;
     conf_node->value = GUINT_TO_POINTER (val);
 
-    g_hash_table_replace (conf->h_conf, conf_node->full_name, conf_node);
+    conf_node_replace (conf, conf_node);
 }
 
 GList *conf_get_list (ConfData *conf, const gchar *path)
@@ -402,7 +418,7 @@ void conf_list_set_string (ConfData *conf, const gchar *full_path, const gchar *
         conf_node->name = g_strdup (full_path);
         conf_node->type = CT_LIST;
         conf_node->value = l;
-        g_hash_table_replace (conf->h_conf, conf_node->full_name, conf_node);
+        conf_node_replace (conf, conf_node);
     }
 }
 
@@ -460,3 +476,85 @@ gboolean conf_set_node_change_cb (ConfData *conf, const gchar *path, ConfNodeCha
 
     return TRUE;
 }
+
+static gboolean conf_node_value_equal (ConfNode *a, ConfNode *b)
+{
+    GList *la, *lb;
+
+    if (a->type != b->type)
+        return FALSE;
+
+    if (a->type == CT_STRING)
+        return !g_strcmp0 ((const gchar *) a->value, (const gchar *) b->value);
+
+    if (a->type == CT_LIST) {
+        for (la = g_list_first ((GList *) a->value), lb = g_list_first ((GList *) b->value);
+            la && lb; la = g_list_next (la), lb = g_list_next (lb)) {
+            if (g_strcmp0 ((const gchar *) la->data, (const gchar *) lb->data))
+                return FALSE;
+        }
+        return !la && !lb;
+    }
+
+    return a->value == b->value;
+}
+
+/**
+ * Applies values of new_conf (usually freshly parsed config file) to conf
+ * and calls change callbacks of the nodes which values are changed.
+ * Nodes missing in new_conf keep their current values.
+ * new_conf is destroyed.
+ *
+ * @retval number of changed nodes
+ */
+guint conf_update_from (ConfData *conf, ConfData *new_conf)
+{
+    GHashTableIter iter;
+    ConfNode *new_node, *conf_node;
+    GList *l_changed = NULL, *l;
+    gpointer tmp;
+    guint changed = 0;
+
+    g_hash_table_iter_init (&iter, new_conf->h_conf);
+    while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &new_node)) {
+        conf_node = g_hash_table_lookup (conf->h_conf, new_node->full_name);
+
+        if (!conf_node) {
+            LOG_debug (CONF, "New conf node: %s", new_node->full_name);
+            g_hash_table_iter_steal (&iter);
+            g_hash_table_insert (conf->h_conf, new_node->full_name, new_node);
+            changed++;
+            continue;
+        }
+
+        if (conf_node_value_equal (conf_node, new_node))
+            continue;
+
+        if (conf_node->type != new_node->type) {
+            LOG_err (CONF, "Conf node %s changed its type, ignoring !", new_node->full_name);
+            continue;
+        }
+
+        LOG_debug (CONF, "Conf node changed: %s", new_node->full_name);
+
+        // swap values, old one is freed with new_conf
+        tmp = conf_node->value;
+        conf_node->value = new_node->value;
+        new_node->value = tmp;
+
+        changed++;
+        if (conf_node->change_cb)
+            l_changed = g_list_prepend (l_changed, conf_node);
+    }
+
+    conf_destroy (new_conf);
+
+    // call callbacks when all values are updated
+    for (l = g_list_first (l_changed); l; l = g_list_next (l)) {
+        conf_node = (ConfNode *) l->data;
+        conf_node->change_cb (conf_node->full_name, conf_node->user_data);
+    }
+    g_list_free (l_changed);
+
+    return changed;
+}
@@ -0,0 +1,238 @@
+/*
+ * Copyright (C) 2012-2013 Paul Ionkin <paul.ionkin@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include "hot_torrents.h"
+
+#define HOT_LOG "hot"
+
+#define HOT_SKETCH_DEPTH 4
+#define HOT_SKETCH_WIDTH (1 << 14)
+
+typedef struct {
+    uint8_t info_hash[SHA_DIGEST_LENGTH];
+    guint32 count;
+    // position in a_heap
+    guint idx;
+} HotEntry;
+
+struct _HotTorrents {
+    TrackerApp *app;
+
+    guint32 sketch[HOT_SKETCH_DEPTH][HOT_SKETCH_WIDTH];
+
+    // min-heap by count, of at most top entries
+    HotEntry **a_heap;
+    guint n_heap;
+    guint top;
+    guint32 threshold;
+    // info_hash -> HotEntry of a_heap
+    GHashTable *h_entries;
+
+    struct event *ev_decay;
+};
+
+static guint hot_hash (gconstpointer key)
+{
+    return (guint) sha1_hash64 (key);
+}
+
+static gboolean hot_equal (gconstpointer a, gconstpointer b)
+{
+    return !memcmp (a, b, SHA_DIGEST_LENGTH);
+}
+
+/*{{{ heap */
+static void hot_heap_swap (HotTorrents *hot, guint a, guint b)
+{
+    HotEntry *tmp = hot->a_heap[a];
+
+    hot->a_heap[a] = hot->a_heap[b];
+    hot->a_heap[b] = tmp;
+    hot->a_heap[a]->idx = a;
+    hot->a_heap[b]->idx = b;
+}
+
+// entry's count has grown, move it towards the leaves
+static void hot_heap_sift_down (HotTorrents *hot, guint i)
+{
+    for (;;) {
+        guint l = i * 2 + 1, r = l + 1, min = i;
+
+        if (l < hot->n_heap && hot->a_heap[l]->count < hot->a_heap[min]->count)
+            min = l;
+        if (r < hot->n_heap && hot->a_heap[r]->count < hot->a_heap[min]->count)
+            min = r;
+        if (min == i)
+            break;
+
+        hot_heap_swap (hot, i, min);
+        i = min;
+    }
+}
+
+static void hot_heap_sift_up (HotTorrents *hot, guint i)
+{
+    while (i > 0) {
+        guint parent = (i - 1) / 2;
+
+        if (hot->a_heap[parent]->count <= hot->a_heap[i]->count)
+            break;
+
+        hot_heap_swap (hot, i, parent);
+        i = parent;
+    }
+}
+/*}}}*/
+
+// count-min sketch: increments all rows, returns the minimum
+// row hashes are h1 + i * h2 of the two halves of one 64 bit hash
+static guint32 hot_sketch_add (HotTorrents *hot, const uint8_t *info_hash)
+{
+    guint64 h = sha1_hash64 (info_hash);
+    guint32 h1 = (guint32) h, h2 = (guint32) (h >> 32) | 1;
+    guint32 min = G_MAXUINT32;
+    gint i;
+
+    for (i = 0; i < HOT_SKETCH_DEPTH; i++) {
+        guint32 *c;
+
+        c = &hot->sketch[i][(h1 + i * h2) & (HOT_SKETCH_WIDTH - 1)];
+        if (*c < G_MAXUINT32)
+            (*c)++;
+        min = MIN (min, *c);
+    }
+
+    return min;
+}
+
+void hot_torrents_add (HotTorrents *hot, const uint8_t *info_hash)
+{
+    guint32 count = hot_sketch_add (hot, info_hash);
+    HotEntry *entry;
+
+    entry = g_hash_table_lookup (hot->h_entries, info_hash);
+    if (entry) {
+        entry->count = count;
+        hot_heap_sift_down (hot, entry->idx);
+        return;
+    }
+
+    if (hot->n_heap < hot->top) {
+        entry = g_new0 (HotEntry, 1);
+        entry->idx = hot->n_heap++;
+        hot->a_heap[entry->idx] = entry;
+    } else if (count > hot->a_heap[0]->count) {
+        // replace the coldest one
+        entry = hot->a_heap[0];
+        g_hash_table_remove (hot->h_entries, entry->info_hash);
+    } else
+        return;
+
+    memcpy (entry->info_hash, info_hash, SHA_DIGEST_LENGTH);
+    entry->count = count;
+    g_hash_table_insert (hot->h_entries, entry->info_hash, entry);
+
+    hot_heap_sift_down (hot, entry->idx);
+    hot_heap_sift_up (hot, entry->idx);
+}
+
+gboolean hot_torrents_is_hot (const HotTorrents *hot, const uint8_t *info_hash)
+{
+    const HotEntry *entry = g_hash_table_lookup (hot->h_entries, info_hash);
+
+    return entry && entry->count >= hot->threshold;
+}
+
+// halving keeps the heap order
+static void hot_torrents_on_decay_cb (G_GNUC_UNUSED evutil_socket_t fd, G_GNUC_UNUSED short event, void *ctx)
+{
+    HotTorrents *hot = (HotTorrents *) ctx;
+    guint i, j;
+
+    for (i = 0; i < HOT_SKETCH_DEPTH; i++)
+        for (j = 0; j < HOT_SKETCH_WIDTH; j++)
+            hot->sketch[i][j] >>= 1;
+
+    for (i = 0; i < hot->n_heap; i++)
+        hot->a_heap[i]->count >>= 1;
+}
+
+static gint hot_entry_cmp (gconstpointer a, gconstpointer b)
+{
+    const HotEntry *ea = *(const HotEntry **) a;
+    const HotEntry *eb = *(const HotEntry **) b;
+
+    return (ea->count < eb->count) - (ea->count > eb->count);
+}
+
+void hot_torrents_print (const HotTorrents *hot, struct evbuffer *evb)
+{
+    HotEntry **a_sorted;
+    guint i;
+
+    a_sorted = g_new (HotEntry *, hot->n_heap);
+    memcpy (a_sorted, hot->a_heap, hot->n_heap * sizeof (HotEntry *));
+    qsort (a_sorted, hot->n_heap, sizeof (HotEntry *), hot_entry_cmp);
+
+    for (i = 0; i < hot->n_heap; i++) {
+        gchar hinfo[SHA_DIGEST_LENGTH * 2 + 1];
+
+        if (a_sorted[i]->count < hot->threshold)
+            break;
+
+        sha1_to_hexstr (hinfo, a_sorted[i]->info_hash);
+        evbuffer_add_printf (evb, "%s %u\n", hinfo, a_sorted[i]->count);
+    }
+
+    g_free (a_sorted);
+}
+
+HotTorrents *hot_torrents_create (TrackerApp *app)
+{
+    ConfData *conf = tracker_app_get_conf (app);
+    HotTorrents *hot;
+    struct timeval tv;
+
+    hot = g_new0 (HotTorrents, 1);
+    hot->app = app;
+    hot->top = MAX (conf_get_uint (conf, "hot.top"), 1);
+    hot->threshold = MAX (conf_get_uint (conf, "hot.threshold"), 1);
+    hot->a_heap = g_new0 (HotEntry *, hot->top);
+    hot->h_entries = g_hash_table_new (hot_hash, hot_equal);
+
+    tv.tv_sec = MAX (conf_get_uint (conf, "hot.decay_interval"), 1);
+    tv.tv_usec = 0;
+    hot->ev_decay = event_new (tracker_app_get_evbase (app), -1, EV_PERSIST, hot_torrents_on_decay_cb, hot);
+    event_priority_set (hot->ev_decay, TRACKER_PRIO_BULK);
+    event_add (hot->ev_decay, &tv);
+
+    LOG_msg (HOT_LOG, "Tracking top %u torrents, hot from estimate %u, decay every %ld seconds",
+        hot->top, hot->threshold, (long) tv.tv_sec);
+
+    return hot;
+}
+
+void hot_torrents_destroy (HotTorrents *hot)
+{
+    guint i;
+
+    event_free (hot->ev_decay);
+    g_hash_table_destroy (hot->h_entries);
+    for (i = 0; i < hot->n_heap; i++)
+        g_free (hot->a_heap[i]);
+    g_free (hot->a_heap);
+    g_free (hot);
+}
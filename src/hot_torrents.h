@@ -0,0 +1,40 @@
+/*
+ * Copyright (C) 2012-2013 Paul Ionkin <paul.ionkin@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#ifndef _HOT_TORRENTS_H_
+#define _HOT_TORRENTS_H_
+
+#include "global.h"
+
+/*
+ * Announce rate per info_hash is estimated with a count-min sketch, counters
+ * are halved every hot.decay_interval seconds. The hot.top torrents with the
+ * highest estimates are kept in a min-heap, a torrent is hot if it's there
+ * and its estimate is at least hot.threshold.
+ */
+typedef struct _HotTorrents HotTorrents;
+
+HotTorrents *hot_torrents_create (TrackerApp *app);
+void hot_torrents_destroy (HotTorrents *hot);
+
+// info_hash: binary, SHA_DIGEST_LENGTH bytes
+void hot_torrents_add (HotTorrents *hot, const uint8_t *info_hash);
+gboolean hot_torrents_is_hot (const HotTorrents *hot, const uint8_t *info_hash);
+
+// "<hex info_hash> <estimate>" lines, hottest first
+void hot_torrents_print (const HotTorrents *hot, struct evbuffer *evb);
+
+#endif
@@ -0,0 +1,223 @@
+/*
+ * Copyright (C) 2012-2013 Paul Ionkin <paul.ionkin@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include "https.h"
+
+#ifdef SSL_ENABLED
+
+#include <openssl/err.h>
+
+/*
+ * Clients re-announce every few minutes over a new connection, so most
+ * handshakes can be resumed: sessions are kept in the server side cache
+ * and sent to clients as tickets, for https.session_timeout seconds which
+ * should outlast the announce interval. With https.ktls OpenSSL hands the
+ * record layer to the kernel once the handshake is done, where the kernel
+ * and the cipher support it, otherwise records are handled in user space.
+ */
+
+#define HTTPS_LOG "https"
+
+struct _HttpsServer {
+    TrackerApp *app;
+    SSL_CTX *ctx;
+    struct evhttp *httpd;
+    struct evhttp_bound_socket *bound_socket;
+    guint64 ktls;
+};
+
+static void https_log_ssl_error (const gchar *what)
+{
+    LOG_err (HTTPS_LOG, "%s: %s", what, ERR_error_string (ERR_get_error (), NULL));
+}
+
+static void https_on_info_cb (const SSL *ssl, int where, G_GNUC_UNUSED int ret)
+{
+    HttpsServer *https;
+
+    // TLS 1.3 may report more than one handshake per connection
+    if (!(where & SSL_CB_HANDSHAKE_DONE) || SSL_get_app_data (ssl))
+        return;
+
+    https = (HttpsServer *) SSL_CTX_get_app_data (SSL_get_SSL_CTX (ssl));
+    SSL_set_app_data ((SSL *) ssl, https);
+    if (BIO_get_ktls_send (SSL_get_wbio (ssl)))
+        https->ktls++;
+}
+
+static struct bufferevent *https_on_bev_cb (struct event_base *base, void *ctx)
+{
+    HttpsServer *https = (HttpsServer *) ctx;
+    struct bufferevent *bev;
+    SSL *ssl;
+
+    ssl = SSL_new (https->ctx);
+    if (!ssl) {
+        https_log_ssl_error ("Failed to create SSL connection");
+        return NULL;
+    }
+
+    // evhttp sets the socket, handshake starts then
+    bev = bufferevent_openssl_socket_new (base, -1, ssl, BUFFEREVENT_SSL_ACCEPTING, BEV_OPT_CLOSE_ON_FREE);
+    if (!bev) {
+        SSL_free (ssl);
+        return NULL;
+    }
+    // clients often close without close_notify
+    bufferevent_openssl_set_allow_dirty_shutdown (bev, 1);
+
+    return bev;
+}
+
+static SSL_CTX *https_ctx_create (ConfData *conf)
+{
+    SSL_CTX *ctx;
+    long options = SSL_OP_NO_COMPRESSION | SSL_OP_CIPHER_SERVER_PREFERENCE;
+    guint cache_size = conf_get_uint (conf, "https.session_cache");
+
+    ctx = SSL_CTX_new (TLS_server_method ());
+    if (!ctx) {
+        https_log_ssl_error ("Failed to create SSL context");
+        return NULL;
+    }
+
+    SSL_CTX_set_min_proto_version (ctx, TLS1_2_VERSION);
+
+    if (!conf_get_boolean (conf, "https.tickets"))
+        options |= SSL_OP_NO_TICKET;
+#ifdef SSL_OP_ENABLE_KTLS
+    if (conf_get_boolean (conf, "https.ktls"))
+        options |= SSL_OP_ENABLE_KTLS;
+#endif
+    SSL_CTX_set_options (ctx, options);
+
+    SSL_CTX_set_session_id_context (ctx, (const unsigned char *) PACKAGE, strlen (PACKAGE));
+    SSL_CTX_set_session_cache_mode (ctx, cache_size ? SSL_SESS_CACHE_SERVER : SSL_SESS_CACHE_OFF);
+    SSL_CTX_sess_set_cache_size (ctx, cache_size);
+    // lifetime of both cached sessions and tickets
+    SSL_CTX_set_timeout (ctx, conf_get_uint (conf, "https.session_timeout"));
+
+    if (SSL_CTX_use_certificate_chain_file (ctx, conf_get_string (conf, "https.cert")) != 1 ||
+        SSL_CTX_use_PrivateKey_file (ctx, conf_get_string (conf, "https.key"), SSL_FILETYPE_PEM) != 1 ||
+        SSL_CTX_check_private_key (ctx) != 1) {
+        https_log_ssl_error ("Failed to load certificate");
+        SSL_CTX_free (ctx);
+        return NULL;
+    }
+
+    return ctx;
+}
+
+static struct evhttp_bound_socket *https_bind (HttpsServer *https, const gchar *address, gint port)
+{
+    struct evutil_addrinfo hints, *ai = NULL;
+    struct evconnlistener *listener;
+    gchar service[16];
+
+    memset (&hints, 0, sizeof (hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = EVUTIL_AI_PASSIVE;
+    g_snprintf (service, sizeof (service), "%d", port);
+
+    if (evutil_getaddrinfo (address, service, &hints, &ai) != 0 || !ai) {
+        LOG_err (HTTPS_LOG, "Failed to resolve %s", address);
+        return NULL;
+    }
+
+    listener = evconnlistener_new_bind (tracker_app_get_evbase (https->app), NULL, NULL,
+        LEV_OPT_CLOSE_ON_FREE | LEV_OPT_CLOSE_ON_EXEC | LEV_OPT_REUSEABLE,
+        -1, ai->ai_addr, ai->ai_addrlen);
+    evutil_freeaddrinfo (ai);
+
+    if (!listener) {
+        LOG_err (HTTPS_LOG, "Failed to bind to %s:%d: %s", address, port, strerror (errno));
+        return NULL;
+    }
+
+    return evhttp_bind_listener (https->httpd, listener);
+}
+
+HttpsServer *https_server_create (TrackerApp *app, evutil_socket_t fd)
+{
+    ConfData *conf = tracker_app_get_conf (app);
+    HttpsServer *https;
+
+    https = g_new0 (HttpsServer, 1);
+    https->app = app;
+
+    https->ctx = https_ctx_create (conf);
+    if (!https->ctx) {
+        https_server_destroy (https);
+        return NULL;
+    }
+    SSL_CTX_set_app_data (https->ctx, https);
+    SSL_CTX_set_info_callback (https->ctx, https_on_info_cb);
+
+    https->httpd = evhttp_new (tracker_app_get_evbase (app));
+    evhttp_set_bevcb (https->httpd, https_on_bev_cb, https);
+
+    if (fd >= 0)
+        https->bound_socket = evhttp_accept_socket_with_handle (https->httpd, fd);
+    else
+        https->bound_socket = https_bind (https, conf_get_string (conf, "https.address"), conf_get_int (conf, "https.port"));
+    if (!https->bound_socket) {
+        https_server_destroy (https);
+        return NULL;
+    }
+
+    LOG_debug (HTTPS_LOG, "HTTPS server is running on %s:%d",
+        conf_get_string (conf, "https.address"), conf_get_int (conf, "https.port"));
+
+    return https;
+}
+
+void https_server_destroy (HttpsServer *https)
+{
+    // frees connections and their SSL objects
+    if (https->httpd)
+        evhttp_free (https->httpd);
+    if (https->ctx)
+        SSL_CTX_free (https->ctx);
+    g_free (https);
+}
+
+struct evhttp *https_server_get_httpd (HttpsServer *https)
+{
+    return https->httpd;
+}
+
+evutil_socket_t https_server_get_fd (HttpsServer *https)
+{
+    return https->bound_socket ? evhttp_bound_socket_get_fd (https->bound_socket) : -1;
+}
+
+void https_server_stop_accepting (HttpsServer *https)
+{
+    if (https->bound_socket) {
+        evhttp_del_accept_socket (https->httpd, https->bound_socket);
+        https->bound_socket = NULL;
+    }
+}
+
+void https_server_get_stats (const HttpsServer *https, HttpsStats *stats)
+{
+    stats->handshakes = SSL_CTX_sess_accept_good (https->ctx);
+    stats->resumed = SSL_CTX_sess_hits (https->ctx);
+    stats->ktls = https->ktls;
+}
+
+#endif
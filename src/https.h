@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2012-2013 Paul Ionkin <paul.ionkin@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#ifndef _HTTPS_H_
+#define _HTTPS_H_
+
+#include "global.h"
+
+#ifdef SSL_ENABLED
+
+typedef struct {
+    // full and resumed (session cache or ticket) handshakes
+    guint64 handshakes;
+    guint64 resumed;
+    // connections with the record layer offloaded to the kernel
+    guint64 ktls;
+} HttpsStats;
+
+typedef struct _HttpsServer HttpsServer;
+
+/*
+ * TLS listener on https.address:https.port with the certificate and key
+ * from https.cert / https.key. Requests are served by its own evhttp,
+ * the caller registers the same callbacks on it as on the plain one.
+ * fd: already bound socket (handed over on upgrade) or -1
+ */
+HttpsServer *https_server_create (TrackerApp *app, evutil_socket_t fd);
+void https_server_destroy (HttpsServer *https);
+
+struct evhttp *https_server_get_httpd (HttpsServer *https);
+// listening socket, -1 once it stopped accepting
+evutil_socket_t https_server_get_fd (HttpsServer *https);
+void https_server_stop_accepting (HttpsServer *https);
+void https_server_get_stats (const HttpsServer *https, HttpsStats *stats);
+
+#endif
+
+#endif
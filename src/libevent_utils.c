@@ -58,3 +58,30 @@ const gchar *http_find_header (const struct evkeyvalq *headers, const gchar *key
 
     return evhttp_find_header (headers, key);
 }
+
+/**
+ * Finds all "key=value" pairs of URL query and percent-decodes values,
+ * which must be exactly SHA_DIGEST_LENGTH bytes long (info_hash, peer_id).
+ * Does not allocate memory.
+ *
+ * @retval number of values stored to out
+ */
+guint http_query_find_sha1 (const gchar *query, const gchar *key, uint8_t (*out)[SHA_DIGEST_LENGTH], guint max)
+{
+    size_t key_len = strlen (key);
+    const gchar *p = query;
+    guint found = 0;
+
+    while (p && *p && found < max) {
+        const gchar *end = strchr (p, '&');
+        size_t len = end ? (size_t)(end - p) : strlen (p);
+
+        if (len > key_len && p[key_len] == '=' && !strncmp (p, key, key_len) &&
+            sha1_unescape (out[found], p + key_len + 1, len - key_len - 1))
+            found++;
+
+        p = end ? end + 1 : NULL;
+    }
+
+    return found;
+}
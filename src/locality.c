@@ -0,0 +1,203 @@
+/*
+ * Copyright (C) 2012-2013 Paul Ionkin <paul.ionkin@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include "locality.h"
+
+#define LOCALITY_LOG "locality"
+
+/*
+ * Path-compressed binary radix trie. Nodes are kept in one array and refer
+ * to each other by index, root is node 0 (empty prefix) so child index 0
+ * means "no child".
+ */
+typedef struct {
+    // host byte order, bits after len are zero
+    guint32 prefix;
+    guint32 len;
+    // 0 if no prefix ends at this node
+    guint32 region;
+    guint32 child[2];
+} RegionNode;
+
+struct _RegionMap {
+    GArray *a_nodes;
+    guint count;
+};
+
+#define REGION_NODE(map, i) (&g_array_index ((map)->a_nodes, RegionNode, (i)))
+
+static inline guint32 prefix_mask (guint32 len)
+{
+    return len ? 0xFFFFFFFFU << (32 - len) : 0;
+}
+
+// bit following the first len bits
+static inline guint prefix_bit (guint32 addr, guint32 len)
+{
+    return (addr >> (31 - len)) & 1;
+}
+
+static guint32 region_map_add_node (RegionMap *map, guint32 prefix, guint32 len, guint32 region)
+{
+    RegionNode node;
+
+    memset (&node, 0, sizeof (node));
+    node.prefix = prefix & prefix_mask (len);
+    node.len = len;
+    node.region = region;
+    g_array_append_val (map->a_nodes, node);
+
+    return map->a_nodes->len - 1;
+}
+
+static void region_map_insert (RegionMap *map, guint32 prefix, guint32 len, guint32 region)
+{
+    guint32 cur = 0;
+
+    prefix &= prefix_mask (len);
+
+    for (;;) {
+        RegionNode *node = REGION_NODE (map, cur);
+        RegionNode *child;
+        guint32 c, common, diff, idx;
+        guint bit;
+
+        if (node->len == len) {
+            node->region = region;
+            return;
+        }
+
+        bit = prefix_bit (prefix, node->len);
+        c = node->child[bit];
+        if (!c) {
+            idx = region_map_add_node (map, prefix, len, region);
+            REGION_NODE (map, cur)->child[bit] = idx;
+            return;
+        }
+
+        child = REGION_NODE (map, c);
+        diff = prefix ^ child->prefix;
+        common = diff ? (guint32) __builtin_clz (diff) : 32;
+        common = MIN (common, MIN (len, child->len));
+
+        if (common == child->len) {
+            cur = c;
+            continue;
+        }
+
+        // split the edge to child
+        if (common == len) {
+            guint child_bit = prefix_bit (child->prefix, len);
+
+            idx = region_map_add_node (map, prefix, len, region);
+            REGION_NODE (map, idx)->child[child_bit] = c;
+        } else {
+            guint32 leaf;
+            guint child_bit = prefix_bit (child->prefix, common);
+
+            idx = region_map_add_node (map, prefix, common, 0);
+            leaf = region_map_add_node (map, prefix, len, region);
+            REGION_NODE (map, idx)->child[child_bit] = c;
+            REGION_NODE (map, idx)->child[!child_bit] = leaf;
+        }
+        REGION_NODE (map, cur)->child[bit] = idx;
+        return;
+    }
+}
+
+guint32 region_map_lookup (const RegionMap *map, guint32 addr)
+{
+    const RegionNode *nodes = (const RegionNode *) map->a_nodes->data;
+    const RegionNode *node = &nodes[0];
+    guint32 region = node->region;
+
+    for (;;) {
+        guint32 c;
+
+        if (node->len == 32)
+            break;
+        c = node->child[prefix_bit (addr, node->len)];
+        if (!c)
+            break;
+
+        node = &nodes[c];
+        if ((addr ^ node->prefix) & prefix_mask (node->len))
+            break;
+        if (node->region)
+            region = node->region;
+    }
+
+    return region;
+}
+
+RegionMap *region_map_load (const gchar *path)
+{
+    RegionMap *map;
+    gchar *contents;
+    gchar **lines;
+    GError *error = NULL;
+    guint i;
+
+    if (!g_file_get_contents (path, &contents, NULL, &error)) {
+        LOG_err (LOCALITY_LOG, "Failed to read %s: %s", path, error->message);
+        g_error_free (error);
+        return NULL;
+    }
+
+    map = g_new0 (RegionMap, 1);
+    map->a_nodes = g_array_new (FALSE, FALSE, sizeof (RegionNode));
+    region_map_add_node (map, 0, 0, 0);
+
+    lines = g_strsplit (contents, "\n", -1);
+    g_free (contents);
+
+    for (i = 0; lines[i]; i++) {
+        gchar *line = g_strstrip (lines[i]);
+        gchar ip[INET_ADDRSTRLEN];
+        struct in_addr addr;
+        guint len, region;
+
+        if (!*line || *line == '#')
+            continue;
+
+        if (sscanf (line, "%15[0-9.]/%u %u", ip, &len, &region) != 3 ||
+            evutil_inet_pton (AF_INET, ip, &addr) != 1 || len > 32 || !region) {
+            LOG_err (LOCALITY_LOG, "%s:%u: invalid line: %s", path, i + 1, line);
+            g_strfreev (lines);
+            region_map_destroy (map);
+            return NULL;
+        }
+
+        region_map_insert (map, g_ntohl (addr.s_addr), len, region);
+        map->count++;
+    }
+    g_strfreev (lines);
+
+    LOG_msg (LOCALITY_LOG, "Loaded %s: %u prefixes, %u trie nodes", path, map->count, map->a_nodes->len);
+
+    return map;
+}
+
+void region_map_destroy (RegionMap *map)
+{
+    g_array_free (map->a_nodes, TRUE);
+    g_free (map);
+}
+
+guint region_map_get_count (const RegionMap *map)
+{
+    return map->count;
+}
@@ -0,0 +1,36 @@
+/*
+ * Copyright (C) 2012-2013 Paul Ionkin <paul.ionkin@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#ifndef _LOCALITY_H_
+#define _LOCALITY_H_
+
+#include "global.h"
+
+/*
+ * Prefix to region map for locality-aware peer selection.
+ * Text file, one "a.b.c.d/len region" per line, region is a non-zero number
+ * (ASN, PoP id, ...), lines starting with '#' are ignored.
+ * Longest prefix wins, 0 is returned for addresses not covered by the map.
+ */
+typedef struct _RegionMap RegionMap;
+
+RegionMap *region_map_load (const gchar *path);
+void region_map_destroy (RegionMap *map);
+// addr: host byte order
+guint32 region_map_lookup (const RegionMap *map, guint32 addr);
+guint region_map_get_count (const RegionMap *map);
+
+#endif
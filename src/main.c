@@ -16,311 +16,645 @@
  */
 #include "global.h"
 
+#include "torrent.h"
+#include "replication.h"
+#include "router.h"
+#include "upgrade.h"
+#include "access.h"
+#include "accounting.h"
+#include "trace.h"
+#include "capture.h"
+#include "locality.h"
+#include "shm_stats.h"
+#include "watchdog.h"
+#include "hot_torrents.h"
+#include "torrent_table.h"
+#include "announce.h"
+#include "pipeline.h"
+#include "swarm_store.h"
+#include "supervisor.h"
+#include "https.h"
+
 /*{{{ structs */
-typedef struct {
+struct _TrackerApp {
     ConfData *conf;
     gchar *conf_path;
+    // command line overrides, kept over configuration reloads
+    gchar *cmd_address;
+    gint cmd_port;
+    gboolean cmd_foreground;
+    gboolean cmd_router;
 
     struct event_base *evbase;
     struct evdns_base *dns_base;
     struct evhttp *httpd;
+    struct evhttp_bound_socket *bound_socket;
+#ifdef SSL_ENABLED
+    // TLS listener, NULL if disabled
+    HttpsServer *https;
+#endif
+
+    TorrentTable *torrents;
+    // least recently announced torrents first
+    GQueue q_torrents;
+    struct event *ev_sweep;
+    // a sweep pass runs in slices of sweep_slots table slots at TRACKER_PRIO_BULK
+    struct event *ev_sweep_slice;
+    guint64 sweep_slots;
+    gboolean sweeping;
+    guint64 sweep_cursor;
+    time_t sweep_now;
+    guint64 sweep_peers;
+    guint sweep_torrents;
+    guint64 sweep_passes;
+    guint64 sweep_slices;
+
+    guint64 evicted_torrents;
+    guint64 expired_torrents;
+    guint64 expired_peers;
+    guint64 refused_torrents;
+    // new peer_ids replacing a peer with the same endpoint and key, and
+    // ones sharing the endpoint under another key
+    guint64 duplicate_peers;
+    guint64 endpoint_conflicts;
+
+    // requests by AnnounceEvent
+    guint64 announces[AE_update + 1];
+    guint64 scrapes;
+    guint64 failures;
+    guint64 bad_requests;
+    // announces answered with min_interval_reply
+    guint64 short_circuited;
+    // announces answered without peer selection: stops of
+    // unknown torrents, which allocate nothing, of known ones, and numwant=0
+    guint64 fast_stopped_unknown;
+    guint64 fast_stopped;
+    guint64 fast_numwant_zero;
+
+    // announces parsed during the current loop iteration, NULL if batching is disabled
+    AnnounceRequest *batch;
+    guint batch_max;
+    guint n_batch;
+    struct event *ev_batch;
+    guint64 announce_batches;
+    guint64 batched_announces;
+
+    // warm-up ends at, monotonic seconds, 0 if tracker took over from a running one
+    gint64 warmup_end;
+
+    Replication *repl;
+    Router *router;
+    Upgrade *upgrade;
+
+    // current and previous snapshots, previous one can still be in use
+    TrackerSettings *settings;
+    TrackerSettings *settings_prev;
+    gboolean settings_changed;
+
+    // private tracker tables, NULL if private mode is disabled
+    AccessTables *access;
+    AccessTables *access_prev;
+    Accounting *accounting;
+    Capture *capture;
+    ShmStats *shm_stats;
+    Watchdog *watchdog;
+    HotTorrents *hot;
+    // network threads, NULL if pipeline mode is disabled
+    Pipeline *pipeline;
+    // swarms shared by prefork workers, NULL if prefork mode is disabled
+    SwarmStore *store;
+    // locality-aware peer selection, regions can be NULL
+    gboolean locality;
+    RegionMap *regions;
+    // prefork worker number, -1 if not in prefork mode
+    gint worker;
+#ifdef TRACING_ENABLED
+    Tracer *tracer;
+#endif
+
+    gboolean verbose;
+    struct event *ev_sighup;
+    struct event *ev_sigterm;
+    struct event *ev_sigint;
+};
 
-    GHashTable *h_torrents;
-} TrackerApp;
-
-typedef enum {
-    PS_leecher = 0,
-    PS_seeder = 1,
-} PeerStatus;
+#define APP_LOG "main"
+// max torrents evicted when a new one is added over the memory budget
+#define TRACKER_EVICT_BATCH 8
+/*}}}*/
 
-typedef struct {
-    gchar *peer_id;
-    struct in_addr addr;
-    gint port;
-    PeerStatus status;
-    time_t access_time;
+/*{{{ Torrents */
+Torrent *tracker_get_torrent (TrackerApp *app, const uint8_t *info_hash)
+{
+    return torrent_table_lookup (app->torrents, sha1_hash64 (info_hash), info_hash);
+}
 
-    gint64 uploaded;
-    gint64 downloaded;
-    gint64 left;
-} Peer;
+static gboolean tracker_is_over_budget (TrackerApp *app)
+{
+    const TrackerSettings *settings = tracker_app_get_settings (app);
 
-typedef struct {
-    gchar *info_hash;
+    return settings->max_memory && torrent_get_mem_stats ()->bytes >= settings->max_memory;
+}
 
-    GHashTable *h_peers;
-} Torrent;
+// removes least recently announced torrents, while over the memory budget
+static guint tracker_evict_torrents (TrackerApp *app, guint max_count)
+{
+    Torrent *torrent;
+    guint removed = 0;
 
-typedef enum {
-    AE_started = 0,
-    AE_stopped = 1,
-    AE_completed = 2,
-    AE_update = 3,
-} AnnounceEvent;
+    while (tracker_is_over_budget (app) && removed < max_count &&
+        (torrent = g_queue_peek_head (&app->q_torrents))) {
+        tracker_remove_torrent (app, torrent);
+        removed++;
+    }
+    app->evicted_torrents += removed;
 
-#define APP_LOG "main"
-/*}}}*/
+    return removed;
+}
 
-/*{{{ Peer */
-static Peer *peer_create (const gchar *peer_id, const gchar *remote_addr, gint port)
+/**
+ * Adds new torrent, evicting least recently announced ones if memory budget is exceeded
+ *
+ * @retval NULL if memory budget is exhausted
+ */
+Torrent *tracker_add_torrent (TrackerApp *app, const uint8_t *info_hash)
 {
-    Peer *peer;
+    Torrent *torrent;
 
-    peer = g_new0 (Peer, 1);
-    peer->peer_id = g_strdup (peer_id);
-    
-    evutil_inet_pton (AF_INET, remote_addr, &peer->addr);
-    peer->port = g_htons (port);
-    peer->status = PS_leecher;
-    peer->access_time = time (NULL);
+    tracker_evict_torrents (app, TRACKER_EVICT_BATCH);
+    if (tracker_is_over_budget (app)) {
+        app->refused_torrents++;
+        LOG_debug (APP_LOG, "Memory budget is exhausted, torrent is not added");
+        return NULL;
+    }
 
-    LOG_debug (APP_LOG, "Peer added, id: %s", peer->peer_id);
+    torrent = torrent_create (info_hash);
+    torrent_table_insert (app->torrents, sha1_hash64 (info_hash), torrent);
+    g_queue_push_tail_link (&app->q_torrents, &torrent->lru_link);
 
-    return peer;
+    return torrent;
 }
 
-static void peer_destroy (Peer *peer)
+void tracker_remove_torrent (TrackerApp *app, Torrent *torrent)
 {
-    LOG_debug (APP_LOG, "Peer removed, id: %s", peer->peer_id);
-    
-    g_free (peer->peer_id);
-    g_free (peer);
+    g_queue_unlink (&app->q_torrents, &torrent->lru_link);
+    torrent_table_remove (app->torrents, sha1_hash64 (torrent->info_hash_bin), torrent);
 }
 
-static uint8_t *peer_list_to_compact_val (GList *l_peers, size_t *len)
+// torrent is announced
+void tracker_touch_torrent (TrackerApp *app, Torrent *torrent)
 {
-    GList *l;
-    uint8_t *out, *tmp;;
-
-    *len = g_list_length (l_peers) * 6;
+    if (app->q_torrents.tail != &torrent->lru_link) {
+        g_queue_unlink (&app->q_torrents, &torrent->lru_link);
+        g_queue_push_tail_link (&app->q_torrents, &torrent->lru_link);
+    }
+}
 
-    out = g_new0 (uint8_t, *len);
-    tmp = out;
+void tracker_foreach_torrent (TrackerApp *app, GHFunc func, gpointer user_data)
+{
+    torrent_table_foreach (app->torrents, func, user_data);
+}
 
-    for (l = g_list_first (l_peers); l; l = g_list_next (l)) {
-        Peer *peer = (Peer *) l->data;
+typedef struct {
+    TrackerApp *app;
+    const TrackerSettings *settings;
+    time_t now;
+    guint64 peers;
+} SweepCtx;
 
-        memcpy (tmp, &peer->addr, 4); tmp += 4;
-        memcpy (tmp, &peer->port, 2); tmp += 2;
+static gboolean tracker_app_sweep_torrent (G_GNUC_UNUSED gpointer key, gpointer value, gpointer user_data)
+{
+    SweepCtx *sweep = (SweepCtx *) user_data;
+    Torrent *torrent = (Torrent *) value;
+
+    if (sweep->settings->peer_timeout)
+        sweep->peers += torrent_expire_peers (torrent, sweep->now - sweep->settings->peer_timeout);
+    if (sweep->app->repl)
+        sweep->peers += replication_expire_peers (sweep->app->repl, torrent, sweep->now);
+
+    if (!g_hash_table_size (torrent->h_peers) ||
+        (sweep->settings->torrent_timeout && torrent->access_time < sweep->now - sweep->settings->torrent_timeout)) {
+        g_queue_unlink (&sweep->app->q_torrents, &torrent->lru_link);
+        return TRUE;
     }
 
-    return out;
+    return FALSE;
 }
 
-/*
-// XXX:
-gchar *peer_list_to_dict_str (GList *l_peers)
+// next slice runs after the loop has polled for I/O: an event activated from
+// its own callback would run in the same pass, before pending announces
+static void tracker_app_sweep_next (TrackerApp *app)
 {
-    GList *l;
-    gchar *out;
-    size_t len;
-    struct in_addr *addr;
+    static const struct timeval tv = { 0, 0 };
+
+    event_add (app->ev_sweep_slice, &tv);
+}
+
+// removes expired peers and empty or idle torrents, then evicts torrents
+// over the memory budget, slice by slice
+static void tracker_app_on_sweep_slice_cb (G_GNUC_UNUSED evutil_socket_t fd, G_GNUC_UNUSED short event, void *ctx)
+{
+    TrackerApp *app = (TrackerApp *) ctx;
+    SweepCtx sweep;
+
+    app->sweep_slices++;
 
-    len = g_list_length (l_peers) * (20 ) + 1;
+    if (app->sweeping) {
+        sweep.app = app;
+        sweep.settings = tracker_app_get_settings (app);
+        sweep.now = app->sweep_now;
+        sweep.peers = 0;
 
-    for (l = g_list_first (l_peers); l; l = g_list_next (l)) {
-        Peer *peer = (Peer *) l->data;
+        app->sweeping = !torrent_table_foreach_remove_slice (app->torrents, &app->sweep_cursor, app->sweep_slots,
+            tracker_app_sweep_torrent, &sweep, &app->sweep_torrents);
+        app->sweep_peers += sweep.peers;
+        app->expired_peers += sweep.peers;
+        tracker_app_sweep_next (app);
+        return;
     }
 
+    if (tracker_evict_torrents (app, TRACKER_EVICT_BATCH) == TRACKER_EVICT_BATCH) {
+        tracker_app_sweep_next (app);
+        return;
+    }
+
+    app->expired_torrents += app->sweep_torrents;
+    app->sweep_passes++;
+
+    if (app->sweep_peers || app->sweep_torrents)
+        LOG_debug (APP_LOG, "Removed %"G_GUINT64_FORMAT" expired peers, %u torrents", app->sweep_peers, app->sweep_torrents);
 }
-*/
 
-void peer_update (Peer *peer, gint64 uploaded, gint64 downloaded, gint64 left, AnnounceEvent ev)
+// starts a sweep pass unless the previous one is still running
+static void tracker_app_on_sweep_cb (G_GNUC_UNUSED evutil_socket_t fd, G_GNUC_UNUSED short event, void *ctx)
 {
-    peer->uploaded = uploaded;
-    peer->downloaded = downloaded;
-    peer->left = left;
+    TrackerApp *app = (TrackerApp *) ctx;
+
+    if (event_pending (app->ev_sweep_slice, EV_TIMEOUT, NULL))
+        return;
 
-    if (ev == AE_completed)
-        peer->status = PS_seeder;
+    app->sweeping = TRUE;
+    app->sweep_cursor = 0;
+    app->sweep_now = time (NULL);
+    app->sweep_peers = 0;
+    app->sweep_torrents = 0;
+    tracker_app_sweep_next (app);
 }
 /*}}}*/
 
-/*{{{ Torrent */
-static Torrent *torrent_create (const gchar *info_hash)
+/*{{{ Announce*/
+// priority of the connection's further I/O, keep-alive clients included
+static void tracker_app_set_request_priority (struct evhttp_request *req, gint priority)
 {
-    Torrent *torrent;
+    struct evhttp_connection *evcon = evhttp_request_get_connection (req);
+
+    if (evcon)
+        bufferevent_priority_set (evhttp_connection_get_bufferevent (evcon), priority);
+}
 
-    torrent = g_new0 (Torrent, 1);
-    torrent->info_hash = g_strdup (info_hash);
-    torrent->h_peers = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, (GDestroyNotify) peer_destroy);
+static void tracker_app_send_failure (TrackerApp *app, struct evhttp_request *req, const gchar *reason)
+{
+    struct evbuffer *evb;
 
-    LOG_debug (APP_LOG, "Torrent added, info_hash: %s", torrent->info_hash);
+    app->failures++;
 
-    return torrent;
+    evb = evbuffer_new ();
+    evbuffer_add_printf (evb, "d14:failure reason%zu:%se", strlen (reason), reason);
+    evhttp_send_reply (req, HTTP_OK, "OK", evb);
+    evbuffer_free (evb);
 }
 
-static void torrent_destroy (Torrent *torrent)
+static void tracker_app_announce_failure (TrackerApp *app, AnnounceRequest *areq, const gchar *reason)
 {
-    LOG_debug (APP_LOG, "Torrent removed, info_hash: %s", torrent->info_hash);
+    app->failures++;
 
-    g_hash_table_destroy (torrent->h_peers);
-    g_free (torrent->info_hash);
-    g_free (torrent);
+    areq->code = HTTP_OK;
+    areq->evb = evbuffer_new ();
+    evbuffer_add_printf (areq->evb, "d14:failure reason%zu:%se", strlen (reason), reason);
 }
 
-static Peer *torrent_get_peer (Torrent *torrent, const gchar *peer_id)
+static const gchar *tracker_app_get_remote_host (TrackerApp *app, AnnounceRequest *areq)
 {
-    return (Peer *) g_hash_table_lookup (torrent->h_peers, peer_id);
+    // request is forwarded by tracker router
+    if (tracker_app_get_settings (app)->trust_real_ip && areq->real_ip[0])
+        return areq->real_ip;
+
+    return areq->remote_host;
 }
 
-static Peer *torrent_add_peer (Torrent *torrent, const gchar *peer_id, const gchar *remote_addr, gint port)
+/**
+ * Spreads announces of the same peers in time: during warm-up the interval is
+ * anywhere between warmup_min_interval and interval, otherwise it's off by up
+ * to interval_jitter percent. Both are fixed per peer_id, so a peer keeps its
+ * place in the schedule. The result never goes below min_interval: a peer
+ * coming back on time must not be answered with an empty min_interval reply.
+ */
+static gint tracker_app_get_peer_interval (TrackerApp *app, const TrackerSettings *settings, gint interval, const gchar *peer_id)
 {
-    Peer *peer;
+    guint32 h = g_str_hash (peer_id) * 2654435761U;
+    gint floor_interval = MAX ((gint) settings->min_interval, 1);
+    gint lo, hi;
 
-    peer = peer_create (peer_id, remote_addr, port);
-    g_hash_table_insert (torrent->h_peers, peer->peer_id, peer);
+    interval = MAX (interval, floor_interval);
 
-    return peer;
+    if (app->warmup_end && g_get_monotonic_time () / G_USEC_PER_SEC < app->warmup_end) {
+        lo = MIN ((gint) settings->warmup_min_interval, interval);
+        hi = interval;
+    } else {
+        gint spread = interval * (gint) settings->interval_jitter / 100;
+
+        if (spread <= 0)
+            return interval;
+        lo = interval - spread;
+        hi = interval + spread;
+    }
+
+    lo = MAX (lo, floor_interval);
+
+    return lo + (gint) (h % (guint32) (hi - lo + 1));
 }
 
-static GList *torrent_get_list_of_peers (Torrent *torrent, gint numwant)
+// clears the announce of a client which has gone while waiting in the batch
+static void tracker_app_on_announce_close_cb (G_GNUC_UNUSED struct evhttp_connection *evcon, void *ctx)
 {
-    GList *l = NULL;
-    gint peers = 0;
-    GHashTableIter iter;
-    Peer *peer;
+    AnnounceRequest *areq = (AnnounceRequest *) ctx;
 
-    g_hash_table_iter_init (&iter, torrent->h_peers);
-    while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&peer)) {
-        if (peers > numwant)
-            break;
+    areq->req = NULL;
+}
 
-        l = g_list_prepend (l, peer);
+void tracker_app_announce_prefetch (TrackerApp *app, const AnnounceRequest *areq, gboolean torrent)
+{
+    if (!areq->valid)
+        return;
 
-        peers++;
-    }
+    if (torrent)
+        torrent_table_prefetch_torrent (app->torrents, areq->hash);
+    else
+        torrent_table_prefetch (app->torrents, areq->hash);
+}
 
-    l = g_list_reverse (l);
-    
-    return l;
+// announce inside min_interval: no peers
+static void tracker_app_announce_too_soon (TrackerApp *app, const TrackerSettings *settings, AnnounceRequest *areq, gint interval)
+{
+    app->short_circuited++;
+    areq->code = HTTP_OK;
+    areq->evb = evbuffer_new ();
+    if (interval == settings->interval)
+        evbuffer_add (areq->evb, settings->min_interval_reply, settings->min_interval_reply_len);
+    else
+        evbuffer_add_printf (areq->evb, "d8:intervali%de12:min intervali%ue5:peers0:e", interval, settings->min_interval);
 }
 
-static Torrent *tracker_get_torrent (TrackerApp *app, const gchar *info_hash)
+// peers: compact form
+static void tracker_app_announce_peers (const TrackerSettings *settings, AnnounceRequest *areq, gint interval,
+    const uint8_t *peers, size_t len)
 {
-    return (Torrent *) g_hash_table_lookup (app->h_torrents, info_hash);
+    areq->code = HTTP_OK;
+    areq->evb = evbuffer_new ();
+    evbuffer_add_printf (areq->evb, "d8:intervali%de", interval);
+    if (settings->min_interval)
+        evbuffer_add_printf (areq->evb, "12:min intervali%ue", settings->min_interval);
+    evbuffer_add_printf (areq->evb, "5:peers%zd:", len);
+    evbuffer_add (areq->evb, peers, len);
+    evbuffer_add_printf (areq->evb, "e");
 }
 
-static Torrent *tracker_add_torrent (TrackerApp *app, const gchar *info_hash)
+// no peers, stops and numwant=0: no peer selection, the (jittered) interval
+// is spliced into the precomputed reply. A stopped peer won't announce again,
+// its interval doesn't matter
+static void tracker_app_announce_empty (const TrackerSettings *settings, AnnounceRequest *areq, gint interval)
 {
-    Torrent *torrent;
+    gchar reply[sizeof ("d8:intervali-2147483648") + sizeof (settings->empty_reply_suffix)];
+    gint len;
 
-    torrent = torrent_create (info_hash);
-    g_hash_table_insert (app->h_torrents, torrent->info_hash, torrent);
+    len = g_snprintf (reply, sizeof (reply), "d8:intervali%d", interval);
+    memcpy (reply + len, settings->empty_reply_suffix, settings->empty_reply_suffix_len);
 
-    return torrent;
+    areq->code = HTTP_OK;
+    areq->evb = evbuffer_new ();
+    evbuffer_add (areq->evb, reply, len + settings->empty_reply_suffix_len);
 }
 
-static void torrent_remove_peer (Torrent *torrent, const gchar *peer_id)
+// prefork mode: peers are in the swarm store shared by workers
+static void tracker_app_store_announce (TrackerApp *app, AnnounceRequest *areq, AnnounceEvent ev,
+    gint numwant, gint interval, const struct in_addr *addr)
 {
-    g_hash_table_remove (torrent->h_peers, peer_id);
+    const TrackerSettings *settings = tracker_app_get_settings (app);
+    guint32 now = (guint32) time (NULL);
+    guint32 expire_before = now - settings->peer_timeout;
+    uint8_t *peers;
+    size_t len;
+
+    if (ev == AE_stopped) {
+        swarm_store_remove (app->store, areq->info_hash, areq->peer_id);
+        app->fast_stopped++;
+        tracker_app_announce_empty (settings, areq, settings->interval);
+        return;
+    }
+
+    switch (swarm_store_update (app->store, areq->info_hash, areq->peer_id, addr, g_htons (areq->port),
+        areq->left == 0, ev == AE_completed, now, expire_before, ev == AE_update ? settings->min_interval : 0)) {
+        case SS_full:
+            tracker_app_announce_failure (app, areq, "tracker is full");
+            return;
+        case SS_too_soon:
+            tracker_app_announce_too_soon (app, settings, areq, interval);
+            return;
+        case SS_updated:
+            break;
+    }
+    TRACE_PHASE (areq->trace, TP_lookup);
+
+    interval = tracker_app_get_peer_interval (app, settings, interval, areq->peer_id);
+
+    if (!numwant) {
+        app->fast_numwant_zero++;
+        tracker_app_announce_empty (settings, areq, interval);
+        return;
+    }
+
+    peers = swarm_store_get_peers (app->store, areq->info_hash, areq->peer_id, expire_before, numwant, &len);
+    TRACE_PHASE (areq->trace, TP_peers);
+
+    tracker_app_announce_peers (settings, areq, interval, peers, len);
+    TRACE_PHASE (areq->trace, TP_encode);
+    g_free (peers);
 }
 
-/*}}}*/
+// a new peer_id on the endpoint of a known peer with the same key (or both
+// without one) is the same client restarted, its old entry is dropped
+static void tracker_app_dedup_peer (TrackerApp *app, Torrent *torrent, const struct in_addr *addr, gint port, guint32 key_hash)
+{
+    Peer *dup = torrent_get_peer_by_endpoint (torrent, addr, port);
 
-/*{{{ Announce*/
-static void tracker_app_on_announce_cb (struct evhttp_request *req, void *ctx)
+    if (!dup)
+        return;
+
+    if (dup->key_hash != key_hash) {
+        app->endpoint_conflicts++;
+        return;
+    }
+
+    app->duplicate_peers++;
+    if (app->repl)
+        replication_peer_remove (app->repl, torrent, dup->peer_id);
+    torrent_remove_peer (torrent, dup->peer_id);
+}
+
+void tracker_app_announce_process (TrackerApp *app, AnnounceRequest *areq)
 {
-    TrackerApp *app = (TrackerApp *) ctx;
-    struct evbuffer *evb = NULL;
-    const gchar *query;
-    struct evkeyvalq q_params;
-    const char *info_hash, *peer_id, *compact, *event;
+    const TrackerSettings *settings = tracker_app_get_settings (app);
+    const gchar *peer_id = areq->peer_id;
+    const gchar *passkey = areq->passkey[0] ? areq->passkey : NULL;
     AnnounceEvent ev;
-    const char *tmp;
-    gint64 uploaded, downloaded, left;
-    gint port, numwant;
+    gint numwant, interval;
+    guint64 up_delta = 0, down_delta = 0;
     char hinfo[SHA_DIGEST_LENGTH*3 + 1];
     Torrent *torrent;
     Peer *peer = NULL;
+    struct in_addr addr;
     GList *l;
     uint8_t *peer_list_val;
     size_t len;
 
-    if (!req) {
-        LOG_err (APP_LOG, "req == NULL !");
-        return;
-    }
-
-    LOG_debug (APP_LOG, "[%s:%d] URL: %s", req->remote_host, req->remote_port, req->uri);
-
-    query = evhttp_uri_get_query (evhttp_request_get_evhttp_uri (req));
-    if (!query) {
-        evhttp_send_reply (req, HTTP_NOCONTENT, "Not found", NULL);
+    if (!areq->valid) {
+        app->bad_requests++;
+        areq->code = HTTP_NOCONTENT;
         return;
     }
 
-    TAILQ_INIT (&q_params);
-    evhttp_parse_query_str (query, &q_params);
-
-    port = numwant = 0;
-    uploaded = downloaded = left = 0;
-
-    info_hash = http_find_header (&q_params, "info_hash");
-    peer_id = http_find_header (&q_params, "peer_id");
-    tmp = http_find_header (&q_params, "port");
-    if (tmp)
-        port = atoi (tmp);
-    tmp = http_find_header (&q_params, "uploaded");
-    if (tmp)
-        uploaded = g_ascii_strtoll (tmp, NULL, 10);
-    tmp = http_find_header (&q_params, "downloaded");
-    if (tmp)
-        downloaded = g_ascii_strtoll (tmp, NULL, 10);
-    tmp = http_find_header (&q_params, "left");
-    if (tmp)
-        left = g_ascii_strtoll (tmp, NULL, 10);
-    tmp = http_find_header (&q_params, "numwant");
-    if (tmp)
-        numwant = atoi (tmp);
-    if (!numwant)
-        numwant = conf_get_int (app->conf, "tracker.default_numwant");
-    compact = http_find_header (&q_params, "compact");
-    event = http_find_header (&q_params, "event");
-
-    // sanity check
-    if (!info_hash || !peer_id) {
-        evhttp_send_reply (req, HTTP_NOCONTENT, "Not Found", NULL);
-        evhttp_clear_headers (&q_params);
+    if (passkey && !access_tables_check_torrent (tracker_app_get_access (app), areq->info_hash)) {
+        tracker_app_announce_failure (app, areq, "unregistered torrent");
         return;
     }
 
-    if (event) {
-        if (!strncmp (event, "started", 7)) {
+    if (areq->event) {
+        if (!strncmp (areq->event, "started", 7)) {
             ev = AE_started;
-        } else if (!strncmp (event, "stopped", 7)) {
+        } else if (!strncmp (areq->event, "stopped", 7)) {
             ev = AE_stopped;
-        } else if (!strncmp (event, "completed", 9)) {
+        } else if (!strncmp (areq->event, "completed", 9)) {
             ev = AE_completed;
         } else {
             ev = AE_update;
         }
     } else 
         ev = AE_update;
+    app->announces[ev]++;
+
+    if (app->capture)
+        capture_announce (app->capture, areq->info_hash, peer_id, tracker_app_get_remote_host (app, areq),
+            areq->port, ev, areq->numwant, areq->uploaded, areq->downloaded, areq->left,
+            areq->compact && *areq->compact == '1');
+
+    numwant = areq->numwant;
+    if (numwant < 0)
+        numwant = settings->default_numwant;
+
+    interval = settings->interval;
+    if (app->hot) {
+        hot_torrents_add (app->hot, areq->info_hash);
+        if (settings->hot_interval && hot_torrents_is_hot (app->hot, areq->info_hash))
+            interval = settings->hot_interval;
+    }
 
-    sha1_to_hexstr (hinfo, (const uint8_t *)info_hash);
+    sha1_to_hexstr (hinfo, areq->info_hash);
+    TRACE_PHASE (areq->trace, TP_parse);
 
     LOG_debug (APP_LOG, "%s => peer_id: %s, port: %d, uploaded: %"G_GINT64_FORMAT", downloaded: %"G_GINT64_FORMAT", left: %"G_GINT64_FORMAT", numwant: %d, compact: %s, event: %s", 
-        hinfo, peer_id, port, uploaded, downloaded, left, numwant, compact, event);
+        hinfo, peer_id, areq->port, areq->uploaded, areq->downloaded, areq->left, numwant, areq->compact, areq->event);
+
+    memset (&addr, 0, sizeof (addr));
+    evutil_inet_pton (AF_INET, tracker_app_get_remote_host (app, areq), &addr);
+
+    if (app->store) {
+        tracker_app_store_announce (app, areq, ev, numwant, interval, &addr);
+        return;
+    }
+
+    torrent = torrent_table_lookup (app->torrents, areq->hash, areq->info_hash);
+    // don't create torrent just to remove the peer
+    if (!torrent && ev != AE_stopped)
+        torrent = tracker_add_torrent (app, areq->info_hash);
 
-    torrent = tracker_get_torrent (app, hinfo);
     if (!torrent) {
-        torrent = tracker_add_torrent (app, hinfo);
+        if (ev == AE_stopped) {
+            app->fast_stopped_unknown++;
+            tracker_app_announce_empty (settings, areq, settings->interval);
+        } else
+            tracker_app_announce_failure (app, areq, "tracker is full");
+        return;
     }
+    TRACE_PHASE (areq->trace, TP_lookup);
+
+    // client re-announces too often: no peer selection and no peer / torrent updates
+    if (ev == AE_update && settings->min_interval && (peer = torrent_get_peer (torrent, peer_id)) &&
+        !peer->origin && time (NULL) - peer->access_time < (time_t) settings->min_interval) {
+        tracker_app_announce_too_soon (app, settings, areq, interval);
+        return;
+    }
+
+    interval = tracker_app_get_peer_interval (app, settings, interval, peer_id);
 
     if (ev != AE_stopped) {
+        guint32 key_hash = areq->key ? g_str_hash (areq->key) : 0;
+
         if (!(peer = torrent_get_peer (torrent, peer_id))) {
-            peer = torrent_add_peer (torrent, peer_id, req->remote_host, port);
-        }
+            tracker_app_dedup_peer (app, torrent, &addr, areq->port, key_hash);
+            peer = torrent_add_peer (torrent, peer_id, &addr, areq->port);
+            if (settings->max_peers_per_torrent)
+                torrent_evict_peers (torrent, settings->max_peers_per_torrent);
+
+            // counters of a peer seen in the middle of session are only a baseline
+            if (ev == AE_started)
+                peer_get_transfer_delta (peer, areq->uploaded, areq->downloaded, &up_delta, &down_delta);
+        } else
+            peer_get_transfer_delta (peer, areq->uploaded, areq->downloaded, &up_delta, &down_delta);
+
+        if (ev == AE_completed && peer->status != PS_seeder)
+            torrent->completed++;
         
-        peer_update (peer, uploaded, downloaded, left, ev);
+        peer_update (peer, areq->uploaded, areq->downloaded, areq->left, ev);
+        peer->key_hash = key_hash;
+        torrent_touch_peer (torrent, peer);
+        tracker_touch_torrent (app, torrent);
+        // peer announced itself to this node
+        peer->origin = 0;
+
+        if (app->repl)
+            replication_peer_update (app->repl, torrent, peer, ev);
 
     // remove peer
     } else {
+        Peer *stopped_peer = torrent_get_peer (torrent, peer_id);
+
+        if (stopped_peer)
+            peer_get_transfer_delta (stopped_peer, areq->uploaded, areq->downloaded, &up_delta, &down_delta);
         torrent_remove_peer (torrent, peer_id);
+
+        if (app->repl)
+            replication_peer_remove (app->repl, torrent, peer_id);
+    }
+
+    if (passkey && app->accounting)
+        accounting_add (app->accounting, passkey, up_delta, down_delta);
+
+    if (ev == AE_stopped) {
+        app->fast_stopped++;
+        tracker_app_announce_empty (settings, areq, settings->interval);
+        return;
+    }
+    if (!numwant) {
+        app->fast_numwant_zero++;
+        tracker_app_announce_empty (settings, areq, interval);
+        return;
     }
 
-    l = torrent_get_list_of_peers (torrent, numwant);
+    if (app->locality)
+        l = torrent_get_list_of_local_peers (torrent, peer, &addr, numwant);
+    else
+        l = torrent_get_list_of_peers (torrent, numwant);
+    TRACE_PHASE (areq->trace, TP_peers);
     peer_list_val = peer_list_to_compact_val (l, &len);
 
     LOG_debug (APP_LOG, "Sending list of peers (items: %d, len: %zd) for torrent: %s for peer: %s Total peers: %d (%d)", 
@@ -330,50 +664,729 @@ static void tracker_app_on_announce_cb (struct evhttp_request *req, void *ctx)
         g_hash_table_size (torrent->h_peers), g_list_length (l)
     );
     
-    evb = evbuffer_new ();
-    evbuffer_add_printf (evb, "d8:intervali3600e5:peers%zd:", len);
-    evbuffer_add (evb, peer_list_val, len);
-    evbuffer_add_printf (evb, "e");
+    tracker_app_announce_peers (settings, areq, interval, peer_list_val, len);
+    TRACE_PHASE (areq->trace, TP_encode);
 
     g_list_free (l);
     g_free (peer_list_val);
-    evhttp_send_reply (req, HTTP_OK, "OK", evb);
+}
+
+void tracker_app_announce_done (TrackerApp *app, AnnounceRequest *areq)
+{
+    TRACE_END (areq->trace, app->tracer);
+}
+
+// processes announces queued during this loop iteration: torrents of the whole
+// batch are prefetched before the first one is touched
+static void tracker_app_announce_flush (TrackerApp *app)
+{
+    guint i;
+
+    if (!app->n_batch)
+        return;
+
+    app->announce_batches++;
+    app->batched_announces += app->n_batch;
+
+    for (i = 0; i < app->n_batch; i++)
+        tracker_app_announce_prefetch (app, &app->batch[i], TRUE);
+
+    for (i = 0; i < app->n_batch; i++) {
+        AnnounceRequest *areq = &app->batch[i];
+
+        if (!areq->req) {
+            LOG_debug (APP_LOG, "Client has gone, announce is dropped");
+            announce_request_clear (areq);
+            continue;
+        }
+
+        evhttp_connection_set_closecb (evhttp_request_get_connection (areq->req), NULL, NULL);
+        tracker_app_announce_process (app, areq);
+        announce_request_send_reply (areq);
+        tracker_app_announce_done (app, areq);
+    }
+
+    app->n_batch = 0;
+}
+
+static void tracker_app_on_batch_cb (G_GNUC_UNUSED evutil_socket_t fd, G_GNUC_UNUSED short event, void *ctx)
+{
+    TrackerApp *app = (TrackerApp *) ctx;
+
+    tracker_app_announce_flush (app);
+}
+
+// passkey: already verified, NULL if private mode is disabled
+static void tracker_app_announce (TrackerApp *app, struct evhttp_request *req, const gchar *passkey)
+{
+    AnnounceRequest single;
+    AnnounceRequest *areq;
+
+    tracker_app_set_request_priority (req, TRACKER_PRIO_ANNOUNCE);
+
+    // batching is disabled
+    if (!app->batch) {
+        announce_request_parse (&single, req, passkey);
+        tracker_app_announce_process (app, &single);
+        announce_request_send_reply (&single);
+        tracker_app_announce_done (app, &single);
+        return;
+    }
+
+    areq = &app->batch[app->n_batch];
+    announce_request_parse (areq, req, passkey);
+
+    tracker_app_announce_prefetch (app, areq, FALSE);
+    evhttp_connection_set_closecb (evhttp_request_get_connection (req), tracker_app_on_announce_close_cb, areq);
+
+    // the first announce of the batch schedules the flush right after the
+    // callbacks of the current loop iteration, a lone request waits for nothing
+    app->n_batch++;
+    if (app->n_batch == app->batch_max)
+        tracker_app_announce_flush (app);
+    else if (app->n_batch == 1)
+        event_active (app->ev_batch, EV_TIMEOUT, 0);
+}
+
+static void tracker_app_on_announce_cb (struct evhttp_request *req, void *ctx)
+{
+    TrackerApp *app = (TrackerApp *) ctx;
+
+    if (!req) {
+        LOG_err (APP_LOG, "req == NULL !");
+        return;
+    }
+
+    tracker_app_announce (app, req, NULL);
+}
+/*}}}*/
+
+/*{{{ Scrape */
+gboolean tracker_app_scrape_reply (TrackerApp *app, uint8_t (*info_hash)[SHA_DIGEST_LENGTH], guint n, struct evbuffer *evb)
+{
+    guint i;
+
+    app->scrapes++;
+    // full scrape is not supported
+    if (!n) {
+        app->bad_requests++;
+        return FALSE;
+    }
+
+    evbuffer_add_printf (evb, "d5:filesd");
+
+    for (i = 0; i < n; i++) {
+        Torrent *torrent;
+        guint seeders = 0, leechers = 0, completed = 0;
+
+        torrent = app->store ? NULL : tracker_get_torrent (app, info_hash[i]);
+        if (app->store) {
+            SwarmStoreCounts counts;
+
+            swarm_store_count (app->store, info_hash[i], (guint32) time (NULL) - tracker_app_get_settings (app)->peer_timeout, &counts);
+            seeders = counts.seeders;
+            leechers = counts.leechers;
+            completed = counts.completed;
+        } else if (torrent) {
+            GHashTableIter iter;
+            Peer *peer;
+
+            g_hash_table_iter_init (&iter, torrent->h_peers);
+            while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&peer)) {
+                if (peer->status == PS_seeder)
+                    seeders++;
+                else
+                    leechers++;
+            }
+            completed = torrent->completed;
+        }
+
+        evbuffer_add_printf (evb, "20:");
+        evbuffer_add (evb, info_hash[i], SHA_DIGEST_LENGTH);
+        evbuffer_add_printf (evb, "d8:completei%ue10:downloadedi%ue10:incompletei%uee", seeders, completed, leechers);
+    }
+
+    evbuffer_add_printf (evb, "ee");
+
+    return TRUE;
+}
+
+static void tracker_app_scrape (TrackerApp *app, struct evhttp_request *req)
+{
+    struct evbuffer *evb;
+    const gchar *query;
+    uint8_t info_hash[TRACKER_MAX_SCRAPE][SHA_DIGEST_LENGTH];
+    guint n;
+
+    tracker_app_set_request_priority (req, TRACKER_PRIO_ANNOUNCE);
+
+    query = evhttp_uri_get_query (evhttp_request_get_evhttp_uri (req));
+    n = query ? http_query_find_sha1 (query, "info_hash", info_hash, TRACKER_MAX_SCRAPE) : 0;
+
+    evb = evbuffer_new ();
+    if (tracker_app_scrape_reply (app, info_hash, n, evb))
+        evhttp_send_reply (req, HTTP_OK, "OK", evb);
+    else
+        evhttp_send_reply (req, HTTP_NOCONTENT, "Not Found", NULL);
+    evbuffer_free (evb);
+}
+
+static void tracker_app_on_scrape_cb (struct evhttp_request *req, void *ctx)
+{
+    TrackerApp *app = (TrackerApp *) ctx;
+
+    tracker_app_scrape (app, req);
+}
+/*}}}*/
+
+/*{{{ Private tracker */
+const AccessTables *tracker_app_get_access (TrackerApp *app)
+{
+    return (const AccessTables *) g_atomic_pointer_get (&app->access);
+}
+
+// loads tables from files and swaps them with current ones
+static gboolean tracker_app_update_access (TrackerApp *app)
+{
+    AccessTables *tables;
+
+    tables = access_tables_load (app->conf);
+    if (!tables)
+        return FALSE;
+
+    if (app->access_prev)
+        access_tables_destroy (app->access_prev);
+    app->access_prev = app->access;
+    g_atomic_pointer_set (&app->access, tables);
+
+    return TRUE;
+}
+
+// handles /<passkey>/announce and /<passkey>/scrape
+static gboolean tracker_app_on_private_request (TrackerApp *app, struct evhttp_request *req)
+{
+    const gchar *path, *action;
+    gchar passkey[ACCESS_LIST_MAX_KEY_SIZE + 1];
+    size_t len;
+
+    path = evhttp_uri_get_path (evhttp_request_get_evhttp_uri (req));
+    if (!path || *path != '/')
+        return FALSE;
+    path++;
+
+    action = strchr (path, '/');
+    if (!action)
+        return FALSE;
+
+    if (strcmp (action, "/announce") && strcmp (action, "/scrape"))
+        return FALSE;
+
+    len = action - path;
+    if (!len || len > ACCESS_LIST_MAX_KEY_SIZE) {
+        tracker_app_send_failure (app, req, "invalid passkey");
+        return TRUE;
+    }
+    memcpy (passkey, path, len);
+    passkey[len] = '\0';
+
+    if (!access_tables_check_passkey (tracker_app_get_access (app), passkey)) {
+        tracker_app_send_failure (app, req, "invalid passkey");
+        return TRUE;
+    }
+
+    if (!strcmp (action, "/announce"))
+        tracker_app_announce (app, req, passkey);
+    else
+        tracker_app_scrape (app, req);
+
+    return TRUE;
+}
+
+/*{{{ Stats */
+void tracker_app_get_stats (TrackerApp *app, ShmStatsData *data)
+{
+    const TrackerSettings *settings = tracker_app_get_settings (app);
+    const TorrentMemStats *mem_stats = torrent_get_mem_stats ();
+    guint i;
+
+    for (i = 0; i < G_N_ELEMENTS (app->announces); i++)
+        data->announces[i] = app->announces[i];
+    data->scrapes = app->scrapes;
+    data->failures = app->failures;
+    data->bad_requests = app->bad_requests;
+    data->short_circuited = app->short_circuited;
+
+    data->torrents = mem_stats->torrents;
+    data->peers = mem_stats->peers;
+    data->memory_bytes = mem_stats->bytes;
+    data->memory_limit = settings->max_memory;
+    data->evicted_torrents = app->evicted_torrents;
+    data->evicted_peers = mem_stats->evicted_peers;
+    data->expired_torrents = app->expired_torrents;
+    data->expired_peers = app->expired_peers;
+    data->refused_torrents = app->refused_torrents;
+}
+
+static void tracker_app_print_stats (TrackerApp *app, struct evbuffer *evb)
+{
+    const TrackerSettings *settings = tracker_app_get_settings (app);
+    const TorrentMemStats *mem_stats = torrent_get_mem_stats ();
+
+    evbuffer_add_printf (evb, "torrents: %"G_GUINT64_FORMAT"\n", mem_stats->torrents);
+    evbuffer_add_printf (evb, "peers: %"G_GUINT64_FORMAT"\n", mem_stats->peers);
+    evbuffer_add_printf (evb, "memory_bytes: %"G_GUINT64_FORMAT"\n", mem_stats->bytes);
+    evbuffer_add_printf (evb, "memory_limit: %"G_GUINT64_FORMAT"\n", settings->max_memory);
+    evbuffer_add_printf (evb, "max_peers_per_torrent: %u\n", settings->max_peers_per_torrent);
+    evbuffer_add_printf (evb, "evicted_torrents: %"G_GUINT64_FORMAT"\n", app->evicted_torrents);
+    evbuffer_add_printf (evb, "evicted_peers: %"G_GUINT64_FORMAT"\n", mem_stats->evicted_peers);
+    evbuffer_add_printf (evb, "expired_torrents: %"G_GUINT64_FORMAT"\n", app->expired_torrents);
+    evbuffer_add_printf (evb, "expired_peers: %"G_GUINT64_FORMAT"\n", app->expired_peers);
+    evbuffer_add_printf (evb, "duplicate_peers: %"G_GUINT64_FORMAT"\n", app->duplicate_peers);
+    evbuffer_add_printf (evb, "endpoint_conflicts: %"G_GUINT64_FORMAT"\n", app->endpoint_conflicts);
+    evbuffer_add_printf (evb, "sweep_passes: %"G_GUINT64_FORMAT"\n", app->sweep_passes);
+    evbuffer_add_printf (evb, "sweep_slices: %"G_GUINT64_FORMAT"\n", app->sweep_slices);
+    evbuffer_add_printf (evb, "refused_torrents: %"G_GUINT64_FORMAT"\n", app->refused_torrents);
+    evbuffer_add_printf (evb, "announces_started: %"G_GUINT64_FORMAT"\n", app->announces[AE_started]);
+    evbuffer_add_printf (evb, "announces_stopped: %"G_GUINT64_FORMAT"\n", app->announces[AE_stopped]);
+    evbuffer_add_printf (evb, "announces_completed: %"G_GUINT64_FORMAT"\n", app->announces[AE_completed]);
+    evbuffer_add_printf (evb, "announces_update: %"G_GUINT64_FORMAT"\n", app->announces[AE_update]);
+    evbuffer_add_printf (evb, "scrapes: %"G_GUINT64_FORMAT"\n", app->scrapes);
+    evbuffer_add_printf (evb, "failures: %"G_GUINT64_FORMAT"\n", app->failures);
+    evbuffer_add_printf (evb, "bad_requests: %"G_GUINT64_FORMAT"\n", app->bad_requests);
+    evbuffer_add_printf (evb, "short_circuited: %"G_GUINT64_FORMAT"\n", app->short_circuited);
+    evbuffer_add_printf (evb, "fast_stopped_unknown: %"G_GUINT64_FORMAT"\n", app->fast_stopped_unknown);
+    evbuffer_add_printf (evb, "fast_stopped: %"G_GUINT64_FORMAT"\n", app->fast_stopped);
+    evbuffer_add_printf (evb, "fast_numwant_zero: %"G_GUINT64_FORMAT"\n", app->fast_numwant_zero);
+    evbuffer_add_printf (evb, "announce_batches: %"G_GUINT64_FORMAT"\n", app->announce_batches);
+    evbuffer_add_printf (evb, "batched_announces: %"G_GUINT64_FORMAT"\n", app->batched_announces);
+    if (app->watchdog) {
+        const WatchdogStats *wd_stats = watchdog_get_stats (app->watchdog);
+
+        evbuffer_add_printf (evb, "loop_lag_p50_us: %"G_GUINT64_FORMAT"\n", watchdog_get_lag_percentile (app->watchdog, 50));
+        evbuffer_add_printf (evb, "loop_lag_p99_us: %"G_GUINT64_FORMAT"\n", watchdog_get_lag_percentile (app->watchdog, 99));
+        evbuffer_add_printf (evb, "loop_lag_p999_us: %"G_GUINT64_FORMAT"\n", watchdog_get_lag_percentile (app->watchdog, 99.9));
+        evbuffer_add_printf (evb, "loop_lag_max_us: %"G_GUINT64_FORMAT"\n", wd_stats->lag_max_us);
+        evbuffer_add_printf (evb, "loop_stalls: %"G_GUINT64_FORMAT"\n", wd_stats->stalls);
+    }
+    if (app->locality) {
+        const TorrentLocalityStats *locality_stats = torrent_get_locality_stats ();
+
+        evbuffer_add_printf (evb, "locality_subnet_peers: %"G_GUINT64_FORMAT"\n", locality_stats->subnet);
+        evbuffer_add_printf (evb, "locality_region_peers: %"G_GUINT64_FORMAT"\n", locality_stats->region);
+        evbuffer_add_printf (evb, "locality_random_peers: %"G_GUINT64_FORMAT"\n", locality_stats->random);
+    }
+    if (app->store) {
+        SwarmStoreStats store_stats;
+
+        swarm_store_get_stats (app->store, &store_stats);
+        evbuffer_add_printf (evb, "store_records: %"G_GUINT64_FORMAT"\n", store_stats.records);
+        evbuffer_add_printf (evb, "store_window: %"G_GUINT64_FORMAT"\n", store_stats.window);
+        evbuffer_add_printf (evb, "store_full: %"G_GUINT64_FORMAT"\n", store_stats.full);
+        evbuffer_add_printf (evb, "store_takeovers: %"G_GUINT64_FORMAT"\n", store_stats.takeovers);
+        evbuffer_add_printf (evb, "store_extended: %"G_GUINT64_FORMAT"\n", store_stats.extended);
+    }
+#ifdef SSL_ENABLED
+    if (app->https) {
+        HttpsStats https_stats;
+
+        https_server_get_stats (app->https, &https_stats);
+        evbuffer_add_printf (evb, "https_handshakes: %"G_GUINT64_FORMAT"\n", https_stats.handshakes);
+        evbuffer_add_printf (evb, "https_resumed: %"G_GUINT64_FORMAT"\n", https_stats.resumed);
+        evbuffer_add_printf (evb, "https_ktls: %"G_GUINT64_FORMAT"\n", https_stats.ktls);
+    }
+#endif
+    if (app->pipeline) {
+        PipelineStats pipeline_stats;
+
+        pipeline_get_stats (app->pipeline, &pipeline_stats);
+        evbuffer_add_printf (evb, "pipeline_jobs: %"G_GUINT64_FORMAT"\n", pipeline_stats.jobs);
+        evbuffer_add_printf (evb, "pipeline_wakeups: %"G_GUINT64_FORMAT"\n", pipeline_stats.wakeups);
+        evbuffer_add_printf (evb, "pipeline_busy: %"G_GUINT64_FORMAT"\n", pipeline_stats.busy);
+    }
+}
+
+gboolean tracker_app_print_page (TrackerApp *app, const gchar *path, struct evbuffer *evb)
+{
+    if (!strcmp (path, "/stats")) {
+        tracker_app_print_stats (app, evb);
+        return TRUE;
+    }
+    if (app->hot && !strcmp (path, "/hot")) {
+        hot_torrents_print (app->hot, evb);
+        return TRUE;
+    }
+
+    app->bad_requests++;
+    return FALSE;
+}
+
+static void tracker_app_on_page_cb (struct evhttp_request *req, void *ctx)
+{
+    TrackerApp *app = (TrackerApp *) ctx;
+    struct evbuffer *evb;
+
+    tracker_app_set_request_priority (req, TRACKER_PRIO_BULK);
+
+    evb = evbuffer_new ();
+    if (tracker_app_print_page (app, evhttp_uri_get_path (evhttp_request_get_evhttp_uri (req)), evb)) {
+        evhttp_add_header (evhttp_request_get_output_headers (req), "Content-Type", "text/plain");
+        evhttp_send_reply (req, HTTP_OK, "OK", evb);
+    } else
+        evhttp_send_reply (req, HTTP_NOCONTENT, "Not Found", NULL);
     evbuffer_free (evb);
-    
-    evhttp_clear_headers (&q_params);
 }
+/*}}}*/
 
-static void tracker_app_on_http_gen_cb (struct evhttp_request *req, G_GNUC_UNUSED void *ctx)
+static void tracker_app_on_http_gen_cb (struct evhttp_request *req, void *ctx)
 {
     const gchar *query = NULL;
-    //TrackerApp *app = (TrackerApp *) ctx;
+    TrackerApp *app = (TrackerApp *) ctx;
+    const gchar *path;
 
     if (!req) {
         LOG_err (APP_LOG, "req == NULL !");
         return;
     }
 
+    if (app->access) {
+        if (tracker_app_on_private_request (app, req))
+            return;
+
+        path = evhttp_uri_get_path (evhttp_request_get_evhttp_uri (req));
+        if (path && (!strcmp (path, "/announce") || !strcmp (path, "/scrape"))) {
+            tracker_app_send_failure (app, req, "passkey is required");
+            return;
+        }
+    }
+
     LOG_debug (APP_LOG, "Unknown request [%s:%d] URL: %s", req->remote_host, req->remote_port, req->uri);
 
+    app->bad_requests++;
     evhttp_send_reply (req, HTTP_NOCONTENT, "Not Found", NULL);
 }
 /*}}}*/
 
+/*{{{ Settings */
+static TrackerSettings *tracker_settings_create (ConfData *conf)
+{
+    TrackerSettings *settings;
+
+    settings = g_new0 (TrackerSettings, 1);
+    settings->default_numwant = conf_get_int (conf, "tracker.default_numwant");
+    settings->interval = conf_get_int (conf, "tracker.interval");
+    settings->trust_real_ip = conf_get_boolean (conf, "tracker.trust_real_ip");
+    settings->max_memory = (guint64) conf_get_uint (conf, "tracker.max_memory") * 1024 * 1024;
+    settings->max_peers_per_torrent = conf_get_uint (conf, "tracker.max_peers_per_torrent");
+    settings->peer_timeout = conf_get_uint (conf, "tracker.peer_timeout");
+    settings->torrent_timeout = conf_get_uint (conf, "tracker.torrent_timeout");
+    settings->min_interval = conf_get_uint (conf, "tracker.min_interval");
+    settings->hot_interval = conf_get_uint (conf, "hot.interval");
+    settings->interval_jitter = MIN (conf_get_uint (conf, "tracker.interval_jitter"), 100);
+    settings->warmup_min_interval = conf_get_uint (conf, "tracker.warmup_min_interval");
+    settings->min_interval_reply_len = g_snprintf (settings->min_interval_reply, sizeof (settings->min_interval_reply),
+        "d8:intervali%de12:min intervali%ue5:peers0:e", settings->interval, settings->min_interval);
+    if (settings->min_interval)
+        settings->empty_reply_suffix_len = g_snprintf (settings->empty_reply_suffix, sizeof (settings->empty_reply_suffix),
+            "e12:min intervali%ue5:peers0:e", settings->min_interval);
+    else
+        settings->empty_reply_suffix_len = g_snprintf (settings->empty_reply_suffix, sizeof (settings->empty_reply_suffix),
+            "e5:peers0:e");
+
+    return settings;
+}
+
+const TrackerSettings *tracker_app_get_settings (TrackerApp *app)
+{
+    return (const TrackerSettings *) g_atomic_pointer_get (&app->settings);
+}
+
+static void tracker_app_update_settings (TrackerApp *app)
+{
+    TrackerSettings *settings;
+
+    settings = tracker_settings_create (app->conf);
+
+    g_free (app->settings_prev);
+    app->settings_prev = app->settings;
+    g_atomic_pointer_set (&app->settings, settings);
+}
+
+static void tracker_app_on_settings_changed_cb (G_GNUC_UNUSED const gchar *path, gpointer user_data)
+{
+    TrackerApp *app = (TrackerApp *) user_data;
+
+    app->settings_changed = TRUE;
+}
+
+static void tracker_app_on_log_level_changed_cb (G_GNUC_UNUSED const gchar *path, gpointer user_data)
+{
+    TrackerApp *app = (TrackerApp *) user_data;
+
+    // command line flag wins
+    if (!app->verbose)
+        log_level = conf_get_int (app->conf, "log.level");
+}
+
+static void tracker_app_on_restart_required_cb (const gchar *path, G_GNUC_UNUSED gpointer user_data)
+{
+    LOG_msg (APP_LOG, "Changed value of %s will be applied after restart", path);
+}
+
+static void tracker_app_set_conf_callbacks (TrackerApp *app)
+{
+    const gchar *settings_nodes[] = { "tracker.default_numwant", "tracker.interval", "tracker.trust_real_ip",
+        "tracker.max_memory", "tracker.max_peers_per_torrent", "tracker.peer_timeout", "tracker.torrent_timeout",
+        "tracker.min_interval", "hot.interval", "tracker.interval_jitter", "tracker.warmup_min_interval", NULL };
+    const gchar *restart_nodes[] = { "tracker.address", "tracker.port", "tracker.sweep_interval", "tracker.sweep_slice", "tracker.dedup_peers", "router.enabled",
+        "replication.enabled", "replication.node_id", "replication.address", "replication.port", "private.enabled",
+        "app.cpu_affinity", "app.numa_local", "app.nic", "capture.enabled", "capture.file", "accounting.enabled", "accounting.file", "accounting.flush_interval",
+        "locality.enabled", "locality.regions", "tracker.warmup", "tracker.batch_max",
+        "shm_stats.enabled", "shm_stats.file", "shm_stats.interval",
+        "watchdog.enabled", "watchdog.threshold_ms", "watchdog.file",
+        "hot.enabled", "hot.top", "hot.threshold", "hot.decay_interval",
+        "pipeline.enabled", "pipeline.threads", "pipeline.ring_size", "pipeline.cpus",
+        "https.enabled", "https.address", "https.port", "https.cert", "https.key", "https.session_cache",
+        "https.session_timeout", "https.tickets", "https.ktls",
+        "prefork.enabled", "prefork.workers", "prefork.store", "prefork.store_records", "prefork.store_window", NULL };
+    gint i;
+
+    conf_set_node_change_cb (app->conf, "log.level", tracker_app_on_log_level_changed_cb, app);
+
+    for (i = 0; settings_nodes[i]; i++)
+        conf_set_node_change_cb (app->conf, settings_nodes[i], tracker_app_on_settings_changed_cb, app);
+
+    for (i = 0; restart_nodes[i]; i++)
+        conf_set_node_change_cb (app->conf, restart_nodes[i], tracker_app_on_restart_required_cb, app);
+}
+
+// command line values win over the configuration file
+static void tracker_app_set_cmdline_conf (TrackerApp *app, ConfData *conf)
+{
+    if (app->cmd_address)
+        conf_set_string (conf, "tracker.address", app->cmd_address);
+    if (app->cmd_port)
+        conf_set_int (conf, "tracker.port", app->cmd_port);
+    if (app->cmd_foreground)
+        conf_set_boolean (conf, "app.foreground", TRUE);
+    if (app->cmd_router)
+        conf_set_boolean (conf, "router.enabled", TRUE);
+}
+
+static void tracker_app_on_sighup_cb (G_GNUC_UNUSED evutil_socket_t sig, G_GNUC_UNUSED short events, void *ctx)
+{
+    TrackerApp *app = (TrackerApp *) ctx;
+    ConfData *new_conf;
+    guint changed;
+
+    LOG_msg (APP_LOG, "Reloading configuration file: %s", app->conf_path);
+
+    new_conf = conf_create ();
+    if (access (app->conf_path, R_OK) != 0 || !conf_parse_file (new_conf, app->conf_path)) {
+        LOG_err (APP_LOG, "Failed to parse configuration file: %s, keeping current configuration", app->conf_path);
+        conf_destroy (new_conf);
+        return;
+    }
+    tracker_app_set_cmdline_conf (app, new_conf);
+
+    app->settings_changed = FALSE;
+    changed = conf_update_from (app->conf, new_conf);
+    if (app->settings_changed)
+        tracker_app_update_settings (app);
+
+    // files can be replaced without changing configuration
+    if (app->access && !tracker_app_update_access (app))
+        LOG_err (APP_LOG, "Failed to reload private tracker tables, keeping current ones");
+
+    LOG_msg (APP_LOG, "Configuration is reloaded, %u values changed", changed);
+}
+/*}}}*/
+
 /*{{{ Application */
+// pins event loop and makes its allocations NUMA local, before anything is allocated
+static gboolean tracker_app_set_affinity (TrackerApp *app)
+{
+    const gchar *affinity = conf_get_string (app->conf, "app.cpu_affinity");
+    const gchar *nic = conf_get_string (app->conf, "app.nic");
+    cpu_set_t set;
+    gint node;
+
+    if (affinity && *affinity) {
+        // follow CPUs handling NIC interrupts
+        if (!strcmp (affinity, "nic")) {
+            if (!nic || !*nic || !sys_get_nic_irq_cpus (nic, &set)) {
+                LOG_err (APP_LOG, "Failed to get IRQ CPUs of NIC: %s", nic ? nic : "");
+                return FALSE;
+            }
+        } else if (!sys_parse_cpu_list (affinity, &set)) {
+            LOG_err (APP_LOG, "Invalid CPU list: %s", affinity);
+            return FALSE;
+        }
+
+        // prefork workers are spread over the list, one CPU each by worker number
+        if (app->worker >= 0 && CPU_COUNT (&set) > 1) {
+            gint cpu = sys_cpu_set_get_nth (&set, app->worker);
+
+            CPU_ZERO (&set);
+            CPU_SET (cpu, &set);
+        }
+
+        if (!sys_pin_thread (&set))
+            return FALSE;
+
+        if (conf_get_boolean (app->conf, "app.numa_local")) {
+            node = sys_cpu_set_get_numa_node (&set);
+            if (node >= 0)
+                sys_bind_memory_to_node (node);
+            else
+                LOG_msg (APP_LOG, "CPUs %s span several NUMA nodes, memory policy is not changed", affinity);
+        }
+    }
+
+    sys_log_topology (nic);
+
+    return TRUE;
+}
+
+// exit the loop, so pending accounting and replication deltas are flushed
+static void tracker_app_on_sigterm_cb (evutil_socket_t sig, G_GNUC_UNUSED short events, void *ctx)
+{
+    TrackerApp *app = (TrackerApp *) ctx;
+
+    LOG_msg (APP_LOG, "Received signal %d, exiting", sig);
+    event_base_loopexit (app->evbase, NULL);
+}
+
+struct event_base *tracker_app_get_evbase (TrackerApp *app)
+{
+    return app->evbase;
+}
+
+struct evdns_base *tracker_app_get_dnsbase (TrackerApp *app)
+{
+    return app->dns_base;
+}
+
+ConfData *tracker_app_get_conf (TrackerApp *app)
+{
+    return app->conf;
+}
+
+void tracker_app_get_listen_fds (TrackerApp *app, evutil_socket_t *http_fd, evutil_socket_t *repl_fd, evutil_socket_t *https_fd)
+{
+    *http_fd = app->bound_socket ? evhttp_bound_socket_get_fd (app->bound_socket) : -1;
+    *repl_fd = app->repl ? replication_get_fd (app->repl) : -1;
+#ifdef SSL_ENABLED
+    *https_fd = app->https ? https_server_get_fd (app->https) : -1;
+#else
+    *https_fd = -1;
+#endif
+}
+
+// new process took over listening sockets, finish active requests and exit
+void tracker_app_stop_accepting (TrackerApp *app)
+{
+    struct timeval tv = { 5, 0 };
+
+    if (app->bound_socket) {
+        evhttp_del_accept_socket (app->httpd, app->bound_socket);
+        app->bound_socket = NULL;
+    }
+    if (app->pipeline)
+        pipeline_stop_accepting (app->pipeline);
+#ifdef SSL_ENABLED
+    if (app->https)
+        https_server_stop_accepting (app->https);
+#endif
+
+    if (app->repl) {
+        replication_destroy (app->repl);
+        app->repl = NULL;
+    }
+
+    event_base_loopexit (app->evbase, &tv);
+}
+
+// callbacks are served on both plain and TLS listeners
+static void tracker_app_set_cb (TrackerApp *app, const gchar *path, void (*cb)(struct evhttp_request *, void *), void *arg)
+{
+    evhttp_set_cb (app->httpd, path, cb, arg);
+#ifdef SSL_ENABLED
+    if (app->https)
+        evhttp_set_cb (https_server_get_httpd (app->https), path, cb, arg);
+#endif
+}
+
 static void application_destroy (TrackerApp *app)
 {
+    if (app->upgrade)
+        upgrade_destroy (app->upgrade);
+    if (app->pipeline)
+        pipeline_destroy (app->pipeline);
+    if (app->ev_sighup)
+        event_free (app->ev_sighup);
+    if (app->ev_sigterm)
+        event_free (app->ev_sigterm);
+    if (app->ev_sigint)
+        event_free (app->ev_sigint);
+    if (app->ev_sweep)
+        event_free (app->ev_sweep);
+    if (app->ev_sweep_slice)
+        event_free (app->ev_sweep_slice);
+    if (app->ev_batch)
+        event_free (app->ev_batch);
+    if (app->router)
+        router_destroy (app->router);
+    if (app->accounting)
+        accounting_destroy (app->accounting);
+    if (app->capture)
+        capture_destroy (app->capture);
+    if (app->shm_stats)
+        shm_stats_destroy (app->shm_stats);
+    if (app->watchdog)
+        watchdog_destroy (app->watchdog);
+    if (app->hot)
+        hot_torrents_destroy (app->hot);
+#ifdef TRACING_ENABLED
+    if (app->tracer)
+        tracer_destroy (app->tracer);
+#endif
+    if (app->repl)
+        replication_destroy (app->repl);
     if (app->httpd)
         evhttp_free (app->httpd);
+#ifdef SSL_ENABLED
+    if (app->https)
+        https_server_destroy (app->https);
+#endif
+    // connections are gone, so are the clients of announces left in the batch
+    if (app->batch) {
+        guint i;
+
+        for (i = 0; i < app->n_batch; i++)
+            evhttp_clear_headers (&app->batch[i].q_params);
+        g_free (app->batch);
+    }
     if (app->dns_base)
         evdns_base_free (app->dns_base, 0);
     if (app->evbase)
         event_base_free (app->evbase);
-    if (app->h_torrents)
-        g_hash_table_destroy (app->h_torrents);
+    if (app->torrents)
+        torrent_table_destroy (app->torrents);
+    if (app->store)
+        swarm_store_close (app->store);
+    if (app->regions)
+        region_map_destroy (app->regions);
     if (app->conf)
         conf_destroy (app->conf);
     if (app->conf_path)
         g_free (app->conf_path);
+    g_free (app->cmd_address);
+    g_free (app->settings);
+    g_free (app->settings_prev);
+    if (app->access)
+        access_tables_destroy (app->access);
+    if (app->access_prev)
+        access_tables_destroy (app->access_prev);
     g_free (app);
 }
 
@@ -389,8 +1402,14 @@ int main (G_GNUC_UNUSED int argc, G_GNUC_UNUSED char *argv[])
     gchar conf_str[1023];
     gboolean verbose = FALSE;
     gboolean version = FALSE;
+    gboolean router = FALSE;
+    gboolean upgrade = FALSE;
+    gchar **orig_argv;
+    gint ctl_fd = -1;
+    evutil_socket_t http_fd = -1, repl_fd = -1, https_fd = -1;
 
     app = g_new0 (TrackerApp, 1);
+    app->worker = -1;
     app->conf_path = g_build_filename (SYSCONFDIR, "tbfs_tracker.conf", NULL);
     g_snprintf (conf_str, sizeof (conf_str), "Path to configuration file. Default: %s", app->conf_path);
 
@@ -399,11 +1418,16 @@ int main (G_GNUC_UNUSED int argc, G_GNUC_UNUSED char *argv[])
         { "port", 'p', 0, G_OPTION_ARG_INT, &port, "Port to bind Tracker server to. Default is \"6969\"", NULL },
         { "config", 'c', 0, G_OPTION_ARG_FILENAME_ARRAY, &s_config, conf_str, NULL},
         { "foreground", 'f', 0, G_OPTION_ARG_NONE, &foreground, "Flag. Do not daemonize process.", NULL },
+        { "upgrade", 0, 0, G_OPTION_ARG_NONE, &upgrade, "Flag. Take over listening sockets and torrents from running tracker.", NULL },
+        { "router", 'r', 0, G_OPTION_ARG_NONE, &router, "Flag. Run as router, forwarding requests to backend trackers.", NULL },
         { "verbose", 'v', 0, G_OPTION_ARG_NONE, &verbose, "Verbose output.", NULL },
         { "version", 'V', 0, G_OPTION_ARG_NONE, &version, "Show application version and exit.", NULL },
         { NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL }
     };
 
+    // needed to start new binary on upgrade
+    orig_argv = g_strdupv (argv);
+
     // parse command line arguments
     context = g_option_context_new ("[-a address] [-p port] [-f] [-v]");
     g_option_context_add_main_entries (context, entries, NULL);
@@ -423,6 +1447,101 @@ int main (G_GNUC_UNUSED int argc, G_GNUC_UNUSED char *argv[])
     }
 
     app->conf = conf_create ();
+
+    // default values, config file overrides them
+    conf_set_int (app->conf, "log.level", LOG_msg);
+    conf_set_boolean (app->conf, "app.foreground", FALSE);
+    conf_set_string (app->conf, "tracker.address", "0.0.0.0");
+    conf_set_int (app->conf, "tracker.port", 6969);
+    conf_set_int (app->conf, "tracker.default_numwant", 50);
+    conf_set_int (app->conf, "tracker.interval", 3600);
+    conf_set_string (app->conf, "app.upgrade_socket", "/tmp/tbfs_tracker.upgrade");
+    conf_set_string (app->conf, "app.cpu_affinity", "");
+    conf_set_boolean (app->conf, "app.numa_local", TRUE);
+    conf_set_string (app->conf, "app.nic", "");
+    conf_set_boolean (app->conf, "tracker.trust_real_ip", FALSE);
+    conf_set_uint (app->conf, "tracker.max_memory", 0);
+    conf_set_uint (app->conf, "tracker.max_peers_per_torrent", 0);
+    conf_set_uint (app->conf, "tracker.peer_timeout", 7200);
+    conf_set_uint (app->conf, "tracker.torrent_timeout", 7200);
+    conf_set_uint (app->conf, "tracker.min_interval", 0);
+    conf_set_uint (app->conf, "tracker.interval_jitter", 10);
+    conf_set_uint (app->conf, "tracker.warmup", 0);
+    conf_set_uint (app->conf, "tracker.warmup_min_interval", 300);
+    conf_set_uint (app->conf, "tracker.sweep_interval", 60);
+    conf_set_uint (app->conf, "tracker.sweep_slice", 16384);
+    conf_set_boolean (app->conf, "tracker.dedup_peers", TRUE);
+    conf_set_uint (app->conf, "tracker.batch_max", 32);
+
+    conf_set_boolean (app->conf, "replication.enabled", FALSE);
+    conf_set_uint (app->conf, "replication.node_id", 0);
+    conf_set_string (app->conf, "replication.address", "0.0.0.0");
+    conf_set_int (app->conf, "replication.port", 6970);
+    conf_set_uint (app->conf, "replication.flush_interval", 200);
+    conf_set_uint (app->conf, "replication.peer_ttl", 7200);
+
+    conf_set_boolean (app->conf, "private.enabled", FALSE);
+    conf_set_string (app->conf, "private.passkeys", "");
+    conf_set_string (app->conf, "private.torrents", "");
+
+#ifdef TRACING_ENABLED
+    conf_set_boolean (app->conf, "trace.enabled", FALSE);
+    conf_set_string (app->conf, "trace.file", "/tmp/tbfs_tracker.trace");
+    conf_set_uint (app->conf, "trace.records", 65536);
+    conf_set_uint (app->conf, "trace.sample_every", 1000);
+    conf_set_uint (app->conf, "trace.slow_threshold_us", 10000);
+#endif
+
+    conf_set_boolean (app->conf, "locality.enabled", FALSE);
+    conf_set_string (app->conf, "locality.regions", "");
+
+    conf_set_boolean (app->conf, "shm_stats.enabled", FALSE);
+    conf_set_string (app->conf, "shm_stats.file", "/dev/shm/tbfs_tracker.stats");
+    conf_set_uint (app->conf, "shm_stats.interval", 100);
+
+    conf_set_boolean (app->conf, "watchdog.enabled", FALSE);
+    conf_set_uint (app->conf, "watchdog.threshold_ms", 100);
+    conf_set_string (app->conf, "watchdog.file", "/tmp/tbfs_tracker.stalls");
+
+    conf_set_boolean (app->conf, "hot.enabled", FALSE);
+    conf_set_uint (app->conf, "hot.top", 64);
+    conf_set_uint (app->conf, "hot.threshold", 1000);
+    conf_set_uint (app->conf, "hot.decay_interval", 60);
+    conf_set_uint (app->conf, "hot.interval", 0);
+
+    conf_set_boolean (app->conf, "capture.enabled", FALSE);
+    conf_set_string (app->conf, "capture.file", "/tmp/tbfs_tracker.capture");
+
+    conf_set_boolean (app->conf, "accounting.enabled", FALSE);
+    conf_set_string (app->conf, "accounting.file", "/tmp/tbfs_tracker.accounting");
+    conf_set_uint (app->conf, "accounting.flush_interval", 60);
+
+    conf_set_boolean (app->conf, "router.enabled", FALSE);
+    conf_set_uint (app->conf, "router.connections", 4);
+    conf_set_uint (app->conf, "router.vnodes", 160);
+    conf_set_uint (app->conf, "router.timeout", 5);
+
+    conf_set_boolean (app->conf, "pipeline.enabled", FALSE);
+    conf_set_uint (app->conf, "pipeline.threads", 2);
+    conf_set_uint (app->conf, "pipeline.ring_size", 1024);
+    conf_set_string (app->conf, "pipeline.cpus", "");
+
+    conf_set_boolean (app->conf, "https.enabled", FALSE);
+    conf_set_string (app->conf, "https.address", "0.0.0.0");
+    conf_set_int (app->conf, "https.port", 6443);
+    conf_set_string (app->conf, "https.cert", "/etc/tbfs_tracker/cert.pem");
+    conf_set_string (app->conf, "https.key", "/etc/tbfs_tracker/key.pem");
+    conf_set_uint (app->conf, "https.session_cache", 20480);
+    conf_set_uint (app->conf, "https.session_timeout", 7200);
+    conf_set_boolean (app->conf, "https.tickets", TRUE);
+    conf_set_boolean (app->conf, "https.ktls", TRUE);
+
+    conf_set_boolean (app->conf, "prefork.enabled", FALSE);
+    conf_set_uint (app->conf, "prefork.workers", 4);
+    conf_set_string (app->conf, "prefork.store", "/dev/shm/tbfs_tracker.swarm");
+    conf_set_uint (app->conf, "prefork.store_records", 1048576);
+    conf_set_uint (app->conf, "prefork.store_window", 256);
+
     if (access (app->conf_path, R_OK) == 0) {
         LOG_debug (APP_LOG, "Using config file: %s", app->conf_path);
         if (!conf_parse_file (app->conf, app->conf_path)) {
@@ -430,17 +1549,9 @@ int main (G_GNUC_UNUSED int argc, G_GNUC_UNUSED char *argv[])
             application_destroy (app);
             return -1;
         }
-
-    // default values
-    } else {
-        // XXX: update !
-        conf_set_int (app->conf, "log.level", LOG_msg);
-        conf_set_boolean (app->conf, "app.foreground", FALSE);
-        conf_set_string (app->conf, "tracker.address", "0.0.0.0");
-        conf_set_int (app->conf, "tracker.port", 6969);
-        conf_set_int (app->conf, "tracker.default_numwant", 50);
     }
 
+    app->verbose = verbose;
     if (verbose)
         conf_set_int (app->conf, "log.level", LOG_debug);
 
@@ -459,18 +1570,16 @@ int main (G_GNUC_UNUSED int argc, G_GNUC_UNUSED char *argv[])
         return 0;
     }
 
-    // set address from command line
+    // set address, port, foreground and router from command line
     if (s_address && g_strv_length (s_address) >= 1) {
-        conf_set_string (app->conf, "tracker.address", s_address[0]);
+        app->cmd_address = g_strdup (s_address[0]);
         g_strfreev (s_address);
     }
-    if (port != 6969) {
-        conf_set_int (app->conf, "tracker.port", port);
-    }
-
-    // set foreground
-    if (foreground)
-        conf_set_boolean (app->conf, "app.foreground", foreground);
+    if (port != 6969)
+        app->cmd_port = port;
+    app->cmd_foreground = foreground;
+    app->cmd_router = router;
+    tracker_app_set_cmdline_conf (app, app->conf);
 
     // check that peer_id is set
     if (!conf_get_string (app->conf, "tracker.address")) {
@@ -479,8 +1588,41 @@ int main (G_GNUC_UNUSED int argc, G_GNUC_UNUSED char *argv[])
         return -1;
     }
 
+    if (conf_get_boolean (app->conf, "prefork.enabled")) {
+        gint ret;
+
+        if (upgrade || conf_get_boolean (app->conf, "router.enabled") || conf_get_boolean (app->conf, "replication.enabled") ||
+            conf_get_boolean (app->conf, "private.enabled") || conf_get_boolean (app->conf, "pipeline.enabled") ||
+            conf_get_boolean (app->conf, "capture.enabled") || conf_get_boolean (app->conf, "shm_stats.enabled") ||
+            conf_get_boolean (app->conf, "https.enabled")) {
+            LOG_err (APP_LOG, "Prefork mode doesn't support upgrade, router, replication, private, pipeline, capture, shm_stats and https !");
+            application_destroy (app);
+            return -1;
+        }
+
+        app->store = swarm_store_open (conf_get_string (app->conf, "prefork.store"),
+            conf_get_uint (app->conf, "prefork.store_records"), conf_get_uint (app->conf, "prefork.store_window"));
+        if (!app->store) {
+            LOG_err (APP_LOG, "Failed to open swarm store !");
+            application_destroy (app);
+            return -1;
+        }
+
+        // workers go on with the listening socket, the supervisor returns once they are gone
+        ret = supervisor_run (app->conf, &http_fd, &app->worker);
+        if (ret <= 0) {
+            application_destroy (app);
+            return ret;
+        }
+    }
+
+    if (!tracker_app_set_affinity (app)) {
+        application_destroy (app);
+        return -1;
+    }
+
     app->evbase = event_base_new ();
-    if (!app->evbase) {
+    if (!app->evbase || event_base_priority_init (app->evbase, TRACKER_PRIORITIES) < 0) {
         LOG_err (APP_LOG, "Failed to create event base !");
         application_destroy (app);
         return -1;
@@ -493,13 +1635,52 @@ int main (G_GNUC_UNUSED int argc, G_GNUC_UNUSED char *argv[])
         return -1;
     }
 
-    app->h_torrents = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, (GDestroyNotify) torrent_destroy);
+    tracker_app_update_settings (app);
+
+    // peers are put into locality buckets when added, set it up before any torrent
+    if (conf_get_boolean (app->conf, "locality.enabled")) {
+        const gchar *regions = conf_get_string (app->conf, "locality.regions");
+
+        if (*regions) {
+            app->regions = region_map_load (regions);
+            if (!app->regions) {
+                LOG_err (APP_LOG, "Failed to load locality regions !");
+                application_destroy (app);
+                return -1;
+            }
+        }
+        app->locality = TRUE;
+        torrent_set_locality (TRUE, app->regions);
+    }
+
+    torrent_set_dedup (conf_get_boolean (app->conf, "tracker.dedup_peers"));
+
+    app->torrents = torrent_table_create ();
+    g_queue_init (&app->q_torrents);
 
     app->httpd = evhttp_new (app->evbase);
-    if (evhttp_bind_socket (app->httpd, 
-        conf_get_string (app->conf, "tracker.address"), 
-        conf_get_int (app->conf, "tracker.port")) == -1) 
-    {
+
+    // clients of a running tracker keep their schedule on upgrade
+    if (!upgrade && conf_get_uint (app->conf, "tracker.warmup"))
+        app->warmup_end = g_get_monotonic_time () / G_USEC_PER_SEC + conf_get_uint (app->conf, "tracker.warmup");
+
+    if (upgrade) {
+        ctl_fd = upgrade_receive (app, conf_get_string (app->conf, "app.upgrade_socket"), &http_fd, &repl_fd, &https_fd);
+        if (ctl_fd < 0) {
+            LOG_err (APP_LOG, "Failed to take over running tracker !");
+            application_destroy (app);
+            return -1;
+        }
+    }
+
+    if (http_fd >= 0)
+        app->bound_socket = evhttp_accept_socket_with_handle (app->httpd, http_fd);
+    else
+        app->bound_socket = evhttp_bind_socket_with_handle (app->httpd,
+            conf_get_string (app->conf, "tracker.address"),
+            conf_get_int (app->conf, "tracker.port"));
+
+    if (!app->bound_socket) {
         LOG_err (APP_LOG, "Failed to bind Tracker server to %s:%d",
             conf_get_string (app->conf, "tracker.address"), 
             conf_get_int (app->conf, "tracker.port")
@@ -512,12 +1693,169 @@ int main (G_GNUC_UNUSED int argc, G_GNUC_UNUSED char *argv[])
         conf_get_int (app->conf, "tracker.port")
     );
 
-    evhttp_set_cb (app->httpd, "/announce", tracker_app_on_announce_cb, app);
+    if (conf_get_boolean (app->conf, "https.enabled")) {
+#ifdef SSL_ENABLED
+        app->https = https_server_create (app, https_fd);
+        if (!app->https) {
+            LOG_err (APP_LOG, "Failed to start HTTPS server !");
+            application_destroy (app);
+            return -1;
+        }
+        evhttp_set_gencb (https_server_get_httpd (app->https), tracker_app_on_http_gen_cb, app);
+#else
+        LOG_err (APP_LOG, "Tracker is built without SSL support !");
+        application_destroy (app);
+        return -1;
+#endif
+    }
+    // TLS is disabled after an upgrade
+    else if (https_fd >= 0)
+        evutil_closesocket (https_fd);
+
     evhttp_set_gencb (app->httpd, tracker_app_on_http_gen_cb, app);
+    tracker_app_set_cb (app, "/stats", tracker_app_on_page_cb, app);
+
+    if (conf_get_boolean (app->conf, "pipeline.enabled")) {
+        if (conf_get_boolean (app->conf, "router.enabled") || conf_get_boolean (app->conf, "private.enabled")) {
+            LOG_err (APP_LOG, "Pipeline mode doesn't support router and private modes !");
+            application_destroy (app);
+            return -1;
+        }
+        // network threads accept instead
+        evconnlistener_disable (evhttp_bound_socket_get_listener (app->bound_socket));
+    }
+
+    if (conf_get_boolean (app->conf, "router.enabled")) {
+        app->router = router_create (app);
+        if (!app->router) {
+            LOG_err (APP_LOG, "Failed to start router !");
+            application_destroy (app);
+            return -1;
+        }
+
+        tracker_app_set_cb (app, "/announce", router_on_announce_cb, app->router);
+        tracker_app_set_cb (app, "/scrape", router_on_scrape_cb, app->router);
+    } else if (conf_get_boolean (app->conf, "private.enabled")) {
+        // passkey is a part of the path, requests are handled by gencb
+        if (!tracker_app_update_access (app)) {
+            LOG_err (APP_LOG, "Failed to load private tracker tables !");
+            application_destroy (app);
+            return -1;
+        }
+    } else {
+        tracker_app_set_cb (app, "/announce", tracker_app_on_announce_cb, app);
+        tracker_app_set_cb (app, "/scrape", tracker_app_on_scrape_cb, app);
+    }
+
+    if (!app->router && conf_get_boolean (app->conf, "capture.enabled")) {
+        app->capture = capture_create (app);
+        if (!app->capture) {
+            LOG_err (APP_LOG, "Failed to start capture !");
+            application_destroy (app);
+            return -1;
+        }
+    }
+
+    if (!app->router && conf_get_boolean (app->conf, "hot.enabled")) {
+        app->hot = hot_torrents_create (app);
+        tracker_app_set_cb (app, "/hot", tracker_app_on_page_cb, app);
+    }
+
+#ifdef TRACING_ENABLED
+    if (!app->router && conf_get_boolean (app->conf, "trace.enabled")) {
+        app->tracer = tracer_create (app->conf);
+        if (!app->tracer) {
+            LOG_err (APP_LOG, "Failed to start tracing !");
+            application_destroy (app);
+            return -1;
+        }
+    }
+#endif
+
+    if (!app->router && conf_get_boolean (app->conf, "replication.enabled")) {
+        app->repl = replication_create (app, repl_fd);
+        if (!app->repl) {
+            LOG_err (APP_LOG, "Failed to start replication !");
+            application_destroy (app);
+            return -1;
+        }
+    }
+
+    tracker_app_set_conf_callbacks (app);
+
+    app->ev_sighup = evsignal_new (app->evbase, SIGHUP, tracker_app_on_sighup_cb, app);
+    event_add (app->ev_sighup, NULL);
+    app->ev_sigterm = evsignal_new (app->evbase, SIGTERM, tracker_app_on_sigterm_cb, app);
+    event_add (app->ev_sigterm, NULL);
+    app->ev_sigint = evsignal_new (app->evbase, SIGINT, tracker_app_on_sigterm_cb, app);
+    event_add (app->ev_sigint, NULL);
+
+    if (!app->router) {
+        struct timeval tv = { conf_get_uint (app->conf, "tracker.sweep_interval"), 0 };
+
+        app->ev_sweep = event_new (app->evbase, -1, EV_PERSIST, tracker_app_on_sweep_cb, app);
+        event_priority_set (app->ev_sweep, TRACKER_PRIO_BULK);
+        event_add (app->ev_sweep, &tv);
+        app->ev_sweep_slice = event_new (app->evbase, -1, 0, tracker_app_on_sweep_slice_cb, app);
+        event_priority_set (app->ev_sweep_slice, TRACKER_PRIO_BULK);
+        app->sweep_slots = MAX (conf_get_uint (app->conf, "tracker.sweep_slice"), 1);
+
+        app->batch_max = conf_get_uint (app->conf, "tracker.batch_max");
+        if (app->batch_max > 1 && !conf_get_boolean (app->conf, "pipeline.enabled")) {
+            app->batch = g_new0 (AnnounceRequest, app->batch_max);
+            app->ev_batch = event_new (app->evbase, -1, 0, tracker_app_on_batch_cb, app);
+            event_priority_set (app->ev_batch, TRACKER_PRIO_ANNOUNCE);
+        }
+    }
+
+    // prefork workers are restarted by the supervisor
+    if (!app->store)
+        app->upgrade = upgrade_create (app, orig_argv);
+    g_strfreev (orig_argv);
 
-    if (!conf_get_boolean (app->conf, "app.foreground"))
+    if (!conf_get_boolean (app->conf, "app.foreground") && !app->store)
         wutils_daemonize ();
 
+    // threads don't survive the fork of wutils_daemonize, the stats header holds the pid
+    if (conf_get_boolean (app->conf, "shm_stats.enabled")) {
+        app->shm_stats = shm_stats_create (app);
+        if (!app->shm_stats) {
+            LOG_err (APP_LOG, "Failed to start stats publishing !");
+            application_destroy (app);
+            return -1;
+        }
+    }
+
+    if (app->access && conf_get_boolean (app->conf, "accounting.enabled")) {
+        app->accounting = accounting_create (app);
+        if (!app->accounting) {
+            LOG_err (APP_LOG, "Failed to start accounting !");
+            application_destroy (app);
+            return -1;
+        }
+    }
+
+    if (conf_get_boolean (app->conf, "watchdog.enabled")) {
+        app->watchdog = watchdog_create (app);
+        if (!app->watchdog) {
+            LOG_err (APP_LOG, "Failed to start watchdog !");
+            application_destroy (app);
+            return -1;
+        }
+    }
+
+    if (conf_get_boolean (app->conf, "pipeline.enabled")) {
+        app->pipeline = pipeline_create (app, evhttp_bound_socket_get_fd (app->bound_socket));
+        if (!app->pipeline) {
+            LOG_err (APP_LOG, "Failed to start pipeline !");
+            application_destroy (app);
+            return -1;
+        }
+    }
+
+    if (ctl_fd >= 0)
+        upgrade_send_ready (ctl_fd);
+
     // start the loop
     event_base_dispatch (app->evbase);
 
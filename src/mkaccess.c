@@ -0,0 +1,152 @@
+/*
+ * Copyright (C) 2012-2013 Paul Ionkin <paul.ionkin@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+/*
+ * Builds private tracker access list file from a list of keys, one per line:
+ *   tbfs_mkaccess -o passkeys.bin < passkeys.txt
+ *   tbfs_mkaccess -x -o torrents.bin < info_hashes.txt
+ */
+#include "access.h"
+
+static guint key_size = 0;
+
+static gint key_cmp (gconstpointer a, gconstpointer b)
+{
+    return memcmp (*(const uint8_t **) a, *(const uint8_t **) b, key_size);
+}
+
+static gboolean hex_decode (const gchar *in, size_t len, uint8_t *out)
+{
+    size_t i;
+
+    if (len % 2)
+        return FALSE;
+
+    for (i = 0; i < len; i += 2) {
+        if (!g_ascii_isxdigit (in[i]) || !g_ascii_isxdigit (in[i + 1]))
+            return FALSE;
+        out[i / 2] = (g_ascii_xdigit_value (in[i]) << 4) | g_ascii_xdigit_value (in[i + 1]);
+    }
+
+    return TRUE;
+}
+
+int main (int argc, char *argv[])
+{
+    GOptionContext *context;
+    GError *error = NULL;
+    gchar *out_path = NULL;
+    gboolean hex = FALSE;
+    GPtrArray *a_keys;
+    gchar line[1024];
+    guint line_no = 0, i, count = 0;
+    gchar *tmp_path;
+    AccessListHeader hdr;
+    FILE *f;
+    GOptionEntry entries[] = {
+        { "output", 'o', 0, G_OPTION_ARG_FILENAME, &out_path, "Output file.", NULL },
+        { "hex", 'x', 0, G_OPTION_ARG_NONE, &hex, "Flag. Keys are hex encoded (info_hash).", NULL },
+        { NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL }
+    };
+
+    context = g_option_context_new ("-o output < keys");
+    g_option_context_add_main_entries (context, entries, NULL);
+    if (!g_option_context_parse (context, &argc, &argv, &error) || !out_path) {
+        g_fprintf (stderr, "Failed to parse command line options: %s\n", error ? error->message : "output is not set");
+        g_option_context_free (context);
+        return -1;
+    }
+    g_option_context_free (context);
+
+    a_keys = g_ptr_array_new_with_free_func (g_free);
+
+    while (fgets (line, sizeof (line), stdin)) {
+        gchar *s = g_strstrip (line);
+        size_t len = strlen (s);
+        uint8_t *key;
+
+        line_no++;
+        if (!len || *s == '#')
+            continue;
+
+        if (hex)
+            len /= 2;
+
+        if (!key_size)
+            key_size = len;
+
+        if (len != key_size || len > ACCESS_LIST_MAX_KEY_SIZE) {
+            g_fprintf (stderr, "Line %u: all keys must be %u bytes long\n", line_no, key_size);
+            return -1;
+        }
+
+        key = g_malloc (key_size);
+        if (hex) {
+            if (!hex_decode (s, len * 2, key)) {
+                g_fprintf (stderr, "Line %u: invalid hex string\n", line_no);
+                return -1;
+            }
+        } else
+            memcpy (key, s, key_size);
+
+        g_ptr_array_add (a_keys, key);
+    }
+
+    if (!key_size)
+        key_size = hex ? SHA_DIGEST_LENGTH : 32;
+
+    g_ptr_array_sort (a_keys, key_cmp);
+
+    // write to temporary file and rename it, running tracker has the old one mapped
+    tmp_path = g_strdup_printf ("%s.tmp", out_path);
+    f = fopen (tmp_path, "w");
+    if (!f) {
+        g_fprintf (stderr, "Failed to create %s: %s\n", tmp_path, strerror (errno));
+        return -1;
+    }
+
+    for (i = 0; i < a_keys->len; i++) {
+        if (i && !memcmp (g_ptr_array_index (a_keys, i - 1), g_ptr_array_index (a_keys, i), key_size))
+            continue;
+        count++;
+    }
+
+    memcpy (hdr.magic, ACCESS_LIST_MAGIC, sizeof (hdr.magic));
+    hdr.version = g_htonl (ACCESS_LIST_VERSION);
+    hdr.key_size = g_htonl (key_size);
+    hdr.count = g_htonl (count);
+    fwrite (&hdr, sizeof (hdr), 1, f);
+
+    for (i = 0; i < a_keys->len; i++) {
+        if (i && !memcmp (g_ptr_array_index (a_keys, i - 1), g_ptr_array_index (a_keys, i), key_size))
+            continue;
+        fwrite (g_ptr_array_index (a_keys, i), key_size, 1, f);
+    }
+
+    if (fclose (f) != 0 || rename (tmp_path, out_path) != 0) {
+        g_fprintf (stderr, "Failed to write %s: %s\n", out_path, strerror (errno));
+        unlink (tmp_path);
+        return -1;
+    }
+
+    g_fprintf (stdout, "%s: %u keys of %u bytes\n", out_path, count, key_size);
+
+    g_ptr_array_free (a_keys, TRUE);
+    g_free (tmp_path);
+    g_free (out_path);
+
+    return 0;
+}
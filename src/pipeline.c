@@ -0,0 +1,578 @@
+/*
+ * Copyright (C) 2012-2013 Paul Ionkin <paul.ionkin@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include "pipeline.h"
+#include "announce.h"
+#include <sys/eventfd.h>
+#include <pthread.h>
+
+#define PIPELINE_LOG "pipeline"
+
+#define RING_CACHE_LINE 64
+// requests of a network thread taken by the loop thread between prefetches
+#define PIPELINE_BATCH 32
+
+typedef enum {
+    PJ_announce = 0,
+    PJ_scrape = 1,
+    // /stats, /hot, unknown paths
+    PJ_page = 2,
+} PipelineJobType;
+
+enum {
+    PIPELINE_RUN = 0,
+    PIPELINE_STOP_ACCEPTING = 1,
+    PIPELINE_EXIT = 2,
+};
+
+typedef struct _PipelineWorker PipelineWorker;
+
+typedef struct {
+    PipelineJobType type;
+    // NULL if the client has gone, network thread only
+    struct evhttp_request *req;
+    // taken from the pool of the network thread
+    gboolean in_flight;
+
+    AnnounceRequest areq;
+    // scrape, TRACKER_MAX_SCRAPE entries allocated on the first use
+    uint8_t (*info_hash)[SHA_DIGEST_LENGTH];
+    guint n_info_hash;
+    gchar path[32];
+
+    // reply of scrape and page, NULL if there is no content
+    struct evbuffer *evb;
+} PipelineJob;
+
+/*
+ * Indexes only grow, the slot is index & mask. Each side owns one index and
+ * keeps a copy of the other one, the cache line of the other side is only
+ * read when the ring looks full (producer) or empty (consumer).
+ */
+typedef struct {
+    // consumer side
+    guint64 head;
+    guint64 tail_cache;
+    gchar pad_head[RING_CACHE_LINE - 2 * sizeof (guint64)];
+    // producer side
+    guint64 tail;
+    guint64 head_cache;
+    gchar pad_tail[RING_CACHE_LINE - 2 * sizeof (guint64)];
+
+    PipelineJob **slots;
+    guint64 mask;
+} SpscRing;
+
+struct _PipelineWorker {
+    Pipeline *pipeline;
+    GThread *thread;
+    struct event_base *evbase;
+    struct evhttp *httpd;
+    struct evhttp_bound_socket *bound_socket;
+
+    // network thread -> loop thread
+    SpscRing requests;
+    // loop thread -> network thread
+    SpscRing replies;
+
+    // replies are ready or stop is changed
+    gint efd;
+    struct event *ev_wake;
+    // wakes the loop thread up once the current loop iteration is done
+    struct event *ev_flush;
+    gboolean flush_pending;
+
+    // ring_size jobs: a ring never has more entries than that
+    PipelineJob *jobs;
+    PipelineJob **free_jobs;
+    guint n_free;
+
+    // pipeline.cpus: one CPU of the list, applied by the thread itself
+    gboolean pin;
+    cpu_set_t cpus;
+    // memory policy of the thread, -1 to keep the loop thread's
+    gint numa_node;
+
+    // atomic
+    guint64 busy;
+    gint stop;
+};
+
+struct _Pipeline {
+    TrackerApp *app;
+    // initialized ones
+    PipelineWorker *workers;
+    guint n_workers;
+    guint ring_size;
+
+    // requests are ready
+    gint efd;
+    struct event *ev_wake;
+
+    guint64 jobs;
+    guint64 wakeups;
+};
+
+/*{{{ ring */
+static void spsc_ring_init (SpscRing *ring, guint size)
+{
+    ring->slots = g_new0 (PipelineJob *, size);
+    ring->mask = size - 1;
+}
+
+static void spsc_ring_free (SpscRing *ring)
+{
+    g_free (ring->slots);
+}
+
+// producer thread only
+static gboolean spsc_ring_push (SpscRing *ring, PipelineJob *job)
+{
+    if (ring->tail - ring->head_cache > ring->mask) {
+        ring->head_cache = __atomic_load_n (&ring->head, __ATOMIC_ACQUIRE);
+        if (ring->tail - ring->head_cache > ring->mask)
+            return FALSE;
+    }
+
+    ring->slots[ring->tail & ring->mask] = job;
+    __atomic_store_n (&ring->tail, ring->tail + 1, __ATOMIC_RELEASE);
+
+    return TRUE;
+}
+
+// consumer thread only
+static PipelineJob *spsc_ring_pop (SpscRing *ring)
+{
+    PipelineJob *job;
+
+    if (ring->head == ring->tail_cache) {
+        ring->tail_cache = __atomic_load_n (&ring->tail, __ATOMIC_ACQUIRE);
+        if (ring->head == ring->tail_cache)
+            return NULL;
+    }
+
+    job = ring->slots[ring->head & ring->mask];
+    __atomic_store_n (&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+
+    return job;
+}
+/*}}}*/
+
+static void pipeline_wake (gint efd)
+{
+    uint64_t one = 1;
+
+    // EAGAIN: counter is about to overflow, the other side is awake anyway
+    if (write (efd, &one, sizeof (one)) < 0 && errno != EAGAIN)
+        LOG_err (PIPELINE_LOG, "Failed to write to eventfd: %s", strerror (errno));
+}
+
+static void pipeline_drain (gint efd)
+{
+    uint64_t count;
+
+    if (read (efd, &count, sizeof (count)) < 0 && errno != EAGAIN)
+        LOG_err (PIPELINE_LOG, "Failed to read from eventfd: %s", strerror (errno));
+}
+
+/*{{{ network thread */
+static void pipeline_worker_on_close_cb (G_GNUC_UNUSED struct evhttp_connection *evcon, void *ctx)
+{
+    PipelineJob *job = (PipelineJob *) ctx;
+
+    job->req = NULL;
+}
+
+static void pipeline_worker_on_flush_cb (G_GNUC_UNUSED evutil_socket_t fd, G_GNUC_UNUSED short event, void *ctx)
+{
+    PipelineWorker *worker = (PipelineWorker *) ctx;
+
+    worker->flush_pending = FALSE;
+    pipeline_wake (worker->pipeline->efd);
+}
+
+static void pipeline_worker_on_request_cb (struct evhttp_request *req, void *ctx)
+{
+    PipelineWorker *worker = (PipelineWorker *) ctx;
+    PipelineJob *job;
+    const gchar *path, *query;
+
+    if (!req) {
+        LOG_err (PIPELINE_LOG, "req == NULL !");
+        return;
+    }
+
+    if (!worker->n_free) {
+        __atomic_fetch_add (&worker->busy, 1, __ATOMIC_RELAXED);
+        evhttp_send_reply (req, HTTP_SERVUNAVAIL, "Service Unavailable", NULL);
+        return;
+    }
+    job = worker->free_jobs[--worker->n_free];
+    job->req = req;
+    job->in_flight = TRUE;
+
+    path = evhttp_uri_get_path (evhttp_request_get_evhttp_uri (req));
+    if (!path)
+        path = "";
+
+    if (!strcmp (path, "/announce")) {
+        job->type = PJ_announce;
+        announce_request_parse (&job->areq, req, NULL);
+    } else if (!strcmp (path, "/scrape")) {
+        job->type = PJ_scrape;
+        if (!job->info_hash)
+            job->info_hash = g_malloc (TRACKER_MAX_SCRAPE * SHA_DIGEST_LENGTH);
+        query = evhttp_uri_get_query (evhttp_request_get_evhttp_uri (req));
+        job->n_info_hash = query ? http_query_find_sha1 (query, "info_hash", job->info_hash, TRACKER_MAX_SCRAPE) : 0;
+    } else {
+        job->type = PJ_page;
+        g_strlcpy (job->path, path, sizeof (job->path));
+    }
+
+    evhttp_connection_set_closecb (evhttp_request_get_connection (req), pipeline_worker_on_close_cb, job);
+
+    // can't fail, there are no more jobs than ring slots
+    spsc_ring_push (&worker->requests, job);
+    if (!worker->flush_pending) {
+        worker->flush_pending = TRUE;
+        event_active (worker->ev_flush, EV_TIMEOUT, 0);
+    }
+}
+
+static void pipeline_worker_send_reply (PipelineWorker *worker, PipelineJob *job)
+{
+    if (!job->req) {
+        LOG_debug (PIPELINE_LOG, "Client has gone, reply is dropped");
+        if (job->type == PJ_announce)
+            announce_request_clear (&job->areq);
+    } else {
+        evhttp_connection_set_closecb (evhttp_request_get_connection (job->req), NULL, NULL);
+
+        if (job->type == PJ_announce) {
+            announce_request_send_reply (&job->areq);
+            tracker_app_announce_done (worker->pipeline->app, &job->areq);
+        } else if (job->evb) {
+            if (job->type == PJ_page)
+                evhttp_add_header (evhttp_request_get_output_headers (job->req), "Content-Type", "text/plain");
+            evhttp_send_reply (job->req, HTTP_OK, "OK", job->evb);
+        } else
+            evhttp_send_reply (job->req, HTTP_NOCONTENT, "Not Found", NULL);
+    }
+
+    if (job->evb) {
+        evbuffer_free (job->evb);
+        job->evb = NULL;
+    }
+    job->req = NULL;
+    job->in_flight = FALSE;
+    worker->free_jobs[worker->n_free++] = job;
+}
+
+static void pipeline_worker_on_wake_cb (evutil_socket_t fd, G_GNUC_UNUSED short event, void *ctx)
+{
+    PipelineWorker *worker = (PipelineWorker *) ctx;
+    PipelineJob *job;
+    gint stop;
+
+    pipeline_drain (fd);
+
+    while ((job = spsc_ring_pop (&worker->replies)))
+        pipeline_worker_send_reply (worker, job);
+
+    stop = __atomic_load_n (&worker->stop, __ATOMIC_ACQUIRE);
+    if (stop >= PIPELINE_STOP_ACCEPTING && worker->bound_socket) {
+        evhttp_del_accept_socket (worker->httpd, worker->bound_socket);
+        worker->bound_socket = NULL;
+    }
+    if (stop == PIPELINE_EXIT)
+        event_base_loopbreak (worker->evbase);
+}
+
+static gpointer pipeline_worker_thread (gpointer data)
+{
+    PipelineWorker *worker = (PipelineWorker *) data;
+    sigset_t set;
+
+    // signals are handled by the loop thread
+    sigfillset (&set);
+    pthread_sigmask (SIG_BLOCK, &set, NULL);
+
+    // before the loop allocates buffers, so they come from the local node
+    if (worker->pin && sys_pin_thread (&worker->cpus) && worker->numa_node >= 0)
+        sys_bind_memory_to_node (worker->numa_node);
+
+    event_base_dispatch (worker->evbase);
+
+    return NULL;
+}
+/*}}}*/
+
+/*{{{ loop thread */
+static void pipeline_process_job (Pipeline *pipeline, PipelineJob *job)
+{
+    switch (job->type) {
+        case PJ_announce:
+            // the trace is ended by the network thread once the reply is sent
+            tracker_app_announce_process (pipeline->app, &job->areq);
+            break;
+        case PJ_scrape:
+            job->evb = evbuffer_new ();
+            if (!tracker_app_scrape_reply (pipeline->app, job->info_hash, job->n_info_hash, job->evb)) {
+                evbuffer_free (job->evb);
+                job->evb = NULL;
+            }
+            break;
+        case PJ_page:
+            job->evb = evbuffer_new ();
+            if (!tracker_app_print_page (pipeline->app, job->path, job->evb)) {
+                evbuffer_free (job->evb);
+                job->evb = NULL;
+            }
+            break;
+    }
+}
+
+// takes all requests of the worker, PIPELINE_BATCH at a time: torrent table
+// slots, then torrents of the batch are prefetched before processing
+static void pipeline_process_worker (Pipeline *pipeline, PipelineWorker *worker)
+{
+    PipelineJob *batch[PIPELINE_BATCH];
+    guint n, i;
+    guint64 total = 0;
+
+    do {
+        for (n = 0; n < PIPELINE_BATCH && (batch[n] = spsc_ring_pop (&worker->requests)); n++)
+            if (batch[n]->type == PJ_announce)
+                tracker_app_announce_prefetch (pipeline->app, &batch[n]->areq, FALSE);
+
+        for (i = 0; i < n; i++)
+            if (batch[i]->type == PJ_announce)
+                tracker_app_announce_prefetch (pipeline->app, &batch[i]->areq, TRUE);
+
+        for (i = 0; i < n; i++) {
+            pipeline_process_job (pipeline, batch[i]);
+            // can't fail, there are no more jobs than ring slots
+            spsc_ring_push (&worker->replies, batch[i]);
+        }
+        total += n;
+    } while (n == PIPELINE_BATCH);
+
+    if (total) {
+        pipeline->jobs += total;
+        pipeline_wake (worker->efd);
+    }
+}
+
+static void pipeline_on_wake_cb (evutil_socket_t fd, G_GNUC_UNUSED short event, void *ctx)
+{
+    Pipeline *pipeline = (Pipeline *) ctx;
+    guint i;
+
+    // before draining the rings: a request pushed later wakes the loop again
+    pipeline_drain (fd);
+    pipeline->wakeups++;
+
+    for (i = 0; i < pipeline->n_workers; i++)
+        pipeline_process_worker (pipeline, &pipeline->workers[i]);
+}
+/*}}}*/
+
+static gboolean pipeline_worker_init (Pipeline *pipeline, PipelineWorker *worker, evutil_socket_t http_fd)
+{
+    evutil_socket_t fd;
+    guint i;
+
+    worker->pipeline = pipeline;
+
+    worker->efd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (worker->efd < 0) {
+        LOG_err (PIPELINE_LOG, "Failed to create eventfd: %s", strerror (errno));
+        return FALSE;
+    }
+
+    spsc_ring_init (&worker->requests, pipeline->ring_size);
+    spsc_ring_init (&worker->replies, pipeline->ring_size);
+    worker->jobs = g_new0 (PipelineJob, pipeline->ring_size);
+    worker->free_jobs = g_new (PipelineJob *, pipeline->ring_size);
+    for (i = 0; i < pipeline->ring_size; i++)
+        worker->free_jobs[i] = &worker->jobs[pipeline->ring_size - 1 - i];
+    worker->n_free = pipeline->ring_size;
+
+    worker->evbase = event_base_new ();
+    worker->httpd = evhttp_new (worker->evbase);
+    evhttp_set_gencb (worker->httpd, pipeline_worker_on_request_cb, worker);
+    worker->ev_wake = event_new (worker->evbase, worker->efd, EV_READ | EV_PERSIST, pipeline_worker_on_wake_cb, worker);
+    event_add (worker->ev_wake, NULL);
+    worker->ev_flush = event_new (worker->evbase, -1, 0, pipeline_worker_on_flush_cb, worker);
+
+    // every thread accepts on its own descriptor of the listening socket
+    fd = dup (http_fd);
+    if (fd >= 0)
+        worker->bound_socket = evhttp_accept_socket_with_handle (worker->httpd, fd);
+    if (!worker->bound_socket) {
+        LOG_err (PIPELINE_LOG, "Failed to accept on listening socket: %s", strerror (errno));
+        if (fd >= 0)
+            close (fd);
+    }
+
+    // freed by pipeline_destroy in any case
+    return worker->bound_socket != NULL;
+}
+
+static void pipeline_worker_free (PipelineWorker *worker)
+{
+    guint i;
+
+    // connections are closed, close callbacks clear job->req
+    if (worker->httpd)
+        evhttp_free (worker->httpd);
+
+    // requests the loop thread has not taken and replies which were not sent
+    for (i = 0; worker->jobs && i < worker->pipeline->ring_size; i++) {
+        PipelineJob *job = &worker->jobs[i];
+
+        if (job->in_flight && job->type == PJ_announce)
+            announce_request_clear (&job->areq);
+        if (job->evb)
+            evbuffer_free (job->evb);
+        g_free (job->info_hash);
+    }
+
+    if (worker->ev_wake)
+        event_free (worker->ev_wake);
+    if (worker->ev_flush)
+        event_free (worker->ev_flush);
+    if (worker->evbase)
+        event_base_free (worker->evbase);
+    if (worker->efd >= 0)
+        close (worker->efd);
+
+    spsc_ring_free (&worker->requests);
+    spsc_ring_free (&worker->replies);
+    g_free (worker->jobs);
+    g_free (worker->free_jobs);
+}
+
+Pipeline *pipeline_create (TrackerApp *app, evutil_socket_t http_fd)
+{
+    ConfData *conf = tracker_app_get_conf (app);
+    const gchar *cpus = conf_get_string (conf, "pipeline.cpus");
+    Pipeline *pipeline;
+    cpu_set_t set;
+    guint threads, i;
+
+    if (cpus && *cpus && !sys_parse_cpu_list (cpus, &set)) {
+        LOG_err (PIPELINE_LOG, "Invalid CPU list: %s", cpus);
+        return NULL;
+    }
+
+    pipeline = g_new0 (Pipeline, 1);
+    pipeline->app = app;
+
+    // ring indexes are masked
+    pipeline->ring_size = 2;
+    while (pipeline->ring_size < conf_get_uint (conf, "pipeline.ring_size"))
+        pipeline->ring_size *= 2;
+
+    pipeline->efd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (pipeline->efd < 0) {
+        LOG_err (PIPELINE_LOG, "Failed to create eventfd: %s", strerror (errno));
+        g_free (pipeline);
+        return NULL;
+    }
+    pipeline->ev_wake = event_new (tracker_app_get_evbase (app), pipeline->efd, EV_READ | EV_PERSIST, pipeline_on_wake_cb, pipeline);
+    event_priority_set (pipeline->ev_wake, TRACKER_PRIO_ANNOUNCE);
+    event_add (pipeline->ev_wake, NULL);
+
+    threads = MAX (conf_get_uint (conf, "pipeline.threads"), 1);
+    pipeline->workers = g_new0 (PipelineWorker, threads);
+    for (i = 0; i < threads; i++) {
+        pipeline->n_workers++;
+        if (!pipeline_worker_init (pipeline, &pipeline->workers[i], http_fd)) {
+            pipeline_destroy (pipeline);
+            return NULL;
+        }
+    }
+
+    // network thread N gets the N-th CPU of the list (wrapping around)
+    for (i = 0; i < pipeline->n_workers; i++) {
+        PipelineWorker *worker = &pipeline->workers[i];
+        gint cpu;
+
+        worker->numa_node = -1;
+        if (!cpus || !*cpus)
+            continue;
+
+        cpu = sys_cpu_set_get_nth (&set, i);
+        worker->pin = TRUE;
+        CPU_ZERO (&worker->cpus);
+        CPU_SET (cpu, &worker->cpus);
+        if (conf_get_boolean (conf, "app.numa_local"))
+            worker->numa_node = sys_cpu_get_numa_node (cpu);
+    }
+
+    for (i = 0; i < pipeline->n_workers; i++)
+        pipeline->workers[i].thread = g_thread_new ("pipeline", pipeline_worker_thread, &pipeline->workers[i]);
+
+    LOG_msg (PIPELINE_LOG, "Pipeline mode: %u network threads, %u requests in flight per thread, CPUs %s",
+        pipeline->n_workers, pipeline->ring_size, cpus && *cpus ? cpus : "not pinned");
+
+    return pipeline;
+}
+
+void pipeline_destroy (Pipeline *pipeline)
+{
+    guint i;
+
+    for (i = 0; i < pipeline->n_workers; i++) {
+        PipelineWorker *worker = &pipeline->workers[i];
+
+        if (!worker->thread)
+            continue;
+        __atomic_store_n (&worker->stop, PIPELINE_EXIT, __ATOMIC_RELEASE);
+        pipeline_wake (worker->efd);
+        g_thread_join (worker->thread);
+    }
+
+    for (i = 0; i < pipeline->n_workers; i++)
+        pipeline_worker_free (&pipeline->workers[i]);
+
+    event_free (pipeline->ev_wake);
+    close (pipeline->efd);
+    g_free (pipeline->workers);
+    g_free (pipeline);
+}
+
+void pipeline_stop_accepting (Pipeline *pipeline)
+{
+    guint i;
+
+    for (i = 0; i < pipeline->n_workers; i++) {
+        __atomic_store_n (&pipeline->workers[i].stop, PIPELINE_STOP_ACCEPTING, __ATOMIC_RELEASE);
+        pipeline_wake (pipeline->workers[i].efd);
+    }
+}
+
+void pipeline_get_stats (Pipeline *pipeline, PipelineStats *stats)
+{
+    guint i;
+
+    stats->jobs = pipeline->jobs;
+    stats->wakeups = pipeline->wakeups;
+    stats->busy = 0;
+    for (i = 0; i < pipeline->n_workers; i++)
+        stats->busy += __atomic_load_n (&pipeline->workers[i].busy, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) 2012-2013 Paul Ionkin <paul.ionkin@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#ifndef _PIPELINE_H_
+#define _PIPELINE_H_
+
+#include "global.h"
+
+/*
+ * Pipeline mode: pipeline.threads network threads accept, parse requests and
+ * send replies, the event loop thread owns torrents and does lookups, updates
+ * and peer selection. Each network thread has a pair of single-producer /
+ * single-consumer rings to the loop thread: requests there and replies back.
+ * Producers wake the consumer over eventfd once per loop iteration.
+ */
+typedef struct _Pipeline Pipeline;
+
+typedef struct {
+    // requests passed to the loop thread and its wakeups
+    guint64 jobs;
+    guint64 wakeups;
+    // requests refused because pipeline.ring_size requests were in flight
+    guint64 busy;
+} PipelineStats;
+
+/*
+ * Starts network threads accepting on http_fd, the listener of the event
+ * loop must be disabled. Must be called from the thread running the event
+ * loop, after daemonizing.
+ */
+Pipeline *pipeline_create (TrackerApp *app, evutil_socket_t http_fd);
+void pipeline_destroy (Pipeline *pipeline);
+
+// network threads close their listeners, requests in flight are finished
+void pipeline_stop_accepting (Pipeline *pipeline);
+
+void pipeline_get_stats (Pipeline *pipeline, PipelineStats *stats);
+
+#endif
@@ -0,0 +1,398 @@
+/*
+ * Copyright (C) 2012-2013 Paul Ionkin <paul.ionkin@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+/*
+ * Replays announces captured by tracker (capture.enabled) against one or two
+ * trackers and reports latency and errors, with deltas if two are given:
+ *   tbfs_replay -s 10 -t 127.0.0.1:6969 -t 127.0.0.1:7969 capture_file
+ * -s 0 sends as fast as possible, keeping -c requests in flight per tracker.
+ * Anonymized peer address is sent in X-Real-IP header.
+ */
+#include "capture.h"
+#include "torrent.h"
+#include <sys/mman.h>
+
+#define REPLAY_MAX_TARGETS 2
+
+typedef struct {
+    gchar *host;
+    gint port;
+
+    struct evhttp_connection **conns;
+    guint n_conns;
+    guint next_conn;
+
+    guint64 sent;
+    guint64 errors;
+    guint inflight;
+    // latencies of completed requests, us
+    GArray *a_latency;
+} ReplayTarget;
+
+typedef struct {
+    struct event_base *evbase;
+    struct event *ev_timer;
+
+    const CaptureRecord *records;
+    guint64 n_records;
+    guint64 next;
+
+    gdouble speed;
+    guint concurrency;
+    gint64 start_us;
+
+    ReplayTarget targets[REPLAY_MAX_TARGETS];
+    guint n_targets;
+} Replay;
+
+typedef struct {
+    Replay *replay;
+    ReplayTarget *target;
+    gint64 start_us;
+} ReplayRequest;
+
+static void replay_dispatch (Replay *replay);
+
+static void replay_check_done (Replay *replay)
+{
+    guint i;
+
+    if (replay->next < replay->n_records)
+        return;
+
+    for (i = 0; i < replay->n_targets; i++)
+        if (replay->targets[i].inflight)
+            return;
+
+    event_base_loopexit (replay->evbase, NULL);
+}
+
+static void replay_on_response_cb (struct evhttp_request *req, void *ctx)
+{
+    ReplayRequest *rr = (ReplayRequest *) ctx;
+    Replay *replay = rr->replay;
+    ReplayTarget *target = rr->target;
+    guint32 latency = (guint32) (g_get_monotonic_time () - rr->start_us);
+    static const char failure[] = "d14:failure reason";
+
+    g_array_append_val (target->a_latency, latency);
+    target->inflight--;
+
+    if (!req || evhttp_request_get_response_code (req) != HTTP_OK) {
+        target->errors++;
+    } else {
+        struct evbuffer *in = evhttp_request_get_input_buffer (req);
+        const unsigned char *body = evbuffer_pullup (in, sizeof (failure) - 1);
+
+        if (body && !memcmp (body, failure, sizeof (failure) - 1))
+            target->errors++;
+    }
+
+    g_free (rr);
+
+    if (replay->speed == 0)
+        replay_dispatch (replay);
+    replay_check_done (replay);
+}
+
+static void replay_append_escaped (GString *str, const uint8_t *data, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++)
+        g_string_append_printf (str, "%%%02X", data[i]);
+}
+
+static void replay_send (Replay *replay, ReplayTarget *target, const CaptureRecord *rec)
+{
+    static const gchar *events[] = { "started", "stopped", "completed" };
+    struct evhttp_connection *conn;
+    struct evhttp_request *req;
+    ReplayRequest *rr;
+    GString *uri;
+    gchar addr[INET_ADDRSTRLEN];
+    gchar host[64];
+
+    rr = g_new0 (ReplayRequest, 1);
+    rr->replay = replay;
+    rr->target = target;
+
+    uri = g_string_sized_new (256);
+    g_string_append (uri, "/announce?info_hash=");
+    replay_append_escaped (uri, rec->info_hash, sizeof (rec->info_hash));
+    g_string_append (uri, "&peer_id=");
+    replay_append_escaped (uri, rec->peer_id, sizeof (rec->peer_id));
+    g_string_append_printf (uri, "&port=%u&uploaded=%"G_GUINT64_FORMAT"&downloaded=%"G_GUINT64_FORMAT"&left=%"G_GUINT64_FORMAT,
+        g_ntohs (rec->port), GUINT64_FROM_BE (rec->uploaded), GUINT64_FROM_BE (rec->downloaded), GUINT64_FROM_BE (rec->left));
+    if ((rec->flags & CAPTURE_FLAG_NUMWANT) || g_ntohl (rec->numwant))
+        g_string_append_printf (uri, "&numwant=%u", g_ntohl (rec->numwant));
+    if (rec->flags & CAPTURE_FLAG_COMPACT)
+        g_string_append (uri, "&compact=1");
+    if (rec->event < G_N_ELEMENTS (events))
+        g_string_append_printf (uri, "&event=%s", events[rec->event]);
+
+    conn = target->conns[target->next_conn];
+    target->next_conn = (target->next_conn + 1) % target->n_conns;
+
+    req = evhttp_request_new (replay_on_response_cb, rr);
+    g_snprintf (host, sizeof (host), "%s:%d", target->host, target->port);
+    evhttp_add_header (evhttp_request_get_output_headers (req), "Host", host);
+    evutil_inet_ntop (AF_INET, &rec->addr, addr, sizeof (addr));
+    evhttp_add_header (evhttp_request_get_output_headers (req), "X-Real-IP", addr);
+
+    rr->start_us = g_get_monotonic_time ();
+    target->sent++;
+    target->inflight++;
+
+    if (evhttp_make_request (conn, req, EVHTTP_REQ_GET, uri->str) < 0) {
+        // request is freed by libevent
+        target->inflight--;
+        target->errors++;
+        g_free (rr);
+    }
+
+    g_string_free (uri, TRUE);
+}
+
+static gboolean replay_can_send (Replay *replay)
+{
+    guint i;
+
+    if (replay->speed > 0)
+        return TRUE;
+
+    for (i = 0; i < replay->n_targets; i++)
+        if (replay->targets[i].inflight >= replay->concurrency)
+            return FALSE;
+
+    return TRUE;
+}
+
+// sends records which are due, arms timer for the next one
+static void replay_dispatch (Replay *replay)
+{
+    gint64 elapsed_us = g_get_monotonic_time () - replay->start_us;
+
+    while (replay->next < replay->n_records && replay_can_send (replay)) {
+        const CaptureRecord *rec = &replay->records[replay->next];
+        guint i;
+
+        if (replay->speed > 0) {
+            gint64 due_us = (gint64) (GUINT64_FROM_BE (rec->time_us) / replay->speed);
+
+            if (due_us > elapsed_us) {
+                struct timeval tv;
+
+                tv.tv_sec = (due_us - elapsed_us) / G_USEC_PER_SEC;
+                tv.tv_usec = (due_us - elapsed_us) % G_USEC_PER_SEC;
+                evtimer_add (replay->ev_timer, &tv);
+                return;
+            }
+        }
+
+        for (i = 0; i < replay->n_targets; i++)
+            replay_send (replay, &replay->targets[i], rec);
+        replay->next++;
+    }
+}
+
+static void replay_on_timer_cb (G_GNUC_UNUSED evutil_socket_t fd, G_GNUC_UNUSED short event, void *ctx)
+{
+    Replay *replay = (Replay *) ctx;
+
+    replay_dispatch (replay);
+    replay_check_done (replay);
+}
+
+static gint latency_cmp (gconstpointer a, gconstpointer b)
+{
+    guint32 la = *(const guint32 *) a, lb = *(const guint32 *) b;
+
+    return (la > lb) - (la < lb);
+}
+
+static guint32 latency_percentile (GArray *a_latency, gdouble pct)
+{
+    guint idx;
+
+    if (!a_latency->len)
+        return 0;
+
+    idx = (guint) (a_latency->len * pct / 100.0);
+    if (idx >= a_latency->len)
+        idx = a_latency->len - 1;
+
+    return g_array_index (a_latency, guint32, idx);
+}
+
+static void replay_report (Replay *replay, gdouble duration)
+{
+    static const gdouble pcts[] = { 50, 90, 99, 99.9, 100 };
+    guint i, p;
+
+    g_fprintf (stdout, "%-22s %9s %9s %8s %9s %9s %9s %9s %9s %9s\n", "target", "requests", "errors", "err %",
+        "req/s", "p50 us", "p90 us", "p99 us", "p99.9 us", "max us");
+
+    for (i = 0; i < replay->n_targets; i++) {
+        ReplayTarget *target = &replay->targets[i];
+        gchar name[64];
+
+        g_array_sort (target->a_latency, latency_cmp);
+        g_snprintf (name, sizeof (name), "%s:%d", target->host, target->port);
+
+        g_fprintf (stdout, "%-22s %9"G_GUINT64_FORMAT" %9"G_GUINT64_FORMAT" %8.3f %9.0f", name,
+            target->sent, target->errors, target->sent ? 100.0 * target->errors / target->sent : 0.0,
+            duration > 0 ? target->sent / duration : 0.0);
+        for (p = 0; p < G_N_ELEMENTS (pcts); p++)
+            g_fprintf (stdout, " %9u", latency_percentile (target->a_latency, pcts[p]));
+        g_fprintf (stdout, "\n");
+    }
+
+    if (replay->n_targets == 2) {
+        ReplayTarget *a = &replay->targets[0], *b = &replay->targets[1];
+        gdouble err_a = a->sent ? 100.0 * a->errors / a->sent : 0.0;
+        gdouble err_b = b->sent ? 100.0 * b->errors / b->sent : 0.0;
+
+        g_fprintf (stdout, "%-22s %9s %+9"G_GINT64_FORMAT" %+8.3f %9s", "delta (2nd - 1st)", "",
+            (gint64) b->errors - (gint64) a->errors, err_b - err_a, "");
+        for (p = 0; p < G_N_ELEMENTS (pcts); p++)
+            g_fprintf (stdout, " %+9"G_GINT64_FORMAT,
+                (gint64) latency_percentile (b->a_latency, pcts[p]) - (gint64) latency_percentile (a->a_latency, pcts[p]));
+        g_fprintf (stdout, "\n");
+    }
+}
+
+static gboolean replay_parse_target (ReplayTarget *target, const gchar *str, guint n_conns)
+{
+    const gchar *colon = strrchr (str, ':');
+
+    if (!colon || colon == str || !atoi (colon + 1))
+        return FALSE;
+
+    target->host = g_strndup (str, colon - str);
+    target->port = atoi (colon + 1);
+    target->n_conns = n_conns;
+    target->a_latency = g_array_new (FALSE, FALSE, sizeof (guint32));
+
+    return TRUE;
+}
+
+int main (int argc, char *argv[])
+{
+    GOptionContext *context;
+    GError *error = NULL;
+    gchar **s_targets = NULL;
+    gdouble speed = 1;
+    gint concurrency = 64;
+    gint64 limit = 0;
+    Replay replay;
+    const CaptureFileHeader *hdr;
+    struct stat st;
+    void *map;
+    gint fd;
+    guint i, c;
+    gint64 start;
+    GOptionEntry entries[] = {
+        { "target", 't', 0, G_OPTION_ARG_STRING_ARRAY, &s_targets, "Tracker host:port, can be given twice to compare.", NULL },
+        { "speed", 's', 0, G_OPTION_ARG_DOUBLE, &speed, "Replay speed, 1 - as captured, 0 - as fast as possible.", NULL },
+        { "concurrency", 'c', 0, G_OPTION_ARG_INT, &concurrency, "Connections (and requests in flight at -s 0) per tracker, default 64.", NULL },
+        { "limit", 'n', 0, G_OPTION_ARG_INT64, &limit, "Replay only first N announces.", NULL },
+        { NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL }
+    };
+
+    context = g_option_context_new ("-t host:port [-t host:port] capture_file");
+    g_option_context_add_main_entries (context, entries, NULL);
+    if (!g_option_context_parse (context, &argc, &argv, &error) || argc < 2 || !s_targets ||
+        g_strv_length (s_targets) > REPLAY_MAX_TARGETS || speed < 0 || concurrency < 1) {
+        g_fprintf (stderr, "Usage: %s [-s speed] [-c concurrency] [-n limit] -t host:port [-t host:port] capture_file\n", argv[0]);
+        g_option_context_free (context);
+        return -1;
+    }
+    g_option_context_free (context);
+
+    memset (&replay, 0, sizeof (replay));
+    replay.speed = speed;
+    replay.concurrency = concurrency;
+
+    fd = open (argv[1], O_RDONLY);
+    if (fd < 0 || fstat (fd, &st) != 0 || (size_t) st.st_size < sizeof (CaptureFileHeader)) {
+        g_fprintf (stderr, "Failed to open %s\n", argv[1]);
+        return -1;
+    }
+    map = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close (fd);
+    if (map == MAP_FAILED) {
+        g_fprintf (stderr, "Failed to mmap %s: %s\n", argv[1], strerror (errno));
+        return -1;
+    }
+
+    hdr = (const CaptureFileHeader *) map;
+    if (memcmp (hdr->magic, CAPTURE_FILE_MAGIC, sizeof (hdr->magic)) || g_ntohl (hdr->version) != CAPTURE_FILE_VERSION ||
+        g_ntohl (hdr->record_size) != sizeof (CaptureRecord)) {
+        g_fprintf (stderr, "Invalid capture file: %s\n", argv[1]);
+        return -1;
+    }
+
+    replay.records = (const CaptureRecord *) ((const uint8_t *) map + sizeof (CaptureFileHeader));
+    replay.n_records = (st.st_size - sizeof (CaptureFileHeader)) / sizeof (CaptureRecord);
+    if (limit > 0 && (guint64) limit < replay.n_records)
+        replay.n_records = limit;
+
+    replay.evbase = event_base_new ();
+    replay.ev_timer = evtimer_new (replay.evbase, replay_on_timer_cb, &replay);
+
+    for (i = 0; s_targets[i]; i++) {
+        ReplayTarget *target = &replay.targets[replay.n_targets];
+
+        if (!replay_parse_target (target, s_targets[i], concurrency)) {
+            g_fprintf (stderr, "Invalid target: %s\n", s_targets[i]);
+            return -1;
+        }
+
+        target->conns = g_new0 (struct evhttp_connection *, target->n_conns);
+        for (c = 0; c < target->n_conns; c++)
+            target->conns[c] = evhttp_connection_base_new (replay.evbase, NULL, target->host, target->port);
+        replay.n_targets++;
+    }
+    g_strfreev (s_targets);
+
+    g_fprintf (stdout, "Replaying %"G_GUINT64_FORMAT" announces at %s\n", replay.n_records,
+        speed > 0 ? "captured rate" : "max rate");
+    if (speed > 0 && speed != 1)
+        g_fprintf (stdout, "Speed: %.2fx\n", speed);
+
+    start = replay.start_us = g_get_monotonic_time ();
+    replay_dispatch (&replay);
+    replay_check_done (&replay);
+    event_base_dispatch (replay.evbase);
+
+    replay_report (&replay, (g_get_monotonic_time () - start) / (gdouble) G_USEC_PER_SEC);
+
+    for (i = 0; i < replay.n_targets; i++) {
+        ReplayTarget *target = &replay.targets[i];
+
+        for (c = 0; c < target->n_conns; c++)
+            evhttp_connection_free (target->conns[c]);
+        g_free (target->conns);
+        g_array_free (target->a_latency, TRUE);
+        g_free (target->host);
+    }
+    event_free (replay.ev_timer);
+    event_base_free (replay.evbase);
+    munmap (map, st.st_size);
+
+    return 0;
+}
@@ -0,0 +1,427 @@
+/*
+ * Copyright (C) 2012-2013 Paul Ionkin <paul.ionkin@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include "replication.h"
+
+/*
+ * Peer-delta gossip between tracker nodes.
+ *
+ * Every node batches peer adds / removes, announced to it directly, and
+ * periodically sends them as UDP packets to all configured nodes.
+ * Received peers are tagged with the sender's node_id and expire after
+ * "replication.peer_ttl" seconds unless refreshed by the origin node.
+ */
+
+#define REPL_MAGIC 0x54425244 // "TBRD"
+#define REPL_VERSION 1
+#define REPL_MAX_PACKET 1400
+
+typedef enum {
+    RD_add = 1,
+    RD_remove = 2,
+} ReplDeltaOp;
+
+typedef struct {
+    guint32 magic;
+    guint8 version;
+    guint8 reserved;
+    guint16 count;
+    guint32 node_id;
+    guint32 seq;
+} __attribute__((packed)) ReplHeader;
+
+typedef struct {
+    guint8 op;
+    guint8 status;
+    guint16 port; // network byte order
+    guint32 addr; // network byte order
+    uint8_t info_hash[SHA_DIGEST_LENGTH];
+    gchar peer_id[20];
+} __attribute__((packed)) ReplDelta;
+
+#define REPL_DELTAS_PER_PACKET ((REPL_MAX_PACKET - sizeof (ReplHeader)) / sizeof (ReplDelta))
+
+typedef struct {
+    struct sockaddr_in addr;
+    gchar *name;
+} ReplNode;
+
+struct _Replication {
+    TrackerApp *app;
+    guint32 node_id;
+    guint32 peer_ttl;
+    guint32 seq;
+
+    evutil_socket_t fd;
+    struct event *ev_read;
+    struct event *ev_flush;
+
+    GList *l_nodes;
+    // "info_hash/peer_id" -> ReplDelta, coalesces changes between flushes
+    GHashTable *h_pending;
+
+    guint64 deltas_sent;
+    guint64 deltas_received;
+};
+
+#define REPL_LOG "repl"
+
+static void replication_on_read_cb (evutil_socket_t fd, short event, void *ctx);
+static void replication_on_flush_cb (evutil_socket_t fd, short event, void *ctx);
+
+/*{{{ create / destroy */
+static void repl_node_destroy (ReplNode *node)
+{
+    g_free (node->name);
+    g_free (node);
+}
+
+Replication *replication_create (TrackerApp *app, evutil_socket_t fd)
+{
+    Replication *repl;
+    ConfData *conf = tracker_app_get_conf (app);
+    struct event_base *evbase = tracker_app_get_evbase (app);
+    struct sockaddr_in sin;
+    GList *l;
+    struct timeval tv;
+    guint32 flush_ms;
+
+    repl = g_new0 (Replication, 1);
+    repl->app = app;
+    repl->fd = -1;
+    repl->node_id = conf_get_uint (conf, "replication.node_id");
+    repl->peer_ttl = conf_get_uint (conf, "replication.peer_ttl");
+    repl->h_pending = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
+    if (!repl->node_id) {
+        LOG_err (REPL_LOG, "replication.node_id must be set to a unique non-zero value !");
+        replication_destroy (repl);
+        return NULL;
+    }
+
+    for (l = g_list_first (conf_get_list (conf, "replication.nodes")); l; l = g_list_next (l)) {
+        const gchar *name = (const gchar *) l->data;
+        ReplNode *node;
+        int socklen;
+
+        node = g_new0 (ReplNode, 1);
+        socklen = sizeof (node->addr);
+        if (evutil_parse_sockaddr_port (name, (struct sockaddr *) &node->addr, &socklen) < 0 ||
+            node->addr.sin_family != AF_INET || !node->addr.sin_port) {
+            LOG_err (REPL_LOG, "Invalid replication node address: %s", name);
+            g_free (node);
+            replication_destroy (repl);
+            return NULL;
+        }
+        node->name = g_strdup (name);
+        repl->l_nodes = g_list_append (repl->l_nodes, node);
+    }
+
+    memset (&sin, 0, sizeof (sin));
+    sin.sin_family = AF_INET;
+    sin.sin_port = g_htons (conf_get_int (conf, "replication.port"));
+    if (evutil_inet_pton (AF_INET, conf_get_string (conf, "replication.address"), &sin.sin_addr) != 1) {
+        LOG_err (REPL_LOG, "Invalid replication address: %s", conf_get_string (conf, "replication.address"));
+        replication_destroy (repl);
+        return NULL;
+    }
+
+    if (fd >= 0) {
+        repl->fd = fd;
+    } else {
+        repl->fd = socket (AF_INET, SOCK_DGRAM, 0);
+        if (repl->fd >= 0 && bind (repl->fd, (struct sockaddr *) &sin, sizeof (sin)) < 0) {
+            evutil_closesocket (repl->fd);
+            repl->fd = -1;
+        }
+    }
+    if (repl->fd < 0 || evutil_make_socket_nonblocking (repl->fd) < 0 || evutil_make_socket_closeonexec (repl->fd) < 0) {
+        LOG_err (REPL_LOG, "Failed to bind replication socket to %s:%d: %s",
+            conf_get_string (conf, "replication.address"), conf_get_int (conf, "replication.port"),
+            strerror (errno));
+        replication_destroy (repl);
+        return NULL;
+    }
+
+    repl->ev_read = event_new (evbase, repl->fd, EV_READ | EV_PERSIST, replication_on_read_cb, repl);
+    event_add (repl->ev_read, NULL);
+
+    flush_ms = conf_get_uint (conf, "replication.flush_interval");
+    if (!flush_ms)
+        flush_ms = 200;
+    tv.tv_sec = flush_ms / 1000;
+    tv.tv_usec = (flush_ms % 1000) * 1000;
+    repl->ev_flush = event_new (evbase, -1, EV_PERSIST, replication_on_flush_cb, repl);
+    event_add (repl->ev_flush, &tv);
+
+    LOG_msg (REPL_LOG, "Replication node %u is listening on %s:%d, %u remote nodes",
+        repl->node_id, conf_get_string (conf, "replication.address"), conf_get_int (conf, "replication.port"),
+        g_list_length (repl->l_nodes));
+
+    return repl;
+}
+
+void replication_destroy (Replication *repl)
+{
+    GList *l;
+
+    // send out pending deltas
+    if (repl->fd >= 0)
+        replication_on_flush_cb (-1, 0, repl);
+
+    LOG_debug (REPL_LOG, "Deltas sent: %"G_GUINT64_FORMAT", received: %"G_GUINT64_FORMAT,
+        repl->deltas_sent, repl->deltas_received);
+
+    if (repl->ev_read)
+        event_free (repl->ev_read);
+    if (repl->ev_flush)
+        event_free (repl->ev_flush);
+    if (repl->fd >= 0)
+        evutil_closesocket (repl->fd);
+
+    for (l = g_list_first (repl->l_nodes); l; l = g_list_next (l))
+        repl_node_destroy ((ReplNode *) l->data);
+    g_list_free (repl->l_nodes);
+
+    g_hash_table_destroy (repl->h_pending);
+    g_free (repl);
+}
+
+evutil_socket_t replication_get_fd (Replication *repl)
+{
+    return repl->fd;
+}
+/*}}}*/
+
+/*{{{ outgoing deltas */
+static void replication_queue_delta (Replication *repl, Torrent *torrent, const gchar *peer_id, Peer *peer, ReplDeltaOp op)
+{
+    ReplDelta *delta;
+    gchar *key;
+
+    if (!repl->l_nodes)
+        return;
+
+    key = g_strdup_printf ("%s/%s", torrent->info_hash, peer_id);
+    delta = g_hash_table_lookup (repl->h_pending, key);
+    if (!delta) {
+        delta = g_new0 (ReplDelta, 1);
+        memcpy (delta->info_hash, torrent->info_hash_bin, SHA_DIGEST_LENGTH);
+        memcpy (delta->peer_id, peer_id, MIN (strlen (peer_id), sizeof (delta->peer_id)));
+        g_hash_table_insert (repl->h_pending, key, delta);
+    } else {
+        g_free (key);
+    }
+
+    // the last change wins
+    delta->op = op;
+    if (peer) {
+        delta->status = peer->status;
+        delta->port = peer->port;
+        memcpy (&delta->addr, &peer->addr, sizeof (delta->addr));
+    }
+}
+
+void replication_peer_update (Replication *repl, Torrent *torrent, Peer *peer, AnnounceEvent ev)
+{
+    time_t now = time (NULL);
+
+    // refresh remote copies well before they expire
+    if (ev == AE_update && peer->repl_time && (guint32)(now - peer->repl_time) < repl->peer_ttl / 2)
+        return;
+
+    peer->repl_time = now;
+    replication_queue_delta (repl, torrent, peer->peer_id, peer, RD_add);
+}
+
+void replication_peer_remove (Replication *repl, Torrent *torrent, const gchar *peer_id)
+{
+    replication_queue_delta (repl, torrent, peer_id, NULL, RD_remove);
+}
+
+static void replication_send_packet (Replication *repl, uint8_t *buf, guint count)
+{
+    ReplHeader *hdr = (ReplHeader *) buf;
+    size_t len = sizeof (ReplHeader) + count * sizeof (ReplDelta);
+    GList *l;
+
+    hdr->magic = g_htonl (REPL_MAGIC);
+    hdr->version = REPL_VERSION;
+    hdr->reserved = 0;
+    hdr->count = g_htons (count);
+    hdr->node_id = g_htonl (repl->node_id);
+    hdr->seq = g_htonl (repl->seq++);
+
+    for (l = g_list_first (repl->l_nodes); l; l = g_list_next (l)) {
+        ReplNode *node = (ReplNode *) l->data;
+
+        if (sendto (repl->fd, buf, len, 0, (struct sockaddr *) &node->addr, sizeof (node->addr)) < 0)
+            LOG_debug (REPL_LOG, "Failed to send deltas to %s: %s", node->name, strerror (errno));
+    }
+
+    repl->deltas_sent += count;
+}
+
+static void replication_on_flush_cb (G_GNUC_UNUSED evutil_socket_t fd, G_GNUC_UNUSED short event, void *ctx)
+{
+    Replication *repl = (Replication *) ctx;
+    uint8_t buf[REPL_MAX_PACKET];
+    ReplDelta *deltas = (ReplDelta *) (buf + sizeof (ReplHeader));
+    GHashTableIter iter;
+    ReplDelta *delta;
+    guint count = 0;
+
+    if (!g_hash_table_size (repl->h_pending))
+        return;
+
+    LOG_debug (REPL_LOG, "Flushing %u deltas", g_hash_table_size (repl->h_pending));
+
+    g_hash_table_iter_init (&iter, repl->h_pending);
+    while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &delta)) {
+        memcpy (&deltas[count++], delta, sizeof (ReplDelta));
+        if (count == REPL_DELTAS_PER_PACKET) {
+            replication_send_packet (repl, buf, count);
+            count = 0;
+        }
+    }
+    if (count)
+        replication_send_packet (repl, buf, count);
+
+    g_hash_table_remove_all (repl->h_pending);
+}
+/*}}}*/
+
+/*{{{ incoming deltas */
+static gboolean replication_is_known_node (Replication *repl, const struct sockaddr_in *sin)
+{
+    GList *l;
+
+    for (l = g_list_first (repl->l_nodes); l; l = g_list_next (l)) {
+        ReplNode *node = (ReplNode *) l->data;
+
+        if (node->addr.sin_addr.s_addr == sin->sin_addr.s_addr && node->addr.sin_port == sin->sin_port)
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+static void replication_apply_delta (Replication *repl, guint32 origin, const ReplDelta *delta)
+{
+    gchar peer_id[sizeof (delta->peer_id) + 1];
+    Torrent *torrent;
+    Peer *peer;
+
+    memcpy (peer_id, delta->peer_id, sizeof (delta->peer_id));
+    peer_id[sizeof (delta->peer_id)] = '\0';
+
+    torrent = tracker_get_torrent (repl->app, delta->info_hash);
+
+    if (delta->op == RD_remove) {
+        if (torrent)
+            torrent_remove_peer (torrent, peer_id);
+        return;
+    }
+
+    if (delta->op != RD_add)
+        return;
+
+    if (!torrent)
+        torrent = tracker_add_torrent (repl->app, delta->info_hash);
+    // memory budget is exhausted
+    if (!torrent)
+        return;
+
+    if (!(peer = torrent_get_peer (torrent, peer_id))) {
+        const TrackerSettings *settings = tracker_app_get_settings (repl->app);
+        struct in_addr addr;
+
+        memcpy (&addr, &delta->addr, sizeof (addr));
+        peer = torrent_add_peer (torrent, peer_id, &addr, g_ntohs (delta->port));
+        if (settings->max_peers_per_torrent)
+            torrent_evict_peers (torrent, settings->max_peers_per_torrent);
+    } else {
+        struct in_addr addr;
+
+        memcpy (&addr, &delta->addr, sizeof (addr));
+        torrent_set_peer_endpoint (torrent, peer, &addr, g_ntohs (delta->port));
+    }
+
+    peer->status = delta->status == PS_seeder ? PS_seeder : PS_leecher;
+    peer->origin = origin;
+    torrent_touch_peer (torrent, peer);
+    tracker_touch_torrent (repl->app, torrent);
+    peer->expire_time = peer->access_time + repl->peer_ttl;
+}
+
+static void replication_on_read_cb (evutil_socket_t fd, G_GNUC_UNUSED short event, void *ctx)
+{
+    Replication *repl = (Replication *) ctx;
+    uint8_t buf[REPL_MAX_PACKET];
+    struct sockaddr_in sin;
+    socklen_t sin_len;
+    ssize_t len;
+
+    for (;;) {
+        const ReplHeader *hdr = (const ReplHeader *) buf;
+        const ReplDelta *deltas = (const ReplDelta *) (buf + sizeof (ReplHeader));
+        guint32 origin;
+        guint count, i;
+
+        sin_len = sizeof (sin);
+        len = recvfrom (fd, buf, sizeof (buf), 0, (struct sockaddr *) &sin, &sin_len);
+        if (len < 0)
+            break;
+
+        if ((size_t) len < sizeof (ReplHeader) || g_ntohl (hdr->magic) != REPL_MAGIC || hdr->version != REPL_VERSION) {
+            LOG_debug (REPL_LOG, "Dropping malformed packet (%zd bytes)", len);
+            continue;
+        }
+
+        if (!replication_is_known_node (repl, &sin)) {
+            LOG_debug (REPL_LOG, "Dropping packet from unknown node %s:%d", inet_ntoa (sin.sin_addr), g_ntohs (sin.sin_port));
+            continue;
+        }
+
+        origin = g_ntohl (hdr->node_id);
+        count = g_ntohs (hdr->count);
+        if (!origin || origin == repl->node_id || sizeof (ReplHeader) + count * sizeof (ReplDelta) > (size_t) len) {
+            LOG_debug (REPL_LOG, "Dropping invalid packet from node %u", origin);
+            continue;
+        }
+
+        for (i = 0; i < count; i++)
+            replication_apply_delta (repl, origin, &deltas[i]);
+
+        repl->deltas_received += count;
+    }
+}
+/*}}}*/
+
+/*{{{ expiration */
+static gboolean replication_peer_is_expired (G_GNUC_UNUSED gpointer key, gpointer value, gpointer user_data)
+{
+    Peer *peer = (Peer *) value;
+    time_t now = *(time_t *) user_data;
+
+    return peer->origin && peer->expire_time < now;
+}
+
+guint replication_expire_peers (G_GNUC_UNUSED Replication *repl, Torrent *torrent, time_t now)
+{
+    return torrent_remove_peers_if (torrent, replication_peer_is_expired, &now);
+}
+/*}}}*/
@@ -0,0 +1,37 @@
+/*
+ * Copyright (C) 2012-2013 Paul Ionkin <paul.ionkin@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#ifndef _REPLICATION_H_
+#define _REPLICATION_H_
+
+#include "global.h"
+#include "torrent.h"
+
+typedef struct _Replication Replication;
+
+// fd: already bound socket (handed over on upgrade) or -1
+Replication *replication_create (TrackerApp *app, evutil_socket_t fd);
+void replication_destroy (Replication *repl);
+evutil_socket_t replication_get_fd (Replication *repl);
+
+// queue peer state change, announced to this node
+void replication_peer_update (Replication *repl, Torrent *torrent, Peer *peer, AnnounceEvent ev);
+void replication_peer_remove (Replication *repl, Torrent *torrent, const gchar *peer_id);
+// removes peers of other nodes which were not refreshed for replication.peer_ttl,
+// called by the sweep slice by slice
+guint replication_expire_peers (Replication *repl, Torrent *torrent, time_t now);
+
+#endif
@@ -0,0 +1,433 @@
+/*
+ * Copyright (C) 2012-2013 Paul Ionkin <paul.ionkin@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include "router.h"
+
+/*
+ * Router mode: announces are forwarded to one of the backend trackers,
+ * chosen by info_hash on a consistent-hash ring (ketama-like, every
+ * backend owns "router.vnodes" points). Adding a backend moves only
+ * ~1/N of torrents. Scrapes with several info_hashes are split per
+ * backend and the replies are merged.
+ */
+
+#define ROUTER_MAX_SCRAPE 64
+
+typedef struct {
+    gchar *name;
+    gchar *host;
+    gint port;
+
+    struct evhttp_connection **conns;
+    guint n_conns;
+    guint next_conn;
+
+    guint64 requests;
+    guint64 failures;
+} RouterBackend;
+
+typedef struct {
+    guint32 point;
+    guint backend;
+} RingPoint;
+
+typedef struct _RouterRequest RouterRequest;
+struct _RouterRequest {
+    Router *router;
+    struct evhttp_request *req; // client request, NULL if client has gone
+    gboolean is_scrape;
+    guint pending;  // number of backend requests in flight
+    gint code;
+    struct evbuffer *out;
+
+    RouterRequest *next_free;
+};
+
+struct _Router {
+    TrackerApp *app;
+
+    RouterBackend *backends;
+    guint n_backends;
+
+    RingPoint *ring;
+    guint n_points;
+
+    // pool of request contexts, they are never freed while router is running
+    RouterRequest *free_requests;
+    guint n_requests;
+};
+
+#define ROUTER_LOG "router"
+
+/*{{{ ring */
+static gint ring_point_cmp (gconstpointer a, gconstpointer b)
+{
+    const RingPoint *pa = (const RingPoint *) a;
+    const RingPoint *pb = (const RingPoint *) b;
+
+    if (pa->point < pb->point)
+        return -1;
+    if (pa->point > pb->point)
+        return 1;
+    return (gint) pa->backend - (gint) pb->backend;
+}
+
+static void router_build_ring (Router *router, guint vnodes)
+{
+    guint b, i, j, n = 0;
+    guint per_backend = MAX (1, vnodes / 4) * 4;
+
+    router->ring = g_new0 (RingPoint, router->n_backends * per_backend);
+
+    for (b = 0; b < router->n_backends; b++) {
+        for (i = 0; i < per_backend / 4; i++) {
+            unsigned char digest[MD5_DIGEST_LENGTH];
+            gchar buf[256];
+            gint len;
+
+            len = g_snprintf (buf, sizeof (buf), "%s-%u", router->backends[b].name, i);
+            MD5 ((const unsigned char *) buf, len, digest);
+
+            // every digest gives 4 points
+            for (j = 0; j < 4; j++) {
+                router->ring[n].point = ((guint32) digest[3 + j * 4] << 24) | ((guint32) digest[2 + j * 4] << 16) |
+                    ((guint32) digest[1 + j * 4] << 8) | digest[j * 4];
+                router->ring[n].backend = b;
+                n++;
+            }
+        }
+    }
+
+    router->n_points = n;
+    qsort (router->ring, router->n_points, sizeof (RingPoint), ring_point_cmp);
+}
+
+static guint router_get_backend (Router *router, const uint8_t *info_hash)
+{
+    guint32 point;
+    guint lo = 0, hi = router->n_points;
+
+    // info_hash is SHA1, it's uniformly distributed already
+    point = ((guint32) info_hash[0] << 24) | ((guint32) info_hash[1] << 16) |
+        ((guint32) info_hash[2] << 8) | info_hash[3];
+
+    while (lo < hi) {
+        guint mid = lo + (hi - lo) / 2;
+
+        if (router->ring[mid].point < point)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (lo == router->n_points)
+        lo = 0;
+
+    return router->ring[lo].backend;
+}
+/*}}}*/
+
+/*{{{ create / destroy */
+Router *router_create (TrackerApp *app)
+{
+    Router *router;
+    ConfData *conf = tracker_app_get_conf (app);
+    GList *l_backends, *l;
+    guint conns, timeout, i;
+
+    l_backends = conf_get_list (conf, "router.backends");
+    if (!l_backends) {
+        LOG_err (ROUTER_LOG, "No backends configured, please set router.backends !");
+        return NULL;
+    }
+
+    conns = MAX (1, conf_get_uint (conf, "router.connections"));
+    timeout = conf_get_uint (conf, "router.timeout");
+
+    router = g_new0 (Router, 1);
+    router->app = app;
+    router->backends = g_new0 (RouterBackend, g_list_length (l_backends));
+
+    for (l = g_list_first (l_backends); l; l = g_list_next (l)) {
+        RouterBackend *backend = &router->backends[router->n_backends];
+        const gchar *name = (const gchar *) l->data;
+        const gchar *colon = strrchr (name, ':');
+
+        if (!colon || atoi (colon + 1) <= 0) {
+            LOG_err (ROUTER_LOG, "Invalid backend address: %s, expected host:port", name);
+            router_destroy (router);
+            return NULL;
+        }
+
+        backend->name = g_strdup (name);
+        backend->host = g_strndup (name, colon - name);
+        backend->port = atoi (colon + 1);
+        backend->n_conns = conns;
+        backend->conns = g_new0 (struct evhttp_connection *, conns);
+        router->n_backends++;
+
+        for (i = 0; i < conns; i++) {
+            backend->conns[i] = evhttp_connection_base_new (tracker_app_get_evbase (app),
+                tracker_app_get_dnsbase (app), backend->host, backend->port);
+            if (!backend->conns[i]) {
+                LOG_err (ROUTER_LOG, "Failed to create connection to backend %s", name);
+                router_destroy (router);
+                return NULL;
+            }
+            if (timeout)
+                evhttp_connection_set_timeout (backend->conns[i], timeout);
+        }
+    }
+
+    router_build_ring (router, conf_get_uint (conf, "router.vnodes"));
+
+    LOG_msg (ROUTER_LOG, "Routing requests to %u backends (%u ring points, %u connections per backend)",
+        router->n_backends, router->n_points, conns);
+
+    return router;
+}
+
+void router_destroy (Router *router)
+{
+    guint b, i;
+    RouterRequest *rreq;
+
+    for (b = 0; b < router->n_backends; b++) {
+        RouterBackend *backend = &router->backends[b];
+
+        LOG_debug (ROUTER_LOG, "Backend %s, requests: %"G_GUINT64_FORMAT", failures: %"G_GUINT64_FORMAT,
+            backend->name, backend->requests, backend->failures);
+
+        for (i = 0; i < backend->n_conns; i++) {
+            if (backend->conns[i])
+                evhttp_connection_free (backend->conns[i]);
+        }
+        g_free (backend->conns);
+        g_free (backend->name);
+        g_free (backend->host);
+    }
+    g_free (router->backends);
+    g_free (router->ring);
+
+    while ((rreq = router->free_requests)) {
+        router->free_requests = rreq->next_free;
+        evbuffer_free (rreq->out);
+        g_free (rreq);
+    }
+
+    g_free (router);
+}
+/*}}}*/
+
+/*{{{ requests */
+static void router_on_client_close_cb (G_GNUC_UNUSED struct evhttp_connection *evcon, void *ctx)
+{
+    RouterRequest *rreq = (RouterRequest *) ctx;
+
+    // the client connection is closing and libevent frees its request with it:
+    // forget it, router_request_finish then recycles rreq without replying
+    rreq->req = NULL;
+}
+
+static RouterRequest *router_request_acquire (Router *router, struct evhttp_request *req, gboolean is_scrape)
+{
+    RouterRequest *rreq;
+
+    if (router->free_requests) {
+        rreq = router->free_requests;
+        router->free_requests = rreq->next_free;
+    } else {
+        rreq = g_new0 (RouterRequest, 1);
+        rreq->router = router;
+        rreq->out = evbuffer_new ();
+        router->n_requests++;
+    }
+
+    rreq->req = req;
+    rreq->is_scrape = is_scrape;
+    rreq->pending = 0;
+    rreq->code = HTTP_OK;
+    rreq->next_free = NULL;
+
+    evhttp_connection_set_closecb (evhttp_request_get_connection (req), router_on_client_close_cb, rreq);
+
+    return rreq;
+}
+
+static void router_request_release (RouterRequest *rreq)
+{
+    Router *router = rreq->router;
+
+    evbuffer_drain (rreq->out, evbuffer_get_length (rreq->out));
+    rreq->req = NULL;
+    rreq->next_free = router->free_requests;
+    router->free_requests = rreq;
+}
+
+static void router_request_finish (RouterRequest *rreq)
+{
+    if (rreq->req) {
+        evhttp_connection_set_closecb (evhttp_request_get_connection (rreq->req), NULL, NULL);
+
+        if (rreq->is_scrape) {
+            evbuffer_prepend (rreq->out, "d5:filesd", 9);
+            evbuffer_add (rreq->out, "ee", 2);
+        }
+
+        if (rreq->code == HTTP_OK)
+            evhttp_send_reply (rreq->req, HTTP_OK, "OK", rreq->out);
+        else
+            evhttp_send_reply (rreq->req, 502, "Bad Gateway", NULL);
+    }
+
+    router_request_release (rreq);
+}
+
+static void router_on_backend_reply_cb (struct evhttp_request *backend_req, void *ctx)
+{
+    RouterRequest *rreq = (RouterRequest *) ctx;
+    struct evbuffer *in;
+
+    if (!backend_req || evhttp_request_get_response_code (backend_req) != HTTP_OK) {
+        LOG_debug (ROUTER_LOG, "Backend request failed: %d",
+            backend_req ? evhttp_request_get_response_code (backend_req) : 0);
+        rreq->code = 502;
+    } else {
+        in = evhttp_request_get_input_buffer (backend_req);
+
+        // strip "d5:filesd" ... "ee" and merge files dictionaries
+        if (rreq->is_scrape) {
+            size_t len = evbuffer_get_length (in);
+            const char *body = (const char *) evbuffer_pullup (in, -1);
+
+            if (len >= 11 && !strncmp (body, "d5:filesd", 9))
+                evbuffer_add (rreq->out, body + 9, len - 11);
+        } else {
+            evbuffer_add_buffer (rreq->out, in);
+        }
+    }
+
+    if (--rreq->pending == 0)
+        router_request_finish (rreq);
+}
+
+static gboolean router_forward (Router *router, RouterRequest *rreq, guint b, const gchar *uri)
+{
+    RouterBackend *backend = &router->backends[b];
+    struct evhttp_connection *evcon;
+    struct evhttp_request *breq;
+    struct evkeyvalq *headers;
+
+    evcon = backend->conns[backend->next_conn];
+    backend->next_conn = (backend->next_conn + 1) % backend->n_conns;
+
+    breq = evhttp_request_new (router_on_backend_reply_cb, rreq);
+    headers = evhttp_request_get_output_headers (breq);
+    evhttp_add_header (headers, "Host", backend->host);
+    evhttp_add_header (headers, "X-Real-IP", rreq->req->remote_host);
+
+    backend->requests++;
+    if (evhttp_make_request (evcon, breq, EVHTTP_REQ_GET, uri) < 0) {
+        LOG_err (ROUTER_LOG, "Failed to send request to backend %s", backend->name);
+        backend->failures++;
+        return FALSE;
+    }
+
+    rreq->pending++;
+
+    return TRUE;
+}
+
+void router_on_announce_cb (struct evhttp_request *req, void *ctx)
+{
+    Router *router = (Router *) ctx;
+    RouterRequest *rreq;
+    uint8_t info_hash[1][SHA_DIGEST_LENGTH];
+    const gchar *query;
+
+    if (!req) {
+        LOG_err (ROUTER_LOG, "req == NULL !");
+        return;
+    }
+
+    query = evhttp_uri_get_query (evhttp_request_get_evhttp_uri (req));
+    if (!query || !http_query_find_sha1 (query, "info_hash", info_hash, 1)) {
+        evhttp_send_reply (req, HTTP_NOCONTENT, "Not Found", NULL);
+        return;
+    }
+
+    rreq = router_request_acquire (router, req, FALSE);
+    if (!router_forward (router, rreq, router_get_backend (router, info_hash[0]), evhttp_request_get_uri (req))) {
+        rreq->code = 502;
+        router_request_finish (rreq);
+    }
+}
+
+void router_on_scrape_cb (struct evhttp_request *req, void *ctx)
+{
+    Router *router = (Router *) ctx;
+    RouterRequest *rreq;
+    uint8_t info_hash[ROUTER_MAX_SCRAPE][SHA_DIGEST_LENGTH];
+    guint hash_backend[ROUTER_MAX_SCRAPE];
+    gchar uri[sizeof ("/scrape?") + ROUTER_MAX_SCRAPE * (sizeof ("info_hash=&") + SHA_DIGEST_LENGTH * 3)];
+    const gchar *query;
+    guint n, i, b;
+
+    if (!req) {
+        LOG_err (ROUTER_LOG, "req == NULL !");
+        return;
+    }
+
+    query = evhttp_uri_get_query (evhttp_request_get_evhttp_uri (req));
+    n = query ? http_query_find_sha1 (query, "info_hash", info_hash, ROUTER_MAX_SCRAPE) : 0;
+    if (!n) {
+        // full scrape is not supported in router mode
+        evhttp_send_reply (req, HTTP_NOCONTENT, "Not Found", NULL);
+        return;
+    }
+
+    for (i = 0; i < n; i++)
+        hash_backend[i] = router_get_backend (router, info_hash[i]);
+
+    rreq = router_request_acquire (router, req, TRUE);
+    // hold the request until all sub-requests are sent
+    rreq->pending++;
+
+    for (b = 0; b < router->n_backends; b++) {
+        gchar *p = uri;
+
+        p += g_snprintf (p, sizeof (uri), "/scrape?");
+        for (i = 0; i < n; i++) {
+            if (hash_backend[i] != b)
+                continue;
+            if (p[-1] != '?')
+                *p++ = '&';
+            p += g_snprintf (p, sizeof (uri) - (p - uri), "info_hash=");
+            escape_sha1 (p, info_hash[i]);
+            p += strlen (p);
+        }
+
+        if (p[-1] == '?')
+            continue;
+
+        if (!router_forward (router, rreq, b, uri))
+            rreq->code = 502;
+    }
+
+    if (--rreq->pending == 0)
+        router_request_finish (rreq);
+}
+/*}}}*/
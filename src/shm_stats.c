@@ -0,0 +1,155 @@
+/*
+ * Copyright (C) 2012-2013 Paul Ionkin <paul.ionkin@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include "shm_stats.h"
+#include <sys/mman.h>
+
+#define SHM_STATS_LOG "shm_stats"
+
+struct _ShmStats {
+    TrackerApp *app;
+    gchar *path;
+    ino_t ino;
+    ShmStatsHeader *hdr;
+
+    guint64 interval_us;
+    gint64 last_us;
+    guint64 lag_max_us;
+
+    struct event *ev_publish;
+};
+
+// single writer: the event loop
+static void shm_stats_publish (ShmStats *stats, const ShmStatsData *data)
+{
+    guint32 seq = stats->hdr->seq;
+
+    __atomic_store_n (&stats->hdr->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence (__ATOMIC_RELEASE);
+    memcpy (&stats->hdr->data, data, sizeof (ShmStatsData));
+    __atomic_store_n (&stats->hdr->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+static void shm_stats_on_publish_cb (G_GNUC_UNUSED evutil_socket_t fd, G_GNUC_UNUSED short event, void *ctx)
+{
+    ShmStats *stats = (ShmStats *) ctx;
+    ShmStatsData data;
+    gint64 now = g_get_monotonic_time ();
+    guint64 elapsed = now - stats->last_us;
+
+    memset (&data, 0, sizeof (data));
+    tracker_app_get_stats (stats->app, &data);
+
+    data.update_time_us = g_get_real_time ();
+    data.loop_lag_us = elapsed > stats->interval_us ? elapsed - stats->interval_us : 0;
+    stats->lag_max_us = MAX (stats->lag_max_us, data.loop_lag_us);
+    data.loop_lag_max_us = stats->lag_max_us;
+    stats->last_us = now;
+
+    shm_stats_publish (stats, &data);
+}
+
+ShmStats *shm_stats_create (TrackerApp *app)
+{
+    ConfData *conf = tracker_app_get_conf (app);
+    ShmStats *stats;
+    gchar *tmp_path;
+    struct stat st;
+    struct timeval tv;
+    guint interval;
+    void *map;
+    gint fd;
+
+    interval = MAX (conf_get_uint (conf, "shm_stats.interval"), 1);
+
+    stats = g_new0 (ShmStats, 1);
+    stats->app = app;
+    stats->path = g_strdup (conf_get_string (conf, "shm_stats.file"));
+    stats->interval_us = (guint64) interval * 1000;
+
+    // readers must never see a partially initialized file
+    tmp_path = g_strdup_printf ("%s.%d", stats->path, getpid ());
+    fd = open (tmp_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || ftruncate (fd, sizeof (ShmStatsHeader)) != 0 || fstat (fd, &st) != 0) {
+        LOG_err (SHM_STATS_LOG, "Failed to create %s: %s", tmp_path, strerror (errno));
+        if (fd >= 0) {
+            close (fd);
+            unlink (tmp_path);
+        }
+        g_free (tmp_path);
+        g_free (stats->path);
+        g_free (stats);
+        return NULL;
+    }
+
+    map = mmap (NULL, sizeof (ShmStatsHeader), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close (fd);
+    if (map == MAP_FAILED) {
+        LOG_err (SHM_STATS_LOG, "Failed to mmap %s: %s", tmp_path, strerror (errno));
+        unlink (tmp_path);
+        g_free (tmp_path);
+        g_free (stats->path);
+        g_free (stats);
+        return NULL;
+    }
+
+    stats->hdr = (ShmStatsHeader *) map;
+    stats->ino = st.st_ino;
+    memcpy (stats->hdr->magic, SHM_STATS_MAGIC, sizeof (stats->hdr->magic));
+    stats->hdr->version = SHM_STATS_VERSION;
+    stats->hdr->data_size = sizeof (ShmStatsData);
+    stats->hdr->pid = getpid ();
+    stats->hdr->start_time = time (NULL);
+
+    stats->last_us = g_get_monotonic_time ();
+    shm_stats_on_publish_cb (-1, 0, stats);
+
+    if (rename (tmp_path, stats->path) != 0) {
+        LOG_err (SHM_STATS_LOG, "Failed to rename %s to %s: %s", tmp_path, stats->path, strerror (errno));
+        unlink (tmp_path);
+        munmap (stats->hdr, sizeof (ShmStatsHeader));
+        g_free (tmp_path);
+        g_free (stats->path);
+        g_free (stats);
+        return NULL;
+    }
+    g_free (tmp_path);
+
+    tv.tv_sec = interval / 1000;
+    tv.tv_usec = (interval % 1000) * 1000;
+    stats->ev_publish = event_new (tracker_app_get_evbase (app), -1, EV_PERSIST, shm_stats_on_publish_cb, stats);
+    event_priority_set (stats->ev_publish, TRACKER_PRIO_BULK);
+    event_add (stats->ev_publish, &tv);
+
+    LOG_msg (SHM_STATS_LOG, "Publishing stats to %s every %u ms", stats->path, interval);
+
+    return stats;
+}
+
+void shm_stats_destroy (ShmStats *stats)
+{
+    struct stat st;
+
+    event_free (stats->ev_publish);
+
+    // new process could have taken over the path already
+    if (stat (stats->path, &st) == 0 && st.st_ino == stats->ino)
+        unlink (stats->path);
+
+    munmap (stats->hdr, sizeof (ShmStatsHeader));
+    g_free (stats->path);
+    g_free (stats);
+}
@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2012-2013 Paul Ionkin <paul.ionkin@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#ifndef _SHM_STATS_H_
+#define _SHM_STATS_H_
+
+#include "global.h"
+
+/*
+ * Stats file, usually under /dev/shm: header followed by ShmStatsData,
+ * host byte order. Tracker publishes a snapshot every shm_stats.interval ms,
+ * readers mmap the file and copy data while seq is even and unchanged:
+ *
+ *   do {
+ *       if (!shm_stats_read_begin (hdr, &seq))
+ *           break;
+ *       data = hdr->data;
+ *   } while (shm_stats_read_retry (hdr, seq));
+ *
+ * seq stays odd if the writer was killed in the middle of an update, so
+ * shm_stats_read_begin () gives up after SHM_STATS_READ_SPINS.
+ * Every tracker process creates a new file and renames it into place,
+ * re-open it when pid changes.
+ */
+#define SHM_STATS_MAGIC "TBSS"
+#define SHM_STATS_VERSION 2
+#define SHM_STATS_READ_SPINS 1000
+
+typedef struct {
+    // CLOCK_REALTIME of the snapshot, us
+    guint64 update_time_us;
+
+    // requests, by AnnounceEvent
+    guint64 announces[4];
+    guint64 scrapes;
+    // failure replies, such as "tracker is full"
+    guint64 failures;
+    // malformed or unknown requests
+    guint64 bad_requests;
+    // announces inside tracker.min_interval
+    guint64 short_circuited;
+
+    guint64 torrents;
+    guint64 peers;
+    guint64 memory_bytes;
+    guint64 memory_limit;
+    guint64 evicted_torrents;
+    guint64 evicted_peers;
+    guint64 expired_torrents;
+    guint64 expired_peers;
+    guint64 refused_torrents;
+
+    // delay of the publish timer, us
+    guint64 loop_lag_us;
+    guint64 loop_lag_max_us;
+} ShmStatsData;
+
+typedef struct {
+    char magic[4];
+    guint32 version;
+    guint32 data_size;
+    guint32 pid;
+    // unix time
+    guint64 start_time;
+    // odd while the snapshot is being written
+    guint32 seq;
+    guint32 reserved;
+    ShmStatsData data;
+} ShmStatsHeader;
+
+// FALSE if seq stays odd: the writer is descheduled or died mid-update
+static inline gboolean shm_stats_read_begin (const ShmStatsHeader *hdr, guint32 *seq)
+{
+    guint i;
+
+    for (i = 0; i < SHM_STATS_READ_SPINS; i++) {
+        *seq = __atomic_load_n (&hdr->seq, __ATOMIC_ACQUIRE);
+        if (!(*seq & 1))
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+static inline gboolean shm_stats_read_retry (const ShmStatsHeader *hdr, guint32 seq)
+{
+    __atomic_thread_fence (__ATOMIC_ACQUIRE);
+
+    return __atomic_load_n (&hdr->seq, __ATOMIC_RELAXED) != seq;
+}
+
+typedef struct _ShmStats ShmStats;
+
+ShmStats *shm_stats_create (TrackerApp *app);
+// removes the file, unless it was replaced by another process
+void shm_stats_destroy (ShmStats *stats);
+
+// fills counters and gauges of the snapshot, implemented in main.c
+void tracker_app_get_stats (TrackerApp *app, ShmStatsData *data);
+
+#endif
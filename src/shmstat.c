@@ -0,0 +1,217 @@
+/*
+ * Copyright (C) 2012-2013 Paul Ionkin <paul.ionkin@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+/*
+ * Reads stats published by tracker (shm_stats.enabled):
+ *   tbfs_shmstat [/dev/shm/tbfs_tracker.stats]
+ *   tbfs_shmstat -i 1 [/dev/shm/tbfs_tracker.stats]
+ * The first form prints the snapshot, the second prints rates every second.
+ */
+#include "shm_stats.h"
+#include <sys/mman.h>
+
+#define SHM_STAT_DEFAULT_FILE "/dev/shm/tbfs_tracker.stats"
+
+typedef struct {
+    const gchar *path;
+    const ShmStatsHeader *hdr;
+    ino_t ino;
+} ShmStatReader;
+
+static gboolean reader_open (ShmStatReader *reader)
+{
+    struct stat st;
+    void *map;
+    gint fd;
+
+    fd = open (reader->path, O_RDONLY);
+    if (fd < 0 || fstat (fd, &st) != 0 || (size_t) st.st_size < sizeof (ShmStatsHeader)) {
+        if (fd >= 0)
+            close (fd);
+        return FALSE;
+    }
+
+    map = mmap (NULL, sizeof (ShmStatsHeader), PROT_READ, MAP_SHARED, fd, 0);
+    close (fd);
+    if (map == MAP_FAILED)
+        return FALSE;
+
+    reader->hdr = (const ShmStatsHeader *) map;
+    if (memcmp (reader->hdr->magic, SHM_STATS_MAGIC, sizeof (reader->hdr->magic)) ||
+        reader->hdr->version != SHM_STATS_VERSION || reader->hdr->data_size != sizeof (ShmStatsData)) {
+        munmap ((void *) reader->hdr, sizeof (ShmStatsHeader));
+        reader->hdr = NULL;
+        return FALSE;
+    }
+    reader->ino = st.st_ino;
+
+    return TRUE;
+}
+
+static void reader_close (ShmStatReader *reader)
+{
+    if (reader->hdr)
+        munmap ((void *) reader->hdr, sizeof (ShmStatsHeader));
+    reader->hdr = NULL;
+}
+
+// re-opens the file if another tracker process replaced it,
+// sets writer_died if the snapshot was left half-written
+static gboolean reader_read (ShmStatReader *reader, ShmStatsData *data, gboolean *writer_died)
+{
+    struct stat st;
+    guint32 seq;
+
+    *writer_died = FALSE;
+
+    if (reader->hdr && (stat (reader->path, &st) != 0 || st.st_ino != reader->ino))
+        reader_close (reader);
+    if (!reader->hdr && !reader_open (reader))
+        return FALSE;
+
+    for (;;) {
+        if (!shm_stats_read_begin (reader->hdr, &seq)) {
+            // a live writer only got descheduled, a dead one never finishes
+            if (kill ((pid_t) reader->hdr->pid, 0) != 0 && errno == ESRCH) {
+                *writer_died = TRUE;
+                return FALSE;
+            }
+            g_usleep (1000);
+            continue;
+        }
+        memcpy (data, &reader->hdr->data, sizeof (ShmStatsData));
+        if (!shm_stats_read_retry (reader->hdr, seq))
+            break;
+    }
+
+    return TRUE;
+}
+
+static void print_snapshot (const ShmStatReader *reader, const ShmStatsData *d)
+{
+    g_fprintf (stdout, "pid: %u\n", reader->hdr->pid);
+    g_fprintf (stdout, "uptime: %"G_GUINT64_FORMAT"\n", d->update_time_us / G_USEC_PER_SEC - reader->hdr->start_time);
+    g_fprintf (stdout, "announces_started: %"G_GUINT64_FORMAT"\n", d->announces[0]);
+    g_fprintf (stdout, "announces_stopped: %"G_GUINT64_FORMAT"\n", d->announces[1]);
+    g_fprintf (stdout, "announces_completed: %"G_GUINT64_FORMAT"\n", d->announces[2]);
+    g_fprintf (stdout, "announces_update: %"G_GUINT64_FORMAT"\n", d->announces[3]);
+    g_fprintf (stdout, "scrapes: %"G_GUINT64_FORMAT"\n", d->scrapes);
+    g_fprintf (stdout, "failures: %"G_GUINT64_FORMAT"\n", d->failures);
+    g_fprintf (stdout, "bad_requests: %"G_GUINT64_FORMAT"\n", d->bad_requests);
+    g_fprintf (stdout, "short_circuited: %"G_GUINT64_FORMAT"\n", d->short_circuited);
+    g_fprintf (stdout, "torrents: %"G_GUINT64_FORMAT"\n", d->torrents);
+    g_fprintf (stdout, "peers: %"G_GUINT64_FORMAT"\n", d->peers);
+    g_fprintf (stdout, "memory_bytes: %"G_GUINT64_FORMAT"\n", d->memory_bytes);
+    g_fprintf (stdout, "memory_limit: %"G_GUINT64_FORMAT"\n", d->memory_limit);
+    g_fprintf (stdout, "evicted_torrents: %"G_GUINT64_FORMAT"\n", d->evicted_torrents);
+    g_fprintf (stdout, "evicted_peers: %"G_GUINT64_FORMAT"\n", d->evicted_peers);
+    g_fprintf (stdout, "expired_torrents: %"G_GUINT64_FORMAT"\n", d->expired_torrents);
+    g_fprintf (stdout, "expired_peers: %"G_GUINT64_FORMAT"\n", d->expired_peers);
+    g_fprintf (stdout, "refused_torrents: %"G_GUINT64_FORMAT"\n", d->refused_torrents);
+    g_fprintf (stdout, "loop_lag_us: %"G_GUINT64_FORMAT"\n", d->loop_lag_us);
+    g_fprintf (stdout, "loop_lag_max_us: %"G_GUINT64_FORMAT"\n", d->loop_lag_max_us);
+}
+
+static guint64 total_announces (const ShmStatsData *d)
+{
+    return d->announces[0] + d->announces[1] + d->announces[2] + d->announces[3];
+}
+
+static void print_rates (const ShmStatsData *prev, const ShmStatsData *d)
+{
+    gdouble secs = (d->update_time_us - prev->update_time_us) / (gdouble) G_USEC_PER_SEC;
+
+    if (secs <= 0)
+        return;
+
+    g_fprintf (stdout, "%10.0f %10.0f %10.0f %10.0f %10"G_GUINT64_FORMAT" %10"G_GUINT64_FORMAT" %10.1f %10"G_GUINT64_FORMAT"\n",
+        (total_announces (d) - total_announces (prev)) / secs,
+        (d->scrapes - prev->scrapes) / secs,
+        (d->failures - prev->failures) / secs,
+        (d->bad_requests - prev->bad_requests) / secs,
+        d->torrents, d->peers, d->memory_bytes / (1024.0 * 1024.0), d->loop_lag_us);
+}
+
+int main (int argc, char *argv[])
+{
+    GOptionContext *context;
+    GError *error = NULL;
+    gint interval = 0;
+    ShmStatReader reader;
+    ShmStatsData data, prev;
+    gboolean have_prev = FALSE;
+    gboolean writer_died;
+    gboolean died_reported = FALSE;
+    guint lines = 0;
+    GOptionEntry entries[] = {
+        { "interval", 'i', 0, G_OPTION_ARG_INT, &interval, "Print rates every N seconds.", NULL },
+        { NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL }
+    };
+
+    context = g_option_context_new ("[stats_file]");
+    g_option_context_add_main_entries (context, entries, NULL);
+    if (!g_option_context_parse (context, &argc, &argv, &error) || interval < 0) {
+        g_fprintf (stderr, "Usage: %s [-i seconds] [stats_file]\n", argv[0]);
+        g_option_context_free (context);
+        return -1;
+    }
+    g_option_context_free (context);
+
+    memset (&reader, 0, sizeof (reader));
+    reader.path = argc > 1 ? argv[1] : SHM_STAT_DEFAULT_FILE;
+
+    if (!reader_read (&reader, &data, &writer_died)) {
+        if (writer_died)
+            g_fprintf (stderr, "Failed to read %s: writer died mid-update\n", reader.path);
+        else
+            g_fprintf (stderr, "Failed to read %s\n", reader.path);
+        return -1;
+    }
+
+    if (!interval) {
+        print_snapshot (&reader, &data);
+        reader_close (&reader);
+        return 0;
+    }
+
+    for (;;) {
+        if (have_prev) {
+            if (lines++ % 20 == 0)
+                g_fprintf (stdout, "%10s %10s %10s %10s %10s %10s %10s %10s\n", "announce/s", "scrape/s",
+                    "failure/s", "bad/s", "torrents", "peers", "memory MB", "lag us");
+            print_rates (&prev, &data);
+            fflush (stdout);
+        }
+        prev = data;
+        have_prev = TRUE;
+
+        sleep (interval);
+        // tracker is restarting, wait for the new file
+        while (!reader_read (&reader, &data, &writer_died)) {
+            if (writer_died && !died_reported) {
+                g_fprintf (stderr, "%s: writer died mid-update, waiting for a new tracker\n", reader.path);
+                died_reported = TRUE;
+            }
+            sleep (1);
+        }
+        died_reported = FALSE;
+        // counters start over in a new process
+        if (total_announces (&data) < total_announces (&prev))
+            have_prev = FALSE;
+    }
+
+    return 0;
+}
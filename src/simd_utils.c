@@ -0,0 +1,518 @@
+/*
+ * Copyright (C) 2012-2013 Paul Ionkin <paul.ionkin@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include "global.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SIMD_X86
+#include <immintrin.h>
+#define SIMD_TARGET_SSSE3 __attribute__ ((target ("ssse3")))
+#define SIMD_TARGET_AVX2 __attribute__ ((target ("avx2")))
+#endif
+
+typedef struct {
+    void (*sha1_to_hexstr) (gchar *out, const uint8_t *sha1);
+    gboolean (*hexstr_to_sha1) (uint8_t *out, const char *in);
+    gboolean (*sha1_unescape) (uint8_t *out, const gchar *in, size_t len);
+} SimdKernels;
+
+static const char hex_chars[] = "0123456789abcdef";
+
+// HEX_VALID | value of hex digits, 0 for other characters
+#define HEX_VALID 0x10
+#define HEX(v) (HEX_VALID | (v))
+static const uint8_t hex_values[256] = {
+    ['0'] = HEX (0), ['1'] = HEX (1), ['2'] = HEX (2), ['3'] = HEX (3), ['4'] = HEX (4),
+    ['5'] = HEX (5), ['6'] = HEX (6), ['7'] = HEX (7), ['8'] = HEX (8), ['9'] = HEX (9),
+    ['a'] = HEX (10), ['b'] = HEX (11), ['c'] = HEX (12), ['d'] = HEX (13), ['e'] = HEX (14), ['f'] = HEX (15),
+    ['A'] = HEX (10), ['B'] = HEX (11), ['C'] = HEX (12), ['D'] = HEX (13), ['E'] = HEX (14), ['F'] = HEX (15),
+};
+
+// hi and lo must be hex digits
+static inline uint8_t hex_pair_value (gchar hi, gchar lo)
+{
+    return (uint8_t) (((hex_values[(uint8_t) hi] & 0x0f) << 4) | (hex_values[(uint8_t) lo] & 0x0f));
+}
+
+/*{{{ scalar */
+static void sha1_to_hexstr_scalar (gchar *out, const uint8_t *sha1)
+{
+    gint i;
+
+    for (i = 0; i < SHA_DIGEST_LENGTH; i++) {
+        *out++ = hex_chars[sha1[i] >> 4];
+        *out++ = hex_chars[sha1[i] & 0xf];
+    }
+
+    *out = '\0';
+}
+
+static gboolean hexstr_to_sha1_scalar (uint8_t *out, const char *in)
+{
+    gint i;
+
+    for (i = 0; i < SHA_DIGEST_LENGTH; i++) {
+        // stops at '\0' of a shorter string
+        if (!(hex_values[(uint8_t) in[i * 2]] & HEX_VALID) || !(hex_values[(uint8_t) in[i * 2 + 1]] & HEX_VALID))
+            return FALSE;
+
+        out[i] = hex_pair_value (in[i * 2], in[i * 2 + 1]);
+    }
+
+    return TRUE;
+}
+
+// reference behaviour for SIMD versions: invalid escapes are taken literally,
+// '+' is a space
+static gboolean sha1_unescape_scalar (uint8_t *out, const gchar *in, size_t len)
+{
+    const gchar *end = in + len;
+    guint i = 0;
+
+    while (in < end && i < SHA_DIGEST_LENGTH) {
+        if (*in == '%' && in + 2 < end &&
+            (hex_values[(uint8_t) in[1]] & HEX_VALID) && (hex_values[(uint8_t) in[2]] & HEX_VALID)) {
+            out[i++] = hex_pair_value (in[1], in[2]);
+            in += 3;
+        } else if (*in == '+') {
+            out[i++] = ' ';
+            in++;
+        } else {
+            out[i++] = (uint8_t) *in++;
+        }
+    }
+
+    return i == SHA_DIGEST_LENGTH && in == end;
+}
+/*}}}*/
+
+#ifdef SIMD_X86
+
+// 20 <= len <= 60, esc: bit i is set if in[i] starts an escape
+static gboolean sha1_unescape_emit (uint8_t *out, const gchar *in, size_t len, guint64 esc)
+{
+    // bytes starting output characters, the i-th of them is out[i]
+    guint64 starts = ~((esc << 1) | (esc << 2)) & ((1ULL << len) - 1);
+    guint p;
+    gint i;
+
+    if (len - 2 * (size_t) __builtin_popcountll (esc) != SHA_DIGEST_LENGTH)
+        return FALSE;
+
+    // branchless, escapes of random binaries are unpredictable;
+    // digits after a literal are read too, in[len] at most
+    for (i = 0; i < SHA_DIGEST_LENGTH - 1; i++) {
+        uint8_t c, lit, dec, mask;
+
+        p = __builtin_ctzll (starts);
+        c = (uint8_t) in[p];
+        lit = c == '+' ? ' ' : c;
+        dec = hex_pair_value (in[p + 1], in[p + 2]);
+        mask = (uint8_t) -(gint) ((esc >> p) & 1);
+
+        out[i] = (dec & mask) | (lit & ~mask);
+        starts &= starts - 1;
+    }
+
+    // the last one may end the value
+    p = __builtin_ctzll (starts);
+    if ((esc >> p) & 1)
+        out[i] = hex_pair_value (in[p + 1], in[p + 2]);
+    else
+        out[i] = in[p] == '+' ? ' ' : (uint8_t) in[p];
+
+    return TRUE;
+}
+
+// "%xx" repeated SHA_DIGEST_LENGTH times
+#define SHA1_ALL_ESCAPED 0x249249249249249ULL
+
+/*{{{ ssse3 */
+// 0xff where c is a hex digit
+SIMD_TARGET_SSSE3
+static inline __m128i hex_mask_ssse3 (__m128i c)
+{
+    __m128i d = _mm_sub_epi8 (c, _mm_set1_epi8 ('0'));
+    __m128i a = _mm_sub_epi8 (_mm_or_si128 (c, _mm_set1_epi8 (0x20)), _mm_set1_epi8 ('a'));
+
+    return _mm_or_si128 (_mm_cmpeq_epi8 (_mm_min_epu8 (d, _mm_set1_epi8 (9)), d),
+        _mm_cmpeq_epi8 (_mm_min_epu8 (a, _mm_set1_epi8 (5)), a));
+}
+
+// value of hex digits, garbage for other characters
+SIMD_TARGET_SSSE3
+static inline __m128i hex_value_ssse3 (__m128i c)
+{
+    __m128i alpha = _mm_and_si128 (_mm_cmpgt_epi8 (c, _mm_set1_epi8 ('9')), _mm_set1_epi8 (9));
+
+    return _mm_add_epi8 (_mm_and_si128 (c, _mm_set1_epi8 (0x0f)), alpha);
+}
+
+// pairs of digit values to bytes, in the low 8 bytes
+SIMD_TARGET_SSSE3
+static inline __m128i hex_pack_ssse3 (__m128i v)
+{
+    __m128i w = _mm_maddubs_epi16 (v, _mm_set1_epi16 (0x0110));
+
+    return _mm_packus_epi16 (w, w);
+}
+
+SIMD_TARGET_SSSE3
+static inline void hex_encode16_ssse3 (gchar *out, __m128i x)
+{
+    const __m128i table = _mm_setr_epi8 ('0', '1', '2', '3', '4', '5', '6', '7',
+        '8', '9', 'a', 'b', 'c', 'd', 'e', 'f');
+    const __m128i mask = _mm_set1_epi8 (0x0f);
+    __m128i hi = _mm_shuffle_epi8 (table, _mm_and_si128 (_mm_srli_epi16 (x, 4), mask));
+    __m128i lo = _mm_shuffle_epi8 (table, _mm_and_si128 (x, mask));
+
+    _mm_storeu_si128 ((__m128i *) out, _mm_unpacklo_epi8 (hi, lo));
+    _mm_storeu_si128 ((__m128i *) (out + 16), _mm_unpackhi_epi8 (hi, lo));
+}
+
+// blocks at 0 and 4 overlap, nothing is read past sha1
+SIMD_TARGET_SSSE3
+static void sha1_to_hexstr_ssse3 (gchar *out, const uint8_t *sha1)
+{
+    hex_encode16_ssse3 (out, _mm_loadu_si128 ((const __m128i *) sha1));
+    hex_encode16_ssse3 (out + 8, _mm_loadu_si128 ((const __m128i *) (sha1 + 4)));
+    out[SHA_DIGEST_LENGTH * 2] = '\0';
+}
+
+// 16 characters to 8 bytes, returns 0xffff if all are hex digits
+SIMD_TARGET_SSSE3
+static inline gint hex_decode16_ssse3 (uint8_t *out, const char *in)
+{
+    __m128i c = _mm_loadu_si128 ((const __m128i *) in);
+
+    _mm_storel_epi64 ((__m128i *) out, hex_pack_ssse3 (hex_value_ssse3 (c)));
+
+    return _mm_movemask_epi8 (hex_mask_ssse3 (c));
+}
+
+SIMD_TARGET_SSSE3
+static gboolean hexstr_to_sha1_ssse3 (uint8_t *out, const char *in)
+{
+    gint valid;
+
+    // loads are 16 bytes wide, don't read past '\0' of a shorter string
+    if (strnlen (in, SHA_DIGEST_LENGTH * 2) != SHA_DIGEST_LENGTH * 2)
+        return FALSE;
+
+    valid = hex_decode16_ssse3 (out, in);
+    valid &= hex_decode16_ssse3 (out + 8, in + 16);
+    valid &= hex_decode16_ssse3 (out + 12, in + 24);
+
+    return valid == 0xffff;
+}
+
+SIMD_TARGET_SSSE3
+static inline void unescape_classify16_ssse3 (const gchar *in, guint shift, guint64 *pct, guint64 *hex)
+{
+    __m128i c = _mm_loadu_si128 ((const __m128i *) (in + shift));
+
+    *pct |= (guint64) (guint32) _mm_movemask_epi8 (_mm_cmpeq_epi8 (c, _mm_set1_epi8 ('%'))) << shift;
+    *hex |= (guint64) (guint32) _mm_movemask_epi8 (hex_mask_ssse3 (c)) << shift;
+}
+
+// 5 "%xx" triplets at given offsets of in to 5 bytes
+SIMD_TARGET_SSSE3
+static inline __m128i unescape_triplets_ssse3 (const gchar *in, __m128i shuf)
+{
+    __m128i c = _mm_shuffle_epi8 (_mm_loadu_si128 ((const __m128i *) in), shuf);
+
+    return hex_pack_ssse3 (hex_value_ssse3 (c));
+}
+
+// nothing is escaped, only '+' needs to be replaced
+SIMD_TARGET_SSSE3
+static inline void sha1_unescape_plain_ssse3 (uint8_t *out, const gchar *in)
+{
+    const __m128i plus = _mm_set1_epi8 ('+');
+    const __m128i flip = _mm_set1_epi8 ('+' ^ ' ');
+    __m128i a = _mm_loadu_si128 ((const __m128i *) in);
+    __m128i b = _mm_loadu_si128 ((const __m128i *) (in + 4));
+
+    a = _mm_xor_si128 (a, _mm_and_si128 (_mm_cmpeq_epi8 (a, plus), flip));
+    b = _mm_xor_si128 (b, _mm_and_si128 (_mm_cmpeq_epi8 (b, plus), flip));
+    _mm_storeu_si128 ((__m128i *) (out + 4), b);
+    _mm_storeu_si128 ((__m128i *) out, a);
+}
+
+// loads at 0, 15, 30 and 44, the last one is shifted to stay inside in
+SIMD_TARGET_SSSE3
+static void sha1_unescape_all_ssse3 (uint8_t *out, const gchar *in)
+{
+    const __m128i shuf = _mm_setr_epi8 (1, 2, 4, 5, 7, 8, 10, 11, 13, 14, -1, -1, -1, -1, -1, -1);
+    const __m128i shuf_last = _mm_setr_epi8 (2, 3, 5, 6, 8, 9, 11, 12, 14, 15, -1, -1, -1, -1, -1, -1);
+    uint8_t tmp[24];
+
+    _mm_storel_epi64 ((__m128i *) tmp, unescape_triplets_ssse3 (in, shuf));
+    _mm_storel_epi64 ((__m128i *) (tmp + 5), unescape_triplets_ssse3 (in + 15, shuf));
+    _mm_storel_epi64 ((__m128i *) (tmp + 10), unescape_triplets_ssse3 (in + 30, shuf));
+    _mm_storel_epi64 ((__m128i *) (tmp + 15), unescape_triplets_ssse3 (in + 44, shuf_last));
+    memcpy (out, tmp, SHA_DIGEST_LENGTH);
+}
+
+SIMD_TARGET_SSSE3
+static gboolean sha1_unescape_ssse3 (uint8_t *out, const gchar *in, size_t len)
+{
+    guint64 pct = 0, hex = 0, esc;
+    size_t off;
+
+    if (len < SHA_DIGEST_LENGTH || len > SHA_DIGEST_LENGTH * 3)
+        return FALSE;
+
+    // the last block overlaps, masks of both agree on shared bytes
+    for (off = 0; off + 16 <= len; off += 16)
+        unescape_classify16_ssse3 (in, off, &pct, &hex);
+    if (off < len)
+        unescape_classify16_ssse3 (in, len - 16, &pct, &hex);
+
+    // '%' followed by two hex digits, these never overlap
+    esc = pct & (hex >> 1) & (hex >> 2);
+    if (esc == SHA1_ALL_ESCAPED) {
+        sha1_unescape_all_ssse3 (out, in);
+        return TRUE;
+    }
+    if (!esc && len == SHA_DIGEST_LENGTH) {
+        sha1_unescape_plain_ssse3 (out, in);
+        return TRUE;
+    }
+
+    return sha1_unescape_emit (out, in, len, esc);
+}
+/*}}}*/
+
+/*{{{ avx2 */
+SIMD_TARGET_AVX2
+static inline __m256i hex_mask_avx2 (__m256i c)
+{
+    __m256i d = _mm256_sub_epi8 (c, _mm256_set1_epi8 ('0'));
+    __m256i a = _mm256_sub_epi8 (_mm256_or_si256 (c, _mm256_set1_epi8 (0x20)), _mm256_set1_epi8 ('a'));
+
+    return _mm256_or_si256 (_mm256_cmpeq_epi8 (_mm256_min_epu8 (d, _mm256_set1_epi8 (9)), d),
+        _mm256_cmpeq_epi8 (_mm256_min_epu8 (a, _mm256_set1_epi8 (5)), a));
+}
+
+SIMD_TARGET_AVX2
+static inline __m256i hex_value_avx2 (__m256i c)
+{
+    __m256i alpha = _mm256_and_si256 (_mm256_cmpgt_epi8 (c, _mm256_set1_epi8 ('9')), _mm256_set1_epi8 (9));
+
+    return _mm256_add_epi8 (_mm256_and_si256 (c, _mm256_set1_epi8 (0x0f)), alpha);
+}
+
+// both lanes at once: bytes 0..15 in the low lane, 4..19 in the high one
+SIMD_TARGET_AVX2
+static void sha1_to_hexstr_avx2 (gchar *out, const uint8_t *sha1)
+{
+    const __m256i table = _mm256_setr_epi8 ('0', '1', '2', '3', '4', '5', '6', '7',
+        '8', '9', 'a', 'b', 'c', 'd', 'e', 'f',
+        '0', '1', '2', '3', '4', '5', '6', '7',
+        '8', '9', 'a', 'b', 'c', 'd', 'e', 'f');
+    const __m256i mask = _mm256_set1_epi8 (0x0f);
+    __m256i x, hi, lo, l, h;
+
+    x = _mm256_inserti128_si256 (_mm256_castsi128_si256 (_mm_loadu_si128 ((const __m128i *) sha1)),
+        _mm_loadu_si128 ((const __m128i *) (sha1 + 4)), 1);
+    hi = _mm256_shuffle_epi8 (table, _mm256_and_si256 (_mm256_srli_epi16 (x, 4), mask));
+    lo = _mm256_shuffle_epi8 (table, _mm256_and_si256 (x, mask));
+    l = _mm256_unpacklo_epi8 (hi, lo);
+    h = _mm256_unpackhi_epi8 (hi, lo);
+
+    // characters 0..15, 16..31 and 24..39
+    _mm_storeu_si128 ((__m128i *) out, _mm256_castsi256_si128 (l));
+    _mm_storeu_si128 ((__m128i *) (out + 16), _mm256_castsi256_si128 (h));
+    _mm_storeu_si128 ((__m128i *) (out + 24), _mm256_extracti128_si256 (h, 1));
+    out[SHA_DIGEST_LENGTH * 2] = '\0';
+}
+
+SIMD_TARGET_AVX2
+static gboolean hexstr_to_sha1_avx2 (uint8_t *out, const char *in)
+{
+    __m256i c, w, packed;
+    gint valid;
+
+    // see hexstr_to_sha1_ssse3
+    if (strnlen (in, SHA_DIGEST_LENGTH * 2) != SHA_DIGEST_LENGTH * 2)
+        return FALSE;
+
+    c = _mm256_loadu_si256 ((const __m256i *) in);
+    w = _mm256_maddubs_epi16 (hex_value_avx2 (c), _mm256_set1_epi16 (0x0110));
+    packed = _mm256_packus_epi16 (w, w);
+    // low qword of each lane holds 8 bytes
+    _mm_storeu_si128 ((__m128i *) out, _mm256_castsi256_si128 (_mm256_permute4x64_epi64 (packed, 0x08)));
+
+    valid = _mm256_movemask_epi8 (hex_mask_avx2 (c)) == -1;
+    valid &= hex_decode16_ssse3 (out + 12, in + 24) == 0xffff;
+
+    return valid;
+}
+
+// lanes of a and b take triplets at 0, 15 and 30, 44 (see SSSE3 version)
+SIMD_TARGET_AVX2
+static void sha1_unescape_all_avx2 (uint8_t *out, const gchar *in)
+{
+    const __m256i shuf_a = _mm256_setr_epi8 (1, 2, 4, 5, 7, 8, 10, 11, 13, 14, -1, -1, -1, -1, -1, -1,
+        1, 2, 4, 5, 7, 8, 10, 11, 13, 14, -1, -1, -1, -1, -1, -1);
+    const __m256i shuf_b = _mm256_setr_epi8 (1, 2, 4, 5, 7, 8, 10, 11, 13, 14, -1, -1, -1, -1, -1, -1,
+        2, 3, 5, 6, 8, 9, 11, 12, 14, 15, -1, -1, -1, -1, -1, -1);
+    __m256i a, b, w;
+    uint8_t tmp[24];
+
+    a = _mm256_inserti128_si256 (_mm256_castsi128_si256 (_mm_loadu_si128 ((const __m128i *) in)),
+        _mm_loadu_si128 ((const __m128i *) (in + 15)), 1);
+    b = _mm256_inserti128_si256 (_mm256_castsi128_si256 (_mm_loadu_si128 ((const __m128i *) (in + 30))),
+        _mm_loadu_si128 ((const __m128i *) (in + 44)), 1);
+    a = hex_value_avx2 (_mm256_shuffle_epi8 (a, shuf_a));
+    b = hex_value_avx2 (_mm256_shuffle_epi8 (b, shuf_b));
+
+    // 5 bytes at the start of every lane
+    w = _mm256_packus_epi16 (_mm256_maddubs_epi16 (a, _mm256_set1_epi16 (0x0110)),
+        _mm256_maddubs_epi16 (b, _mm256_set1_epi16 (0x0110)));
+    _mm_storel_epi64 ((__m128i *) tmp, _mm256_castsi256_si128 (w));
+    _mm_storel_epi64 ((__m128i *) (tmp + 5), _mm256_extracti128_si256 (w, 1));
+    _mm_storel_epi64 ((__m128i *) (tmp + 10), _mm_srli_si128 (_mm256_castsi256_si128 (w), 8));
+    _mm_storel_epi64 ((__m128i *) (tmp + 15), _mm_srli_si128 (_mm256_extracti128_si256 (w, 1), 8));
+    memcpy (out, tmp, SHA_DIGEST_LENGTH);
+}
+
+SIMD_TARGET_AVX2
+static inline void unescape_classify32_avx2 (const gchar *in, guint shift, guint64 *pct, guint64 *hex)
+{
+    __m256i c = _mm256_loadu_si256 ((const __m256i *) (in + shift));
+
+    *pct |= (guint64) (guint32) _mm256_movemask_epi8 (_mm256_cmpeq_epi8 (c, _mm256_set1_epi8 ('%'))) << shift;
+    *hex |= (guint64) (guint32) _mm256_movemask_epi8 (hex_mask_avx2 (c)) << shift;
+}
+
+SIMD_TARGET_AVX2
+static gboolean sha1_unescape_avx2 (uint8_t *out, const gchar *in, size_t len)
+{
+    guint64 pct = 0, hex = 0, esc;
+
+    if (len < SHA_DIGEST_LENGTH || len > SHA_DIGEST_LENGTH * 3)
+        return FALSE;
+
+    if (len >= 32) {
+        unescape_classify32_avx2 (in, 0, &pct, &hex);
+        unescape_classify32_avx2 (in, len - 32, &pct, &hex);
+    } else {
+        unescape_classify16_ssse3 (in, 0, &pct, &hex);
+        unescape_classify16_ssse3 (in, len - 16, &pct, &hex);
+    }
+
+    esc = pct & (hex >> 1) & (hex >> 2);
+    if (esc == SHA1_ALL_ESCAPED) {
+        sha1_unescape_all_avx2 (out, in);
+        return TRUE;
+    }
+    if (!esc && len == SHA_DIGEST_LENGTH) {
+        sha1_unescape_plain_ssse3 (out, in);
+        return TRUE;
+    }
+
+    return sha1_unescape_emit (out, in, len, esc);
+}
+/*}}}*/
+
+#endif
+
+static const SimdKernels simd_kernels[SIMD_max] = {
+    { sha1_to_hexstr_scalar, hexstr_to_sha1_scalar, sha1_unescape_scalar },
+#ifdef SIMD_X86
+    { sha1_to_hexstr_ssse3, hexstr_to_sha1_ssse3, sha1_unescape_ssse3 },
+    { sha1_to_hexstr_avx2, hexstr_to_sha1_avx2, sha1_unescape_avx2 },
+#else
+    { NULL, NULL, NULL },
+    { NULL, NULL, NULL },
+#endif
+};
+
+static const SimdKernels *simd = NULL;
+static SimdLevel simd_level = SIMD_scalar;
+
+SimdLevel simd_get_best_level (void)
+{
+#ifdef SIMD_X86
+    __builtin_cpu_init ();
+    if (__builtin_cpu_supports ("avx2"))
+        return SIMD_avx2;
+    if (__builtin_cpu_supports ("ssse3"))
+        return SIMD_ssse3;
+#endif
+    return SIMD_scalar;
+}
+
+gboolean simd_set_level (SimdLevel level)
+{
+    if (level >= SIMD_max || level > simd_get_best_level ())
+        return FALSE;
+
+    simd_level = level;
+    simd = &simd_kernels[level];
+
+    return TRUE;
+}
+
+SimdLevel simd_get_level (void)
+{
+    if (G_UNLIKELY (!simd))
+        simd_set_level (simd_get_best_level ());
+
+    return simd_level;
+}
+
+const gchar *simd_level_to_str (SimdLevel level)
+{
+    switch (level) {
+        case SIMD_scalar:
+            return "scalar";
+        case SIMD_ssse3:
+            return "ssse3";
+        case SIMD_avx2:
+            return "avx2";
+        case SIMD_max:
+        default:
+            return "unknown";
+    }
+}
+
+static inline const SimdKernels *simd_get_kernels (void)
+{
+    if (G_UNLIKELY (!simd))
+        simd_set_level (simd_get_best_level ());
+
+    return simd;
+}
+
+// out: 2 * SHA_DIGEST_LENGTH + 1
+void sha1_to_hexstr (gchar *out, const uint8_t *sha1)
+{
+    simd_get_kernels ()->sha1_to_hexstr (out, sha1);
+}
+
+// in: 2 * SHA_DIGEST_LENGTH characters, out is undefined if FALSE is returned
+gboolean hexstr_to_sha1 (uint8_t *out, const char *in)
+{
+    return simd_get_kernels ()->hexstr_to_sha1 (out, in);
+}
+
+gboolean sha1_unescape (uint8_t *out, const gchar *in, size_t len)
+{
+    return simd_get_kernels ()->sha1_unescape (out, in, len);
+}
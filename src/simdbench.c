@@ -0,0 +1,235 @@
+/*
+ * Copyright (C) 2012-2013 Paul Ionkin <paul.ionkin@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+/*
+ * Checks SIMD string kernels against the scalar ones and measures them:
+ *   tbfs_simdbench [-n iterations] [-s seed]
+ * Exits with non-zero status if any kernel disagrees with the scalar version.
+ */
+#include "global.h"
+
+#define BENCH_CASES 4096
+
+typedef struct {
+    uint8_t sha1[SHA_DIGEST_LENGTH];
+    // lower or upper case hex, sometimes broken or short
+    gchar hex[SHA_DIGEST_LENGTH * 2 + 1];
+    // percent-encoded the way clients do it, sometimes malformed
+    gchar escaped[SHA_DIGEST_LENGTH * 3 + 8];
+    size_t escaped_len;
+} BenchCase;
+
+static void bench_case_init (BenchCase *c, GRand *rnd)
+{
+    static const gchar unreserved[] = "-._~";
+    gint style = g_rand_int_range (rnd, 0, 4);
+    gchar *o = c->escaped;
+    gint i;
+
+    for (i = 0; i < SHA_DIGEST_LENGTH; i++) {
+        // printable bytes are frequent in peer_id
+        if (style == 3 && i < 8)
+            c->sha1[i] = (uint8_t) g_rand_int_range (rnd, 0x20, 0x7f);
+        else
+            c->sha1[i] = (uint8_t) g_rand_int_range (rnd, 0, 256);
+    }
+
+    for (i = 0; i < SHA_DIGEST_LENGTH; i++) {
+        gboolean upper = g_rand_int_range (rnd, 0, 2);
+
+        c->hex[i * 2] = (upper ? "0123456789ABCDEF" : "0123456789abcdef")[c->sha1[i] >> 4];
+        c->hex[i * 2 + 1] = (upper ? "0123456789ABCDEF" : "0123456789abcdef")[c->sha1[i] & 0xf];
+    }
+    c->hex[SHA_DIGEST_LENGTH * 2] = '\0';
+    switch (g_rand_int_range (rnd, 0, 32)) {
+        case 0:
+        case 1:
+            c->hex[g_rand_int_range (rnd, 0, SHA_DIGEST_LENGTH * 2)] = "gG/:@`z "[g_rand_int_range (rnd, 0, 8)];
+            break;
+        case 2:
+            c->hex[g_rand_int_range (rnd, 0, SHA_DIGEST_LENGTH * 2)] = '\0';
+            break;
+        default:
+            break;
+    }
+
+    for (i = 0; i < SHA_DIGEST_LENGTH; i++) {
+        uint8_t b = c->sha1[i];
+
+        // 0: everything escaped, 1: alnum kept, 2: unreserved kept, 3: as 2, space as '+'
+        if (style == 3 && b == ' ')
+            *o++ = '+';
+        else if ((style >= 1 && g_ascii_isalnum (b)) || (style >= 2 && b && strchr (unreserved, b)))
+            *o++ = (gchar) b;
+        else
+            o += g_snprintf (o, 4, g_rand_int_range (rnd, 0, 2) ? "%%%02x" : "%%%02X", b);
+    }
+    c->escaped_len = o - c->escaped;
+
+    // a stray '%', truncated escape or an extra byte
+    switch (g_rand_int_range (rnd, 0, 32)) {
+        case 0:
+            c->escaped[g_rand_int_range (rnd, 0, c->escaped_len)] = '%';
+            break;
+        case 1:
+            c->escaped_len -= g_rand_int_range (rnd, 1, 3);
+            break;
+        case 2:
+            c->escaped[c->escaped_len++] = 'x';
+            break;
+        default:
+            break;
+    }
+    c->escaped[c->escaped_len] = '\0';
+}
+
+// results of the current level against the scalar ones
+static guint bench_check (const BenchCase *cases, SimdLevel level)
+{
+    guint errors = 0;
+    guint i;
+
+    for (i = 0; i < BENCH_CASES; i++) {
+        const BenchCase *c = &cases[i];
+        gchar hex_a[SHA_DIGEST_LENGTH * 2 + 1], hex_b[SHA_DIGEST_LENGTH * 2 + 1];
+        uint8_t bin_a[SHA_DIGEST_LENGTH], bin_b[SHA_DIGEST_LENGTH];
+        gboolean ret_a, ret_b;
+
+        simd_set_level (SIMD_scalar);
+        sha1_to_hexstr (hex_a, c->sha1);
+        simd_set_level (level);
+        sha1_to_hexstr (hex_b, c->sha1);
+        if (strcmp (hex_a, hex_b)) {
+            g_fprintf (stderr, "%s: sha1_to_hexstr mismatch: %s != %s\n", simd_level_to_str (level), hex_b, hex_a);
+            errors++;
+        }
+
+        simd_set_level (SIMD_scalar);
+        ret_a = hexstr_to_sha1 (bin_a, c->hex);
+        simd_set_level (level);
+        ret_b = hexstr_to_sha1 (bin_b, c->hex);
+        if (ret_a != ret_b || (ret_a && memcmp (bin_a, bin_b, SHA_DIGEST_LENGTH))) {
+            g_fprintf (stderr, "%s: hexstr_to_sha1 mismatch: %s\n", simd_level_to_str (level), c->hex);
+            errors++;
+        }
+
+        simd_set_level (SIMD_scalar);
+        ret_a = sha1_unescape (bin_a, c->escaped, c->escaped_len);
+        simd_set_level (level);
+        ret_b = sha1_unescape (bin_b, c->escaped, c->escaped_len);
+        if (ret_a != ret_b || (ret_a && memcmp (bin_a, bin_b, SHA_DIGEST_LENGTH))) {
+            g_fprintf (stderr, "%s: sha1_unescape mismatch: %s\n", simd_level_to_str (level), c->escaped);
+            errors++;
+        }
+    }
+
+    return errors;
+}
+
+static gdouble bench_ns (gint64 start, guint64 iterations)
+{
+    return (g_get_monotonic_time () - start) * 1000.0 / iterations;
+}
+
+static void bench_run (const BenchCase *cases, SimdLevel level, guint64 iterations)
+{
+    gchar hex[SHA_DIGEST_LENGTH * 2 + 1];
+    uint8_t bin[SHA_DIGEST_LENGTH];
+    // keeps results alive
+    volatile guint sink = 0;
+    gdouble ns_hex, ns_unhex, ns_unescape;
+    guint64 i;
+    gint64 start;
+
+    simd_set_level (level);
+
+    start = g_get_monotonic_time ();
+    for (i = 0; i < iterations; i++) {
+        sha1_to_hexstr (hex, cases[i % BENCH_CASES].sha1);
+        sink += (guint) hex[i % (SHA_DIGEST_LENGTH * 2)];
+    }
+    ns_hex = bench_ns (start, iterations);
+
+    start = g_get_monotonic_time ();
+    for (i = 0; i < iterations; i++) {
+        sink += hexstr_to_sha1 (bin, cases[i % BENCH_CASES].hex);
+        sink += bin[i % SHA_DIGEST_LENGTH];
+    }
+    ns_unhex = bench_ns (start, iterations);
+
+    start = g_get_monotonic_time ();
+    for (i = 0; i < iterations; i++) {
+        const BenchCase *c = &cases[i % BENCH_CASES];
+
+        sink += sha1_unescape (bin, c->escaped, c->escaped_len);
+        sink += bin[i % SHA_DIGEST_LENGTH];
+    }
+    ns_unescape = bench_ns (start, iterations);
+
+    g_fprintf (stdout, "%-8s %14.2f %14.2f %14.2f\n", simd_level_to_str (level), ns_hex, ns_unhex, ns_unescape);
+    (void) sink;
+}
+
+int main (int argc, char *argv[])
+{
+    GOptionContext *context;
+    GError *error = NULL;
+    gint64 iterations = 10000000;
+    gint seed = 0;
+    BenchCase *cases;
+    SimdLevel best, level;
+    GRand *rnd;
+    guint errors = 0;
+    guint i;
+    GOptionEntry entries[] = {
+        { "iterations", 'n', 0, G_OPTION_ARG_INT64, &iterations, "Calls of every kernel (10000000).", NULL },
+        { "seed", 's', 0, G_OPTION_ARG_INT, &seed, "Random seed of test inputs (0: random).", NULL },
+        { NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL }
+    };
+
+    context = g_option_context_new ("");
+    g_option_context_add_main_entries (context, entries, NULL);
+    if (!g_option_context_parse (context, &argc, &argv, &error) || iterations <= 0) {
+        g_fprintf (stderr, "Usage: %s [-n iterations] [-s seed]\n", argv[0]);
+        g_option_context_free (context);
+        return -1;
+    }
+    g_option_context_free (context);
+
+    rnd = seed ? g_rand_new_with_seed (seed) : g_rand_new ();
+    cases = g_new0 (BenchCase, BENCH_CASES);
+    for (i = 0; i < BENCH_CASES; i++)
+        bench_case_init (&cases[i], rnd);
+    g_rand_free (rnd);
+
+    best = simd_get_best_level ();
+    g_fprintf (stdout, "best level: %s\n", simd_level_to_str (best));
+
+    for (level = SIMD_scalar + 1; level <= best; level++) {
+        guint level_errors = bench_check (cases, level);
+
+        g_fprintf (stdout, "%s: %u cases, %u mismatches\n", simd_level_to_str (level), BENCH_CASES, level_errors);
+        errors += level_errors;
+    }
+
+    g_fprintf (stdout, "%-8s %14s %14s %14s\n", "ns/call", "sha1_to_hex", "hex_to_sha1", "unescape");
+    for (level = SIMD_scalar; level <= best; level++)
+        bench_run (cases, level, (guint64) iterations);
+
+    g_free (cases);
+
+    return errors ? 1 : 0;
+}
@@ -107,31 +107,22 @@ gchar *str_remove_quotes (gchar *str)
     return str;
 }
 
-// 2 * SHA_DIGEST_LENGTH + 1
-void sha1_to_hexstr (gchar *out, const uint8_t *sha1)
+// mixes all of sha1, clients can send anything as info_hash
+guint64 sha1_hash64 (const uint8_t *sha1)
 {
-    int i;
-    static const char hex[] = "0123456789abcdef";
+    guint64 h = 0;
+    guint32 w;
+    gint i;
 
-    for (i=0; i<20; ++i) {
-        const unsigned int val = *sha1++;
-        *out++ = hex[val >> 4];
-        *out++ = hex[val & 0xf];
+    for (i = 0; i < SHA_DIGEST_LENGTH; i += sizeof (w)) {
+        memcpy (&w, sha1 + i, sizeof (w));
+        h = (h ^ w) * 0x9E3779B97F4A7C15ULL;
     }
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
 
-    *out = '\0';
-}
-
-void hexstr_to_sha1 (uint8_t *out, const char *in)
-{
-    int i;
-    static const char hex[] = "0123456789abcdef";
-
-    for (i=0; i<20; ++i) {
-        const int hi = strchr (hex, g_ascii_tolower (*in++)) - hex;
-        const int lo = strchr (hex, g_ascii_tolower (*in++)) - hex;
-        *out++ = (uint8_t)((hi<<4) | lo);
-    }
+    return h;
 }
 
 void escape_sha1 (char *out, const uint8_t *sha1)
@@ -0,0 +1,212 @@
+/*
+ * Copyright (C) 2012-2013 Paul Ionkin <paul.ionkin@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include "supervisor.h"
+#include <sys/wait.h>
+
+#define SUPERVISOR_LOG "supervisor"
+
+// a worker which dies sooner than this after start is respawned with a delay, seconds
+#define SUPERVISOR_MIN_UPTIME 5
+#define SUPERVISOR_RESPAWN_DELAY 1
+
+typedef struct {
+    // 0 if not running
+    pid_t pid;
+    time_t started;
+    time_t died;
+} SupervisorWorker;
+
+static evutil_socket_t supervisor_bind (const gchar *address, gint port)
+{
+    struct evutil_addrinfo hints, *ai = NULL;
+    evutil_socket_t fd = -1;
+    gchar service[16];
+
+    memset (&hints, 0, sizeof (hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = EVUTIL_AI_PASSIVE;
+    g_snprintf (service, sizeof (service), "%d", port);
+
+    if (evutil_getaddrinfo (address, service, &hints, &ai) != 0 || !ai) {
+        LOG_err (SUPERVISOR_LOG, "Failed to resolve %s", address);
+        return -1;
+    }
+
+    fd = socket (ai->ai_family, SOCK_STREAM, 0);
+    if (fd < 0 || evutil_make_listen_socket_reuseable (fd) < 0 || evutil_make_socket_nonblocking (fd) < 0 ||
+        evutil_make_socket_closeonexec (fd) < 0 || bind (fd, ai->ai_addr, ai->ai_addrlen) < 0 || listen (fd, 128) < 0) {
+        LOG_err (SUPERVISOR_LOG, "Failed to bind to %s:%d: %s", address, port, strerror (errno));
+        if (fd >= 0)
+            evutil_closesocket (fd);
+        fd = -1;
+    }
+
+    evutil_freeaddrinfo (ai);
+
+    return fd;
+}
+
+// returns 0 in the new worker
+static pid_t supervisor_spawn (SupervisorWorker *worker, const sigset_t *old_mask)
+{
+    pid_t parent = getpid ();
+    pid_t pid;
+
+    pid = fork ();
+    if (pid == 0) {
+        // workers don't outlive the supervisor
+        prctl (PR_SET_PDEATHSIG, SIGTERM);
+        if (getppid () != parent)
+            exit (1);
+        sigprocmask (SIG_SETMASK, old_mask, NULL);
+        return 0;
+    }
+
+    if (pid < 0) {
+        LOG_err (SUPERVISOR_LOG, "Failed to fork worker: %s", strerror (errno));
+        worker->died = time (NULL);
+        return -1;
+    }
+
+    worker->pid = pid;
+    worker->started = time (NULL);
+    LOG_msg (SUPERVISOR_LOG, "Worker %d is started", pid);
+
+    return pid;
+}
+
+static void supervisor_reap (SupervisorWorker *workers, guint n, gboolean stopping)
+{
+    pid_t pid;
+    gint status;
+    guint i;
+
+    while ((pid = waitpid (-1, &status, WNOHANG)) > 0) {
+        for (i = 0; i < n && workers[i].pid != pid; i++)
+            ;
+        if (i == n)
+            continue;
+
+        workers[i].pid = 0;
+        workers[i].died = time (NULL);
+
+        if (WIFSIGNALED (status))
+            LOG_err (SUPERVISOR_LOG, "Worker %d is killed by signal %d", pid, WTERMSIG (status));
+        else if (!stopping)
+            LOG_err (SUPERVISOR_LOG, "Worker %d exited with status %d", pid, WEXITSTATUS (status));
+        else
+            LOG_msg (SUPERVISOR_LOG, "Worker %d exited", pid);
+    }
+}
+
+static void supervisor_signal (SupervisorWorker *workers, guint n, gint sig)
+{
+    guint i;
+
+    for (i = 0; i < n; i++)
+        if (workers[i].pid)
+            kill (workers[i].pid, sig);
+}
+
+gint supervisor_run (ConfData *conf, evutil_socket_t *http_fd, gint *worker_id)
+{
+    SupervisorWorker *workers;
+    sigset_t set, old_mask;
+    gboolean stopping = FALSE;
+    evutil_socket_t fd;
+    guint n, i;
+
+    fd = supervisor_bind (conf_get_string (conf, "tracker.address"), conf_get_int (conf, "tracker.port"));
+    if (fd < 0)
+        return -1;
+
+    if (!conf_get_boolean (conf, "app.foreground"))
+        wutils_daemonize ();
+
+    // signals are taken by sigtimedwait, workers get the old mask back
+    sigemptyset (&set);
+    sigaddset (&set, SIGCHLD);
+    sigaddset (&set, SIGTERM);
+    sigaddset (&set, SIGINT);
+    sigaddset (&set, SIGHUP);
+    sigprocmask (SIG_BLOCK, &set, &old_mask);
+
+    n = MAX (conf_get_uint (conf, "prefork.workers"), 1);
+    workers = g_new0 (SupervisorWorker, n);
+
+    LOG_msg (SUPERVISOR_LOG, "Supervisor %d is starting %u workers", getpid (), n);
+
+    for (;;) {
+        struct timespec ts = { 1, 0 };
+        siginfo_t info;
+        time_t now = time (NULL);
+        guint alive = 0;
+
+        for (i = 0; i < n; i++) {
+            SupervisorWorker *worker = &workers[i];
+            time_t delay;
+
+            if (worker->pid) {
+                alive++;
+                continue;
+            }
+            if (stopping)
+                continue;
+
+            // don't spin on a worker which can't start
+            delay = worker->died && worker->died - worker->started < SUPERVISOR_MIN_UPTIME ? SUPERVISOR_RESPAWN_DELAY : 0;
+            if (now < worker->died + delay)
+                continue;
+
+            if (supervisor_spawn (worker, &old_mask) == 0) {
+                g_free (workers);
+                *http_fd = fd;
+                *worker_id = i;
+                return 1;
+            }
+            if (worker->pid)
+                alive++;
+        }
+
+        if (stopping && !alive)
+            break;
+
+        switch (sigtimedwait (&set, &info, &ts)) {
+            case SIGCHLD:
+                supervisor_reap (workers, n, stopping);
+                break;
+            case SIGTERM:
+            case SIGINT:
+                LOG_msg (SUPERVISOR_LOG, "Received signal %d, stopping workers", info.si_signo);
+                stopping = TRUE;
+                supervisor_signal (workers, n, SIGTERM);
+                break;
+            case SIGHUP:
+                supervisor_signal (workers, n, SIGHUP);
+                break;
+            default:
+                break;
+        }
+    }
+
+    g_free (workers);
+    evutil_closesocket (fd);
+    sigprocmask (SIG_SETMASK, &old_mask, NULL);
+
+    return 0;
+}
@@ -0,0 +1,35 @@
+/*
+ * Copyright (C) 2012-2013 Paul Ionkin <paul.ionkin@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#ifndef _SUPERVISOR_H_
+#define _SUPERVISOR_H_
+
+#include "global.h"
+
+/*
+ * Prefork mode: the supervisor binds tracker.address:port, daemonizes unless
+ * app.foreground is set and forks prefork.workers workers accepting on the
+ * socket. A worker which dies is respawned, swarms stay in the swarm store.
+ * SIGTERM / SIGINT stop workers, then the supervisor; SIGHUP is passed to
+ * workers.
+ */
+
+// 1: in a worker, with the listening socket in http_fd and its number (0 .. prefork.workers - 1) in worker_id
+// 0: in the supervisor, once workers are gone
+// -1: failed to start
+gint supervisor_run (ConfData *conf, evutil_socket_t *http_fd, gint *worker_id);
+
+#endif
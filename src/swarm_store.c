@@ -0,0 +1,468 @@
+/*
+ * Copyright (C) 2012-2013 Paul Ionkin <paul.ionkin@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include "swarm_store.h"
+#include <sys/mman.h>
+
+#define STORE_LOG "store"
+
+#define STORE_MAGIC "TBSW"
+#define STORE_VERSION 2
+#define STORE_MIN_RECORDS 1024
+#define STORE_PEER_ID_SIZE 20
+// writers hold a record for nanoseconds, the owner of a record locked longer is checked
+#define STORE_LOCK_TIMEOUT_US 100000
+// a full window is extended by up to this many windows
+#define STORE_MAX_EXTRA_WINDOWS 63
+// readers skip a record which stays locked
+#define STORE_READ_SPINS 1000
+
+enum {
+    SR_used = 1 << 0,
+    SR_seeder = 1 << 1,
+    SR_completed = 1 << 2,
+};
+
+typedef struct {
+    gchar magic[4];
+    guint32 version;
+    // power of 2
+    guint32 records;
+    guint32 window;
+    // atomic
+    guint64 full;
+    guint64 takeovers;
+    guint64 extended;
+    guint8 reserved[24];
+} StoreHeader;
+
+// a cache line per record
+typedef struct {
+    // low half: sequence, odd while a writer is inside; high half: pid of the writer
+    guint64 lock;
+    // unix time of the last announce
+    guint32 access_time;
+    uint8_t info_hash[SHA_DIGEST_LENGTH];
+    // zero padded
+    uint8_t peer_id[STORE_PEER_ID_SIZE];
+    // network order
+    guint32 addr;
+    guint16 port;
+    guint8 flags;
+    guint8 reserved[5];
+} StoreRecord;
+
+struct _SwarmStore {
+    gchar *path;
+    void *map;
+    size_t size;
+
+    StoreHeader *hdr;
+    StoreRecord *records;
+    // per hash slot, windows added to the one of torrents starting there, after records
+    guint8 *extra_windows;
+    guint64 mask;
+    guint window;
+    guint max_extra;
+    // owner of records locked by this process, set on the first lock: workers are forked by then
+    pid_t pid;
+};
+
+/*{{{ records */
+static void store_peer_id (uint8_t *out, const gchar *peer_id)
+{
+    size_t len = MIN (strlen (peer_id), STORE_PEER_ID_SIZE);
+
+    memset (out, 0, STORE_PEER_ID_SIZE);
+    memcpy (out, peer_id, len);
+}
+
+static StoreRecord *store_record (SwarmStore *store, guint64 base, guint i)
+{
+    return &store->records[(base + i) & store->mask];
+}
+
+// records of the torrent starting at base
+static guint store_span (SwarmStore *store, guint64 base)
+{
+    return store->window * (__atomic_load_n (&store->extra_windows[base & store->mask], __ATOMIC_RELAXED) + 1);
+}
+
+// unlocked read: a live record of the torrent, maybe
+static gboolean store_record_prefilter (const StoreRecord *r, const uint8_t *info_hash, guint32 expire_before)
+{
+    return (r->flags & SR_used) && r->access_time >= expire_before &&
+        !memcmp (r->info_hash, info_hash, sizeof (guint64));
+}
+
+// record is locked or copied
+static gboolean store_record_is_peer (const StoreRecord *r, const uint8_t *info_hash, const uint8_t *peer_id, guint32 expire_before)
+{
+    return (r->flags & SR_used) && r->access_time >= expire_before &&
+        !memcmp (r->info_hash, info_hash, SHA_DIGEST_LENGTH) &&
+        (!peer_id || !memcmp (r->peer_id, peer_id, STORE_PEER_ID_SIZE));
+}
+
+static gboolean store_record_is_free (const StoreRecord *r, guint32 expire_before)
+{
+    return !(r->flags & SR_used) || r->access_time < expire_before;
+}
+
+static guint64 store_lock_value (pid_t pid, guint32 seq)
+{
+    return ((guint64) (guint32) pid << 32) | seq;
+}
+
+// returns the lock value to unlock with
+static guint64 store_record_lock (SwarmStore *store, StoreRecord *r)
+{
+    gint64 start = 0;
+    guint64 lock, locked;
+    pid_t owner;
+
+    if (!store->pid)
+        store->pid = getpid ();
+
+    for (;;) {
+        lock = __atomic_load_n (&r->lock, __ATOMIC_RELAXED);
+        if (!(lock & 1)) {
+            locked = store_lock_value (store->pid, (guint32) lock + 1);
+            if (__atomic_compare_exchange_n (&r->lock, &lock, locked, FALSE, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+                return locked;
+            continue;
+        }
+
+        if (!start) {
+            start = g_get_monotonic_time ();
+            continue;
+        }
+        if (g_get_monotonic_time () - start < STORE_LOCK_TIMEOUT_US)
+            continue;
+        start = 0;
+
+        // a slow owner which is alive keeps the record
+        owner = (pid_t) (lock >> 32);
+        if (owner && owner != store->pid && (kill (owner, 0) == 0 || errno != ESRCH))
+            continue;
+
+        // owner has died inside, record stays odd and becomes ours
+        locked = store_lock_value (store->pid, (guint32) lock + 2);
+        if (__atomic_compare_exchange_n (&r->lock, &lock, locked, FALSE, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            __atomic_fetch_add (&store->hdr->takeovers, 1, __ATOMIC_RELAXED);
+            LOG_err (STORE_LOG, "Record %zd is left locked by dead process %d, taken over", r - store->records, owner);
+            return locked;
+        }
+    }
+}
+
+static void store_record_unlock (StoreRecord *r, guint64 locked)
+{
+    __atomic_store_n (&r->lock, (guint64) (guint32) (locked + 1), __ATOMIC_RELEASE);
+}
+
+// consistent copy, FALSE if record stays locked
+static gboolean store_record_read (const StoreRecord *r, StoreRecord *copy)
+{
+    guint i;
+
+    for (i = 0; i < STORE_READ_SPINS; i++) {
+        guint64 lock = __atomic_load_n (&r->lock, __ATOMIC_ACQUIRE);
+
+        if (lock & 1)
+            continue;
+        memcpy (copy, r, sizeof (StoreRecord));
+        __atomic_thread_fence (__ATOMIC_ACQUIRE);
+        if (__atomic_load_n (&r->lock, __ATOMIC_RELAXED) == lock)
+            return TRUE;
+    }
+
+    return FALSE;
+}
+/*}}}*/
+
+// first free record in [from, to) of the torrent becomes the peer's,
+// another worker can take it before it's locked
+static gboolean store_insert (SwarmStore *store, guint64 base, guint from, guint to, const uint8_t *info_hash,
+    const uint8_t *pid, const struct in_addr *addr, guint16 port, guint8 flags, guint32 now, guint32 expire_before)
+{
+    StoreRecord *r;
+    guint64 locked;
+    guint i;
+
+    for (i = from; i < to; i++) {
+        r = store_record (store, base, i);
+        if (!store_record_is_free (r, expire_before))
+            continue;
+
+        locked = store_record_lock (store, r);
+        if (store_record_is_free (r, expire_before)) {
+            r->access_time = now;
+            memcpy (r->info_hash, info_hash, SHA_DIGEST_LENGTH);
+            memcpy (r->peer_id, pid, STORE_PEER_ID_SIZE);
+            r->addr = addr->s_addr;
+            r->port = port;
+            r->flags = flags;
+            store_record_unlock (r, locked);
+            return TRUE;
+        }
+        store_record_unlock (r, locked);
+    }
+
+    return FALSE;
+}
+
+SwarmStoreResult swarm_store_update (SwarmStore *store, const uint8_t *info_hash, const gchar *peer_id,
+    const struct in_addr *addr, guint16 port, gboolean seeder, gboolean completed,
+    guint32 now, guint32 expire_before, guint32 min_interval)
+{
+    guint64 base = sha1_hash64 (info_hash);
+    guint8 *extra = &store->extra_windows[base & store->mask];
+    guint8 flags = SR_used | (seeder ? SR_seeder : 0) | (completed ? SR_completed : 0);
+    uint8_t pid[STORE_PEER_ID_SIZE];
+    guint64 locked;
+    StoreRecord *r;
+    guint span, done, i;
+    guint8 n;
+
+    store_peer_id (pid, peer_id);
+    span = store_span (store, base);
+
+    // record of the peer
+    for (i = 0; i < span; i++) {
+        r = store_record (store, base, i);
+        if (!store_record_prefilter (r, info_hash, expire_before))
+            continue;
+
+        locked = store_record_lock (store, r);
+        if (store_record_is_peer (r, info_hash, pid, expire_before)) {
+            if (min_interval && now - r->access_time < min_interval) {
+                store_record_unlock (r, locked);
+                return SS_too_soon;
+            }
+
+            r->access_time = now;
+            r->addr = addr->s_addr;
+            r->port = port;
+            r->flags = flags | (r->flags & SR_completed);
+            store_record_unlock (r, locked);
+            return SS_updated;
+        }
+        store_record_unlock (r, locked);
+    }
+
+    if (store_insert (store, base, 0, span, info_hash, pid, addr, port, flags, now, expire_before))
+        return SS_updated;
+
+    // the torrent outgrew its records: one more window, which overlaps other
+    // torrents. Windows added by other workers meanwhile are searched first
+    done = span / store->window;
+    for (;;) {
+        n = __atomic_load_n (extra, __ATOMIC_RELAXED);
+        if (n + 1U > done) {
+            if (store_insert (store, base, done * store->window, (n + 1) * store->window, info_hash, pid, addr, port,
+                flags, now, expire_before))
+                return SS_updated;
+            done = n + 1;
+        }
+
+        if (n >= store->max_extra)
+            break;
+        if (__atomic_compare_exchange_n (extra, &n, n + 1, FALSE, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            __atomic_fetch_add (&store->hdr->extended, 1, __ATOMIC_RELAXED);
+    }
+
+    __atomic_fetch_add (&store->hdr->full, 1, __ATOMIC_RELAXED);
+
+    return SS_full;
+}
+
+void swarm_store_remove (SwarmStore *store, const uint8_t *info_hash, const gchar *peer_id)
+{
+    guint64 base = sha1_hash64 (info_hash);
+    uint8_t pid[STORE_PEER_ID_SIZE];
+    guint64 locked;
+    StoreRecord *r;
+    guint span, i;
+
+    store_peer_id (pid, peer_id);
+    span = store_span (store, base);
+
+    for (i = 0; i < span; i++) {
+        r = store_record (store, base, i);
+        // expired records are free already
+        if (!store_record_prefilter (r, info_hash, 0))
+            continue;
+
+        locked = store_record_lock (store, r);
+        if (store_record_is_peer (r, info_hash, pid, 0))
+            r->flags = 0;
+        store_record_unlock (r, locked);
+    }
+}
+
+uint8_t *swarm_store_get_peers (SwarmStore *store, const uint8_t *info_hash, const gchar *peer_id,
+    guint32 expire_before, guint max, size_t *len)
+{
+    guint64 base = sha1_hash64 (info_hash);
+    uint8_t pid[STORE_PEER_ID_SIZE];
+    StoreRecord copy;
+    uint8_t *out, *tmp;
+    guint span, start, i, n = 0;
+
+    store_peer_id (pid, peer_id);
+    span = store_span (store, base);
+    max = MIN (max, span);
+    out = tmp = g_new (uint8_t, max * 6 + 1);
+
+    // a different part of a big swarm every time
+    start = g_random_int_range (0, span);
+    for (i = 0; i < span && n < max; i++) {
+        const StoreRecord *r = store_record (store, base, (start + i) % span);
+
+        if (!store_record_prefilter (r, info_hash, expire_before) || !store_record_read (r, &copy))
+            continue;
+        if (!store_record_is_peer (&copy, info_hash, NULL, expire_before) || !memcmp (copy.peer_id, pid, STORE_PEER_ID_SIZE))
+            continue;
+
+        memcpy (tmp, &copy.addr, 4); tmp += 4;
+        memcpy (tmp, &copy.port, 2); tmp += 2;
+        n++;
+    }
+
+    *len = n * 6;
+    return out;
+}
+
+void swarm_store_count (SwarmStore *store, const uint8_t *info_hash, guint32 expire_before, SwarmStoreCounts *counts)
+{
+    guint64 base = sha1_hash64 (info_hash);
+    StoreRecord copy;
+    guint span, i;
+
+    memset (counts, 0, sizeof (SwarmStoreCounts));
+
+    span = store_span (store, base);
+    for (i = 0; i < span; i++) {
+        const StoreRecord *r = store_record (store, base, i);
+
+        if (!store_record_prefilter (r, info_hash, expire_before) || !store_record_read (r, &copy))
+            continue;
+        if (!store_record_is_peer (&copy, info_hash, NULL, expire_before))
+            continue;
+
+        if (copy.flags & SR_seeder)
+            counts->seeders++;
+        else
+            counts->leechers++;
+        if (copy.flags & SR_completed)
+            counts->completed++;
+    }
+}
+
+void swarm_store_get_stats (SwarmStore *store, SwarmStoreStats *stats)
+{
+    stats->records = store->mask + 1;
+    stats->window = store->window;
+    stats->full = __atomic_load_n (&store->hdr->full, __ATOMIC_RELAXED);
+    stats->takeovers = __atomic_load_n (&store->hdr->takeovers, __ATOMIC_RELAXED);
+    stats->extended = __atomic_load_n (&store->hdr->extended, __ATOMIC_RELAXED);
+}
+
+// maps the file, keeps its records if the layout is the same
+static gboolean swarm_store_map (SwarmStore *store, gint fd, gboolean *keep)
+{
+    StoreHeader hdr;
+    struct stat st;
+
+    if (fstat (fd, &st) != 0) {
+        LOG_err (STORE_LOG, "Failed to stat %s: %s", store->path, strerror (errno));
+        return FALSE;
+    }
+
+    *keep = FALSE;
+    if ((size_t) st.st_size == store->size && pread (fd, &hdr, sizeof (hdr), 0) == sizeof (hdr))
+        *keep = !memcmp (hdr.magic, STORE_MAGIC, sizeof (hdr.magic)) && hdr.version == STORE_VERSION &&
+            hdr.records == store->mask + 1 && hdr.window == store->window;
+
+    if (!*keep && (ftruncate (fd, 0) != 0 || ftruncate (fd, store->size) != 0)) {
+        LOG_err (STORE_LOG, "Failed to resize %s: %s", store->path, strerror (errno));
+        return FALSE;
+    }
+
+    store->map = mmap (NULL, store->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (store->map == MAP_FAILED) {
+        LOG_err (STORE_LOG, "Failed to mmap %s: %s", store->path, strerror (errno));
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+SwarmStore *swarm_store_open (const gchar *path, guint records, guint window)
+{
+    SwarmStore *store;
+    guint64 n = STORE_MIN_RECORDS;
+    gboolean keep;
+    gint fd;
+
+    while (n < records)
+        n *= 2;
+
+    store = g_new0 (SwarmStore, 1);
+    store->path = g_strdup (path);
+    store->size = sizeof (StoreHeader) + n * sizeof (StoreRecord) + n;
+    store->mask = n - 1;
+    store->window = CLAMP (window, 1, n);
+    store->max_extra = MIN (STORE_MAX_EXTRA_WINDOWS, n / store->window - 1);
+
+    fd = open (path, O_RDWR | O_CREAT, 0640);
+    if (fd < 0) {
+        LOG_err (STORE_LOG, "Failed to open %s: %s", path, strerror (errno));
+        g_free (store->path);
+        g_free (store);
+        return NULL;
+    }
+
+    if (!swarm_store_map (store, fd, &keep)) {
+        close (fd);
+        g_free (store->path);
+        g_free (store);
+        return NULL;
+    }
+    close (fd);
+
+    store->hdr = (StoreHeader *) store->map;
+    store->records = (StoreRecord *) (store->hdr + 1);
+    store->extra_windows = (guint8 *) (store->records + n);
+    if (!keep) {
+        memcpy (store->hdr->magic, STORE_MAGIC, sizeof (store->hdr->magic));
+        store->hdr->version = STORE_VERSION;
+        store->hdr->records = n;
+        store->hdr->window = store->window;
+    }
+
+    LOG_msg (STORE_LOG, "Swarm store %s: %"G_GUINT64_FORMAT" records, window %u, %s", path, n, store->window,
+        keep ? "swarms are kept" : "empty");
+
+    return store;
+}
+
+void swarm_store_close (SwarmStore *store)
+{
+    munmap (store->map, store->size);
+    g_free (store->path);
+    g_free (store);
+}
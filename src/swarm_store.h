@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2012-2013 Paul Ionkin <paul.ionkin@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#ifndef _SWARM_STORE_H_
+#define _SWARM_STORE_H_
+
+#include "global.h"
+
+/*
+ * Peers of all torrents in a file mapped region shared by prefork workers.
+ * Records are fixed size, a torrent keeps its peers in the window of
+ * prefork.store_window records starting at the hash of its info_hash. A
+ * torrent with no free record in its window gets another window after it,
+ * up to 63 times; the window count of a hash slot doesn't shrink.
+ * Each record is protected by a seqlock: writers take it with CAS together
+ * with their pid, readers retry on a change. A record left locked by a dead
+ * process is taken over. Expired records are free, there is no sweep.
+ * The region outlives processes: a restarted tracker keeps the swarms.
+ */
+typedef struct _SwarmStore SwarmStore;
+
+typedef enum {
+    SS_updated = 0,
+    // plain update sooner than min_interval after the previous one, record is kept
+    SS_too_soon = 1,
+    // windows of the torrent have no free record and can't be extended
+    SS_full = 2,
+} SwarmStoreResult;
+
+typedef struct {
+    guint seeders;
+    guint leechers;
+    // current peers which announced "completed"
+    guint completed;
+} SwarmStoreCounts;
+
+typedef struct {
+    guint64 records;
+    guint64 window;
+    // updates refused with SS_full
+    guint64 full;
+    // records left locked by a crashed writer and taken over
+    guint64 takeovers;
+    // windows added to full torrents
+    guint64 extended;
+} SwarmStoreStats;
+
+// keeps the contents of path if its layout is the same, resets it otherwise
+SwarmStore *swarm_store_open (const gchar *path, guint records, guint window);
+void swarm_store_close (SwarmStore *store);
+
+/*
+ * Records of peers which did not announce since expire_before are free.
+ * port: network order, seeder: left is 0, completed: "completed" event.
+ */
+SwarmStoreResult swarm_store_update (SwarmStore *store, const uint8_t *info_hash, const gchar *peer_id,
+    const struct in_addr *addr, guint16 port, gboolean seeder, gboolean completed,
+    guint32 now, guint32 expire_before, guint32 min_interval);
+void swarm_store_remove (SwarmStore *store, const uint8_t *info_hash, const gchar *peer_id);
+
+// up to max peers other than peer_id in compact form, 6 bytes each
+uint8_t *swarm_store_get_peers (SwarmStore *store, const uint8_t *info_hash, const gchar *peer_id,
+    guint32 expire_before, guint max, size_t *len);
+void swarm_store_count (SwarmStore *store, const uint8_t *info_hash, guint32 expire_before, SwarmStoreCounts *counts);
+
+void swarm_store_get_stats (SwarmStore *store, SwarmStoreStats *stats);
+
+#endif
@@ -0,0 +1,414 @@
+/*
+ * Copyright (C) 2012-2013 Paul Ionkin <paul.ionkin@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+/*
+ * Populates the tracker's torrent table with synthetic swarms and reports
+ * memory and latency as it grows:
+ *   tbfs_swarmbench [-p peers] [-t torrents] [-z skew] [-k steps] [-n ops] [-l] [-d] [-s seed]
+ * Peers are spread over torrents by a Zipf distribution, as swarm sizes are.
+ * The table is filled in steps up to -p peers, peers doubling per step. Every
+ * step prints RSS, heap in use (mallinfo2), bytes per peer net of empty
+ * torrents, the tracker's own estimate (TorrentMemStats) and insert, lookup
+ * and select latencies.
+ */
+#include "global.h"
+#include "torrent.h"
+#include "torrent_table.h"
+#include <malloc.h>
+#include <sys/wait.h>
+
+// latency histogram: 8 sub-buckets per power of 2 ns
+#define BENCH_LAT_SUB_BITS 3
+#define BENCH_LAT_BUCKETS (64 << BENCH_LAT_SUB_BITS)
+#define BENCH_NUMWANT 50
+// torrents created to measure the size of an empty one
+#define BENCH_EMPTY_TORRENTS 100000
+
+typedef struct {
+    guint64 counts[BENCH_LAT_BUCKETS];
+    guint64 n;
+    guint64 total_ns;
+} BenchLatency;
+
+typedef struct {
+    guint64 seed;
+    guint64 n_torrents;
+    // cumulative Zipf probabilities of torrent ranks
+    gdouble *cdf;
+    TorrentTable *table;
+    guint64 n_peers;
+} Bench;
+
+static guint64 bench_splitmix (guint64 x)
+{
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+static guint64 bench_now_ns (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (guint64) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*{{{ latency */
+static void bench_latency_add (BenchLatency *lat, guint64 ns)
+{
+    guint b;
+
+    if (ns < (1 << BENCH_LAT_SUB_BITS)) {
+        b = (guint) ns;
+    } else {
+        guint msb = 63 - __builtin_clzll (ns);
+
+        b = ((msb - BENCH_LAT_SUB_BITS + 1) << BENCH_LAT_SUB_BITS) |
+            ((ns >> (msb - BENCH_LAT_SUB_BITS)) & ((1 << BENCH_LAT_SUB_BITS) - 1));
+    }
+
+    lat->counts[MIN (b, BENCH_LAT_BUCKETS - 1)]++;
+    lat->n++;
+    lat->total_ns += ns;
+}
+
+// upper bound of the bucket holding the percentile
+static guint64 bench_latency_percentile (const BenchLatency *lat, gdouble pct)
+{
+    guint64 want = (guint64) (lat->n * pct / 100.0);
+    guint64 seen = 0;
+    guint b;
+
+    for (b = 0; b < BENCH_LAT_BUCKETS; b++) {
+        seen += lat->counts[b];
+        if (seen > want)
+            break;
+    }
+
+    if (b < (1 << BENCH_LAT_SUB_BITS))
+        return b;
+    return ((guint64) ((1 << BENCH_LAT_SUB_BITS) | (b & ((1 << BENCH_LAT_SUB_BITS) - 1))) + 1) <<
+        ((b >> BENCH_LAT_SUB_BITS) - 1);
+}
+
+static void bench_latency_print (const gchar *name, const BenchLatency *lat)
+{
+    g_fprintf (stdout, "  %-7s %10"G_GUINT64_FORMAT" ops  avg %8.1f  p50 %8"G_GUINT64_FORMAT"  p99 %8"G_GUINT64_FORMAT
+        "  p99.9 %8"G_GUINT64_FORMAT" ns\n", name, lat->n, lat->n ? (gdouble) lat->total_ns / lat->n : 0.0,
+        bench_latency_percentile (lat, 50), bench_latency_percentile (lat, 99), bench_latency_percentile (lat, 99.9));
+}
+/*}}}*/
+
+/*{{{ synthetic swarms */
+static gdouble *bench_zipf_cdf (guint64 n, gdouble skew)
+{
+    gdouble *cdf = g_new (gdouble, n);
+    gdouble sum = 0;
+    guint64 i;
+
+    for (i = 0; i < n; i++) {
+        sum += 1.0 / pow ((gdouble) (i + 1), skew);
+        cdf[i] = sum;
+    }
+    for (i = 0; i < n; i++)
+        cdf[i] /= sum;
+
+    return cdf;
+}
+
+// torrent rank of peer n, the same for every call
+static guint64 bench_peer_torrent (const Bench *bench, guint64 n)
+{
+    gdouble u = (bench_splitmix (bench->seed ^ n) >> 11) * (1.0 / 9007199254740992.0);
+    guint64 lo = 0, hi = bench->n_torrents - 1;
+
+    while (lo < hi) {
+        guint64 mid = (lo + hi) / 2;
+
+        if (bench->cdf[mid] < u)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+static void bench_info_hash (const Bench *bench, guint64 rank, uint8_t *info_hash)
+{
+    guint64 h[3];
+
+    h[0] = bench_splitmix (bench->seed + rank * 3);
+    h[1] = bench_splitmix (bench->seed + rank * 3 + 1);
+    h[2] = bench_splitmix (bench->seed + rank * 3 + 2);
+    memcpy (info_hash, h, SHA_DIGEST_LENGTH);
+}
+
+// 20 printable characters, like client peer_ids
+static void bench_peer_id (guint64 n, gchar *peer_id)
+{
+    g_snprintf (peer_id, 21, "-BN0001-%012"G_GINT64_MODIFIER"x", n);
+}
+
+static Torrent *bench_get_torrent (Bench *bench, guint64 rank, gboolean create)
+{
+    uint8_t info_hash[SHA_DIGEST_LENGTH];
+    guint64 hash;
+    Torrent *torrent;
+
+    bench_info_hash (bench, rank, info_hash);
+    hash = sha1_hash64 (info_hash);
+    torrent = torrent_table_lookup (bench->table, hash, info_hash);
+    if (!torrent && create) {
+        torrent = torrent_create (info_hash);
+        torrent_table_insert (bench->table, hash, torrent);
+    }
+
+    return torrent;
+}
+/*}}}*/
+
+/*{{{ memory */
+static guint64 bench_rss (void)
+{
+    FILE *f;
+    unsigned long size = 0, resident = 0;
+
+    f = fopen ("/proc/self/statm", "r");
+    if (!f)
+        return 0;
+    if (fscanf (f, "%lu %lu", &size, &resident) != 2)
+        resident = 0;
+    fclose (f);
+
+    return (guint64) resident * sysconf (_SC_PAGESIZE);
+}
+
+// bytes handed out by malloc, including large mmap'ed blocks
+static guint64 bench_heap_used (void)
+{
+    struct mallinfo2 mi = mallinfo2 ();
+
+    return mi.uordblks + mi.hblkhd;
+}
+
+// heap used by an empty torrent, including its table slot, measured in a
+// child so the parent's heap and RSS baseline stay clean
+static gdouble bench_empty_torrent_size (Bench *bench)
+{
+    gdouble size = 0;
+    gint fds[2];
+    pid_t pid;
+
+    if (pipe (fds) < 0)
+        return 0;
+
+    pid = fork ();
+    if (pid == 0) {
+        Bench tmp = *bench;
+        guint64 before;
+        guint64 i;
+
+        before = bench_heap_used ();
+        tmp.table = torrent_table_create ();
+        tmp.seed = ~bench->seed;
+        for (i = 0; i < BENCH_EMPTY_TORRENTS; i++)
+            bench_get_torrent (&tmp, i, TRUE);
+        size = (gdouble) (bench_heap_used () - before) / BENCH_EMPTY_TORRENTS;
+        if (write (fds[1], &size, sizeof (size)) != sizeof (size))
+            _exit (1);
+        _exit (0);
+    }
+
+    close (fds[1]);
+    if (pid < 0 || read (fds[0], &size, sizeof (size)) != sizeof (size))
+        size = 0;
+    close (fds[0]);
+    if (pid > 0)
+        waitpid (pid, NULL, 0);
+
+    return size;
+}
+/*}}}*/
+
+static void bench_populate (Bench *bench, guint64 target, BenchLatency *lat)
+{
+    struct in_addr addr;
+    gchar peer_id[21];
+
+    for (; bench->n_peers < target; bench->n_peers++) {
+        guint64 n = bench->n_peers;
+        guint64 rank = bench_peer_torrent (bench, n);
+        guint64 start;
+
+        bench_peer_id (n, peer_id);
+        addr.s_addr = g_htonl (0x0a000000 | (guint32) (bench_splitmix (n) & 0xffffff));
+
+        start = bench_now_ns ();
+        torrent_add_peer (bench_get_torrent (bench, rank, TRUE), peer_id, &addr, 6881 + (gint) (n % 1000));
+        bench_latency_add (lat, bench_now_ns () - start);
+    }
+}
+
+// re-announce of a random existing peer: torrent and peer lookups, LRU update
+static void bench_lookup (Bench *bench, guint64 ops, GRand *rnd, BenchLatency *lat)
+{
+    gchar peer_id[21];
+    guint64 i;
+
+    for (i = 0; i < ops; i++) {
+        guint64 n = (guint64) (g_rand_double (rnd) * bench->n_peers);
+        guint64 rank = bench_peer_torrent (bench, n);
+        guint64 start;
+        Torrent *torrent;
+        Peer *peer;
+
+        bench_peer_id (n, peer_id);
+
+        start = bench_now_ns ();
+        torrent = bench_get_torrent (bench, rank, FALSE);
+        peer = torrent ? torrent_get_peer (torrent, peer_id) : NULL;
+        if (peer)
+            torrent_touch_peer (torrent, peer);
+        bench_latency_add (lat, bench_now_ns () - start);
+
+        if (!peer) {
+            g_fprintf (stderr, "peer %"G_GUINT64_FORMAT" is not found\n", n);
+            exit (1);
+        }
+    }
+}
+
+// peer selection and compact encoding, torrents picked by announce popularity
+static void bench_select (Bench *bench, guint64 ops, GRand *rnd, BenchLatency *lat)
+{
+    guint64 i;
+
+    for (i = 0; i < ops; i++) {
+        guint64 rank = bench_peer_torrent (bench, (guint64) g_rand_double (rnd) * bench->n_peers);
+        Torrent *torrent = bench_get_torrent (bench, rank, FALSE);
+        guint64 start;
+        uint8_t *val;
+        size_t len;
+        GList *l;
+
+        if (!torrent)
+            continue;
+
+        start = bench_now_ns ();
+        l = torrent_get_list_of_peers (torrent, BENCH_NUMWANT);
+        val = peer_list_to_compact_val (l, &len);
+        g_list_free (l);
+        g_free (val);
+        bench_latency_add (lat, bench_now_ns () - start);
+    }
+}
+
+int main (int argc, char *argv[])
+{
+    GOptionContext *context;
+    GError *error = NULL;
+    gint64 peers = 10000000;
+    gint64 torrents = 1000000;
+    gdouble skew = 1.0;
+    gint steps = 6;
+    gint64 ops = 1000000;
+    gboolean locality = FALSE;
+    gboolean dedup = FALSE;
+    gint seed = 0;
+    Bench bench;
+    GRand *rnd;
+    guint64 heap_base, rss_base;
+    gdouble empty_torrent;
+    gint step;
+    GOptionEntry entries[] = {
+        { "peers", 'p', 0, G_OPTION_ARG_INT64, &peers, "Peers at the last step (10000000).", NULL },
+        { "torrents", 't', 0, G_OPTION_ARG_INT64, &torrents, "Torrents peers are spread over (1000000).", NULL },
+        { "skew", 'z', 0, G_OPTION_ARG_DOUBLE, &skew, "Zipf exponent of swarm sizes, 0: uniform (1.0).", NULL },
+        { "steps", 'k', 0, G_OPTION_ARG_INT, &steps, "Size steps, peers double per step (6).", NULL },
+        { "ops", 'n', 0, G_OPTION_ARG_INT64, &ops, "Lookups and selections per step (1000000).", NULL },
+        { "locality", 'l', 0, G_OPTION_ARG_NONE, &locality, "Keep locality buckets.", NULL },
+        { "dedup", 'd', 0, G_OPTION_ARG_NONE, &dedup, "Keep the endpoint index of peer deduplication.", NULL },
+        { "seed", 's', 0, G_OPTION_ARG_INT, &seed, "Random seed (0: random).", NULL },
+        { NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL }
+    };
+
+    context = g_option_context_new ("");
+    g_option_context_add_main_entries (context, entries, NULL);
+    if (!g_option_context_parse (context, &argc, &argv, &error) || peers <= 0 || torrents <= 0 ||
+        skew < 0 || steps <= 0 || steps > 40 || ops < 0) {
+        g_fprintf (stderr, "Usage: %s [-p peers] [-t torrents] [-z skew] [-k steps] [-n ops] [-l] [-d] [-s seed]\n", argv[0]);
+        g_option_context_free (context);
+        return -1;
+    }
+    g_option_context_free (context);
+
+    rnd = seed ? g_rand_new_with_seed (seed) : g_rand_new ();
+    torrent_set_locality (locality, NULL);
+    torrent_set_dedup (dedup);
+
+    memset (&bench, 0, sizeof (bench));
+    bench.seed = ((guint64) g_rand_int (rnd) << 32) | g_rand_int (rnd);
+    bench.n_torrents = (guint64) torrents;
+    bench.cdf = bench_zipf_cdf (bench.n_torrents, skew);
+
+    empty_torrent = bench_empty_torrent_size (&bench);
+    g_fprintf (stdout, "sizeof: Peer %zu, Torrent %zu, empty torrent in heap: %.1f bytes, locality: %s, dedup: %s\n",
+        sizeof (Peer), sizeof (Torrent), empty_torrent, locality ? "on" : "off", dedup ? "on" : "off");
+
+    heap_base = bench_heap_used ();
+    rss_base = bench_rss ();
+    bench.table = torrent_table_create ();
+
+    for (step = steps - 1; step >= 0; step--) {
+        BenchLatency lat_insert, lat_lookup, lat_select;
+        const TorrentMemStats *mem;
+        guint64 heap, n_torrents;
+        gint64 start;
+
+        memset (&lat_insert, 0, sizeof (lat_insert));
+        memset (&lat_lookup, 0, sizeof (lat_lookup));
+        memset (&lat_select, 0, sizeof (lat_select));
+
+        start = g_get_monotonic_time ();
+        bench_populate (&bench, MAX ((guint64) peers >> step, 1), &lat_insert);
+        heap = bench_heap_used () - heap_base;
+        n_torrents = torrent_table_size (bench.table);
+        mem = torrent_get_mem_stats ();
+
+        g_fprintf (stdout, "peers %"G_GUINT64_FORMAT", torrents %"G_GUINT64_FORMAT", populated in %.1f s\n",
+            bench.n_peers, n_torrents, (g_get_monotonic_time () - start) / (gdouble) G_USEC_PER_SEC);
+        g_fprintf (stdout, "  rss %.1f MiB, heap %.1f MiB, estimate %.1f MiB, bytes/peer %.1f (estimate %.1f)\n",
+            (bench_rss () - rss_base) / 1048576.0, heap / 1048576.0, mem->bytes / 1048576.0,
+            (heap - n_torrents * empty_torrent) / bench.n_peers,
+            ((gdouble) mem->bytes - n_torrents * empty_torrent) / bench.n_peers);
+
+        bench_lookup (&bench, (guint64) ops, rnd, &lat_lookup);
+        bench_select (&bench, (guint64) ops, rnd, &lat_select);
+
+        bench_latency_print ("insert", &lat_insert);
+        bench_latency_print ("lookup", &lat_lookup);
+        bench_latency_print ("select", &lat_select);
+    }
+
+    torrent_table_destroy (bench.table);
+    g_free (bench.cdf);
+    g_rand_free (rnd);
+
+    return 0;
+}
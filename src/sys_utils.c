@@ -15,6 +15,8 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>
  */
 #include "wutils.h"
+#include <pthread.h>
+#include <sys/syscall.h>
 
 int wutils_daemonize (void)
 {
@@ -59,3 +61,272 @@ int wutils_daemonize (void)
     return 1;
 
 }
+
+/*{{{ CPU affinity and NUMA */
+#define SYS_LOG "sys"
+
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED 1
+#endif
+
+// parses "0-3,8,10-11" list, as used by taskset and sysfs
+gboolean sys_parse_cpu_list (const gchar *str, cpu_set_t *set)
+{
+    const gchar *p = str;
+
+    CPU_ZERO (set);
+
+    while (*p) {
+        gchar *end;
+        glong first, last;
+
+        while (g_ascii_isspace (*p))
+            p++;
+        if (!*p)
+            break;
+
+        first = strtol (p, &end, 10);
+        if (end == p || first < 0 || first >= CPU_SETSIZE)
+            return FALSE;
+        last = first;
+        p = end;
+
+        if (*p == '-') {
+            p++;
+            last = strtol (p, &end, 10);
+            if (end == p || last < first || last >= CPU_SETSIZE)
+                return FALSE;
+            p = end;
+        }
+
+        for (; first <= last; first++)
+            CPU_SET (first, set);
+
+        while (g_ascii_isspace (*p))
+            p++;
+        if (*p == ',')
+            p++;
+        else if (*p)
+            return FALSE;
+    }
+
+    return CPU_COUNT (set) > 0;
+}
+
+// n-th CPU of the set, wrapping around
+gint sys_cpu_set_get_nth (const cpu_set_t *set, gint n)
+{
+    gint cpu;
+
+    n %= MAX (CPU_COUNT (set), 1);
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        if (CPU_ISSET (cpu, set) && n-- == 0)
+            return cpu;
+
+    return 0;
+}
+
+gchar *sys_cpu_set_to_str (const cpu_set_t *set)
+{
+    GString *str = g_string_new (NULL);
+    gint cpu, first = -1;
+
+    for (cpu = 0; cpu <= CPU_SETSIZE; cpu++) {
+        gboolean is_set = cpu < CPU_SETSIZE && CPU_ISSET (cpu, set);
+
+        if (is_set && first < 0)
+            first = cpu;
+        else if (!is_set && first >= 0) {
+            if (str->len)
+                g_string_append_c (str, ',');
+            if (first == cpu - 1)
+                g_string_append_printf (str, "%d", first);
+            else
+                g_string_append_printf (str, "%d-%d", first, cpu - 1);
+            first = -1;
+        }
+    }
+
+    return g_string_free (str, FALSE);
+}
+
+static gchar *sys_read_file (const gchar *path)
+{
+    gchar buf[4096];
+    ssize_t len;
+    gint fd;
+
+    fd = open (path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    len = read (fd, buf, sizeof (buf) - 1);
+    close (fd);
+    if (len <= 0)
+        return NULL;
+    buf[len] = '\0';
+
+    return g_strdup (g_strstrip (buf));
+}
+
+// pins calling thread
+gboolean sys_pin_thread (const cpu_set_t *set)
+{
+    gint ret;
+
+    ret = pthread_setaffinity_np (pthread_self (), sizeof (cpu_set_t), set);
+    if (ret) {
+        LOG_err (SYS_LOG, "Failed to set CPU affinity: %s", strerror (ret));
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+// returns NUMA node of CPU, -1 if unknown
+gint sys_cpu_get_numa_node (gint cpu)
+{
+    gchar *path;
+    GDir *dir;
+    const gchar *name;
+    gint node = -1;
+
+    path = g_strdup_printf ("/sys/devices/system/cpu/cpu%d", cpu);
+    dir = g_dir_open (path, 0, NULL);
+    g_free (path);
+    if (!dir)
+        return -1;
+
+    while ((name = g_dir_read_name (dir))) {
+        if (g_str_has_prefix (name, "node") && g_ascii_isdigit (name[4])) {
+            node = atoi (name + 4);
+            break;
+        }
+    }
+    g_dir_close (dir);
+
+    return node;
+}
+
+// returns NUMA node of all CPUs in set, -1 if they span several nodes
+gint sys_cpu_set_get_numa_node (const cpu_set_t *set)
+{
+    gint cpu, node = -1;
+
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        gint n;
+
+        if (!CPU_ISSET (cpu, set))
+            continue;
+        n = sys_cpu_get_numa_node (cpu);
+        if (n < 0 || (node >= 0 && n != node))
+            return -1;
+        node = n;
+    }
+
+    return node;
+}
+
+// new allocations of calling thread prefer memory of the node
+gboolean sys_bind_memory_to_node (gint node)
+{
+    unsigned long mask;
+
+    if (node < 0 || node >= (gint) (sizeof (mask) * 8))
+        return FALSE;
+    mask = 1UL << node;
+
+    if (syscall (SYS_set_mempolicy, MPOL_PREFERRED, &mask, sizeof (mask) * 8) != 0) {
+        LOG_err (SYS_LOG, "Failed to set memory policy: %s", strerror (errno));
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+// CPUs which handle interrupts of network interface queues
+gboolean sys_get_nic_irq_cpus (const gchar *nic, cpu_set_t *set)
+{
+    gchar *path;
+    GDir *dir;
+    const gchar *name;
+
+    CPU_ZERO (set);
+
+    path = g_strdup_printf ("/sys/class/net/%s/device/msi_irqs", nic);
+    dir = g_dir_open (path, 0, NULL);
+    g_free (path);
+    if (!dir)
+        return FALSE;
+
+    while ((name = g_dir_read_name (dir))) {
+        gchar *list;
+        cpu_set_t irq_set;
+
+        path = g_strdup_printf ("/proc/irq/%s/smp_affinity_list", name);
+        list = sys_read_file (path);
+        g_free (path);
+
+        if (list && sys_parse_cpu_list (list, &irq_set))
+            CPU_OR (set, set, &irq_set);
+        g_free (list);
+    }
+    g_dir_close (dir);
+
+    return CPU_COUNT (set) > 0;
+}
+
+// logs NUMA nodes, CPUs the thread runs on and NIC placement
+void sys_log_topology (const gchar *nic)
+{
+    cpu_set_t set;
+    GDir *dir;
+    const gchar *name;
+    gchar *str;
+    gint node;
+
+    dir = g_dir_open ("/sys/devices/system/node", 0, NULL);
+    if (dir) {
+        while ((name = g_dir_read_name (dir))) {
+            gchar *path;
+
+            if (!g_str_has_prefix (name, "node") || !g_ascii_isdigit (name[4]))
+                continue;
+
+            path = g_strdup_printf ("/sys/devices/system/node/%s/cpulist", name);
+            str = sys_read_file (path);
+            LOG_msg (SYS_LOG, "NUMA %s: CPUs %s", name, str ? str : "unknown");
+            g_free (str);
+            g_free (path);
+        }
+        g_dir_close (dir);
+    }
+
+    if (pthread_getaffinity_np (pthread_self (), sizeof (set), &set) == 0) {
+        str = sys_cpu_set_to_str (&set);
+        node = sys_cpu_set_get_numa_node (&set);
+        if (node >= 0)
+            LOG_msg (SYS_LOG, "Event loop: CPUs %s, NUMA node %d", str, node);
+        else
+            LOG_msg (SYS_LOG, "Event loop: CPUs %s, several NUMA nodes", str);
+        g_free (str);
+    }
+
+    LOG_msg (SYS_LOG, "SIMD string kernels: %s", simd_level_to_str (simd_get_level ()));
+
+    if (nic && *nic) {
+        gchar *path, *nic_node;
+
+        path = g_strdup_printf ("/sys/class/net/%s/device/numa_node", nic);
+        nic_node = sys_read_file (path);
+        g_free (path);
+
+        if (sys_get_nic_irq_cpus (nic, &set)) {
+            str = sys_cpu_set_to_str (&set);
+            LOG_msg (SYS_LOG, "NIC %s: NUMA node %s, IRQs on CPUs %s", nic, nic_node ? nic_node : "unknown", str);
+            g_free (str);
+        } else
+            LOG_msg (SYS_LOG, "NIC %s: NUMA node %s, IRQs unknown", nic, nic_node ? nic_node : "unknown");
+        g_free (nic_node);
+    }
+}
+/*}}}*/
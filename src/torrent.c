@@ -0,0 +1,560 @@
+/*
+ * Copyright (C) 2012-2013 Paul Ionkin <paul.ionkin@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include "torrent.h"
+
+#define TORRENT_LOG "torrent"
+
+// GHashTable keeps key, value and hash per entry and is at most ~half full
+#define TORRENT_HASH_ENTRY_SIZE ((sizeof (gpointer) * 2 + sizeof (guint)) * 2)
+// GHashTable itself, with the initial arrays
+#define TORRENT_HASH_TABLE_SIZE 256
+// TorrentTable slot, the table is 3/8 to 3/4 full
+#define TORRENT_TABLE_ENTRY_SIZE (sizeof (guint64) * 2 * 2)
+// GHashTable used as a set keeps key and hash per entry
+#define TORRENT_SET_ENTRY_SIZE ((sizeof (gpointer) + sizeof (guint)) * 2)
+// GPtrArray slot per bucket, arrays are at most ~half full
+#define TORRENT_BUCKET_ENTRY_SIZE (sizeof (gpointer) * 2)
+#define TORRENT_BUCKET_SIZE (sizeof (GPtrArray) + 64 + TORRENT_HASH_ENTRY_SIZE)
+
+static TorrentMemStats mem_stats;
+
+static gboolean locality_enabled = FALSE;
+static const RegionMap *region_map = NULL;
+static TorrentLocalityStats locality_stats;
+
+static gboolean dedup_enabled = FALSE;
+
+const TorrentMemStats *torrent_get_mem_stats (void)
+{
+    return &mem_stats;
+}
+
+void torrent_set_locality (gboolean enabled, const RegionMap *regions)
+{
+    locality_enabled = enabled;
+    region_map = regions;
+}
+
+const TorrentLocalityStats *torrent_get_locality_stats (void)
+{
+    return &locality_stats;
+}
+
+void torrent_set_dedup (gboolean enabled)
+{
+    dedup_enabled = enabled;
+}
+
+static size_t peer_mem_size (const Peer *peer)
+{
+    return sizeof (Peer) + strlen (peer->peer_id) + 1 + TORRENT_HASH_ENTRY_SIZE +
+        (locality_enabled ? TORRENT_BUCKET_ENTRY_SIZE * PB_max : 0) +
+        (dedup_enabled ? TORRENT_SET_ENTRY_SIZE : 0);
+}
+
+static size_t torrent_mem_size (const Torrent *torrent)
+{
+    return sizeof (Torrent) + SHA_DIGEST_LENGTH * 2 + 1 + TORRENT_HASH_TABLE_SIZE + TORRENT_TABLE_ENTRY_SIZE +
+        (locality_enabled ? TORRENT_BUCKET_SIZE + TORRENT_HASH_TABLE_SIZE * 2 : 0) +
+        (dedup_enabled ? TORRENT_HASH_TABLE_SIZE : 0);
+}
+
+// peers are their own keys in h_endpoints
+static guint peer_endpoint_hash (gconstpointer key)
+{
+    const Peer *peer = (const Peer *) key;
+
+    return (peer->addr.s_addr ^ ((guint) peer->port << 16)) * 2654435761U;
+}
+
+static gboolean peer_endpoint_equal (gconstpointer a, gconstpointer b)
+{
+    const Peer *pa = (const Peer *) a;
+    const Peer *pb = (const Peer *) b;
+
+    return pa->addr.s_addr == pb->addr.s_addr && pa->port == pb->port;
+}
+
+/*{{{ Peer */
+Peer *peer_create (const gchar *peer_id, const struct in_addr *addr, gint port)
+{
+    Peer *peer;
+
+    peer = g_new0 (Peer, 1);
+    peer->peer_id = g_strdup (peer_id);
+
+    peer->addr = *addr;
+    peer->port = g_htons (port);
+    peer->status = PS_leecher;
+    peer->access_time = time (NULL);
+    peer->lru_link.data = peer;
+
+    mem_stats.bytes += peer_mem_size (peer);
+    mem_stats.peers++;
+
+    LOG_debug (TORRENT_LOG, "Peer added, id: %s", peer->peer_id);
+
+    return peer;
+}
+
+void peer_destroy (Peer *peer)
+{
+    LOG_debug (TORRENT_LOG, "Peer removed, id: %s", peer->peer_id);
+
+    mem_stats.bytes -= peer_mem_size (peer);
+    mem_stats.peers--;
+
+    g_free (peer->peer_id);
+    g_free (peer);
+}
+
+uint8_t *peer_list_to_compact_val (GList *l_peers, size_t *len)
+{
+    GList *l;
+    uint8_t *out, *tmp;;
+
+    *len = g_list_length (l_peers) * 6;
+
+    out = g_new0 (uint8_t, *len);
+    tmp = out;
+
+    for (l = g_list_first (l_peers); l; l = g_list_next (l)) {
+        Peer *peer = (Peer *) l->data;
+
+        memcpy (tmp, &peer->addr, 4); tmp += 4;
+        memcpy (tmp, &peer->port, 2); tmp += 2;
+    }
+
+    return out;
+}
+
+/*
+// XXX:
+gchar *peer_list_to_dict_str (GList *l_peers)
+{
+    GList *l;
+    gchar *out;
+    size_t len;
+    struct in_addr *addr;
+
+    len = g_list_length (l_peers) * (20 ) + 1;
+
+    for (l = g_list_first (l_peers); l; l = g_list_next (l)) {
+        Peer *peer = (Peer *) l->data;
+    }
+
+}
+*/
+
+void peer_update (Peer *peer, gint64 uploaded, gint64 downloaded, gint64 left, AnnounceEvent ev)
+{
+    peer->uploaded = uploaded;
+    peer->downloaded = downloaded;
+    peer->left = left;
+
+    if (ev == AE_completed)
+        peer->status = PS_seeder;
+}
+
+// transferred since previous announce, counters going back mean client restarted the session
+void peer_get_transfer_delta (const Peer *peer, gint64 uploaded, gint64 downloaded, guint64 *up_delta, guint64 *down_delta)
+{
+    uploaded = MAX (uploaded, 0);
+    downloaded = MAX (downloaded, 0);
+
+    *up_delta = uploaded >= peer->uploaded ? uploaded - peer->uploaded : uploaded;
+    *down_delta = downloaded >= peer->downloaded ? downloaded - peer->downloaded : downloaded;
+}
+/*}}}*/
+
+/*{{{ Locality buckets */
+static void torrent_bucket_free (GPtrArray *bucket)
+{
+    mem_stats.bytes -= TORRENT_BUCKET_SIZE;
+    g_ptr_array_free (bucket, TRUE);
+}
+
+static void torrent_bucket_add (GPtrArray *bucket, Peer *peer, PeerBucket b)
+{
+    peer->bucket_idx[b] = bucket->len;
+    g_ptr_array_add (bucket, peer);
+}
+
+// moves the last peer in place of removed one
+static void torrent_bucket_remove (GPtrArray *bucket, Peer *peer, PeerBucket b)
+{
+    guint idx = peer->bucket_idx[b];
+
+    g_ptr_array_remove_index_fast (bucket, idx);
+    if (idx < bucket->len)
+        ((Peer *) g_ptr_array_index (bucket, idx))->bucket_idx[b] = idx;
+}
+
+static void torrent_link_bucket (GHashTable *h_buckets, guint32 key, Peer *peer, PeerBucket b)
+{
+    GPtrArray *bucket;
+
+    bucket = g_hash_table_lookup (h_buckets, GUINT_TO_POINTER (key));
+    if (!bucket) {
+        bucket = g_ptr_array_new ();
+        g_hash_table_insert (h_buckets, GUINT_TO_POINTER (key), bucket);
+        mem_stats.bytes += TORRENT_BUCKET_SIZE;
+    }
+    torrent_bucket_add (bucket, peer, b);
+}
+
+static void torrent_unlink_bucket (GHashTable *h_buckets, guint32 key, Peer *peer, PeerBucket b)
+{
+    GPtrArray *bucket;
+
+    bucket = g_hash_table_lookup (h_buckets, GUINT_TO_POINTER (key));
+    torrent_bucket_remove (bucket, peer, b);
+    if (!bucket->len)
+        g_hash_table_remove (h_buckets, GUINT_TO_POINTER (key));
+}
+
+static void torrent_link_peer_buckets (Torrent *torrent, Peer *peer)
+{
+    guint32 addr = g_ntohl (peer->addr.s_addr);
+
+    peer->subnet = addr & 0xFFFFFF00U;
+    peer->region = region_map ? region_map_lookup (region_map, addr) : 0;
+
+    torrent_bucket_add (torrent->a_peers, peer, PB_all);
+    torrent_link_bucket (torrent->h_subnets, peer->subnet, peer, PB_subnet);
+    if (peer->region)
+        torrent_link_bucket (torrent->h_regions, peer->region, peer, PB_region);
+}
+
+static void torrent_unlink_peer_buckets (Torrent *torrent, Peer *peer)
+{
+    torrent_bucket_remove (torrent->a_peers, peer, PB_all);
+    torrent_unlink_bucket (torrent->h_subnets, peer->subnet, peer, PB_subnet);
+    if (peer->region)
+        torrent_unlink_bucket (torrent->h_regions, peer->region, peer, PB_region);
+}
+
+/**
+ * Appends up to want peers of bucket to the list, starting at a random position.
+ * Skips self and peers of skip_subnet / skip_region, which were already taken.
+ *
+ * @retval number of appended peers
+ */
+static guint torrent_sample_bucket (GPtrArray *bucket, GList **l, guint want, const Peer *self,
+    const guint32 *skip_subnet, const guint32 *skip_region)
+{
+    guint i, start, taken = 0;
+
+    if (!bucket || !bucket->len || !want)
+        return 0;
+
+    start = g_random_int_range (0, bucket->len);
+    for (i = 0; i < bucket->len && taken < want; i++) {
+        Peer *peer = (Peer *) g_ptr_array_index (bucket, (start + i) % bucket->len);
+
+        if (peer == self || (skip_subnet && peer->subnet == *skip_subnet) ||
+            (skip_region && peer->region == *skip_region))
+            continue;
+
+        *l = g_list_prepend (*l, peer);
+        taken++;
+    }
+
+    return taken;
+}
+/*}}}*/
+
+/*{{{ Torrent */
+Torrent *torrent_create (const uint8_t *info_hash)
+{
+    Torrent *torrent;
+
+    torrent = g_new0 (Torrent, 1);
+    memcpy (torrent->info_hash_bin, info_hash, SHA_DIGEST_LENGTH);
+    torrent->info_hash = g_malloc (SHA_DIGEST_LENGTH * 2 + 1);
+    sha1_to_hexstr (torrent->info_hash, info_hash);
+    torrent->h_peers = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, (GDestroyNotify) peer_destroy);
+    g_queue_init (&torrent->q_peers);
+    if (dedup_enabled)
+        torrent->h_endpoints = g_hash_table_new (peer_endpoint_hash, peer_endpoint_equal);
+    torrent->access_time = time (NULL);
+    torrent->lru_link.data = torrent;
+
+    if (locality_enabled) {
+        torrent->a_peers = g_ptr_array_new ();
+        torrent->h_subnets = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, (GDestroyNotify) torrent_bucket_free);
+        torrent->h_regions = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, (GDestroyNotify) torrent_bucket_free);
+    }
+
+    mem_stats.bytes += torrent_mem_size (torrent);
+    mem_stats.torrents++;
+
+    LOG_debug (TORRENT_LOG, "Torrent added, info_hash: %s", torrent->info_hash);
+
+    return torrent;
+}
+
+void torrent_destroy (Torrent *torrent)
+{
+    LOG_debug (TORRENT_LOG, "Torrent removed, info_hash: %s", torrent->info_hash);
+
+    mem_stats.bytes -= torrent_mem_size (torrent);
+    mem_stats.torrents--;
+
+    if (torrent->a_peers) {
+        g_hash_table_destroy (torrent->h_regions);
+        g_hash_table_destroy (torrent->h_subnets);
+        g_ptr_array_free (torrent->a_peers, TRUE);
+    }
+    if (torrent->h_endpoints)
+        g_hash_table_destroy (torrent->h_endpoints);
+    g_hash_table_destroy (torrent->h_peers);
+    g_free (torrent->info_hash);
+    g_free (torrent);
+}
+
+Peer *torrent_get_peer (Torrent *torrent, const gchar *peer_id)
+{
+    return (Peer *) g_hash_table_lookup (torrent->h_peers, peer_id);
+}
+
+Peer *torrent_add_peer (Torrent *torrent, const gchar *peer_id, const struct in_addr *addr, gint port)
+{
+    Peer *peer;
+
+    peer = peer_create (peer_id, addr, port);
+    g_hash_table_insert (torrent->h_peers, peer->peer_id, peer);
+    g_queue_push_tail_link (&torrent->q_peers, &peer->lru_link);
+    if (torrent->a_peers)
+        torrent_link_peer_buckets (torrent, peer);
+    // the newest peer of an endpoint replaces the previous one
+    if (torrent->h_endpoints)
+        g_hash_table_add (torrent->h_endpoints, peer);
+
+    return peer;
+}
+
+Peer *torrent_get_peer_by_endpoint (Torrent *torrent, const struct in_addr *addr, gint port)
+{
+    Peer probe;
+
+    if (!torrent->h_endpoints)
+        return NULL;
+
+    probe.addr = *addr;
+    probe.port = g_htons (port);
+
+    return (Peer *) g_hash_table_lookup (torrent->h_endpoints, &probe);
+}
+
+static void torrent_unlink_endpoint (Torrent *torrent, Peer *peer)
+{
+    // another peer may have taken the endpoint over
+    if (torrent->h_endpoints && g_hash_table_lookup (torrent->h_endpoints, peer) == peer)
+        g_hash_table_remove (torrent->h_endpoints, peer);
+}
+
+void torrent_set_peer_endpoint (Torrent *torrent, Peer *peer, const struct in_addr *addr, gint port)
+{
+    torrent_unlink_endpoint (torrent, peer);
+    // subnet and region follow the address
+    if (torrent->a_peers)
+        torrent_unlink_peer_buckets (torrent, peer);
+
+    peer->addr = *addr;
+    peer->port = g_htons (port);
+
+    if (torrent->a_peers)
+        torrent_link_peer_buckets (torrent, peer);
+    if (torrent->h_endpoints)
+        g_hash_table_add (torrent->h_endpoints, peer);
+}
+
+// removes peer from q_peers and locality buckets, before it's removed from h_peers
+static void torrent_unlink_peer (Torrent *torrent, Peer *peer)
+{
+    g_queue_unlink (&torrent->q_peers, &peer->lru_link);
+    if (torrent->a_peers)
+        torrent_unlink_peer_buckets (torrent, peer);
+    torrent_unlink_endpoint (torrent, peer);
+}
+
+void torrent_remove_peer (Torrent *torrent, const gchar *peer_id)
+{
+    Peer *peer;
+
+    peer = torrent_get_peer (torrent, peer_id);
+    if (!peer)
+        return;
+
+    torrent_unlink_peer (torrent, peer);
+    g_hash_table_remove (torrent->h_peers, peer_id);
+}
+
+/**
+ * Removes all peers for which func returns TRUE
+ *
+ * @retval number of removed peers
+ */
+guint torrent_remove_peers_if (Torrent *torrent, GHRFunc func, gpointer user_data)
+{
+    GHashTableIter iter;
+    gpointer key;
+    Peer *peer;
+    guint removed = 0;
+
+    g_hash_table_iter_init (&iter, torrent->h_peers);
+    while (g_hash_table_iter_next (&iter, &key, (gpointer *)&peer)) {
+        if (func (key, peer, user_data)) {
+            torrent_unlink_peer (torrent, peer);
+            g_hash_table_iter_remove (&iter);
+            removed++;
+        }
+    }
+
+    return removed;
+}
+
+// peer has announced itself
+void torrent_touch_peer (Torrent *torrent, Peer *peer)
+{
+    peer->access_time = time (NULL);
+    torrent->access_time = peer->access_time;
+
+    if (torrent->q_peers.tail != &peer->lru_link) {
+        g_queue_unlink (&torrent->q_peers, &peer->lru_link);
+        g_queue_push_tail_link (&torrent->q_peers, &peer->lru_link);
+    }
+}
+
+static void torrent_remove_lru_peer (Torrent *torrent)
+{
+    Peer *peer;
+
+    peer = (Peer *) g_queue_peek_head (&torrent->q_peers);
+    torrent_unlink_peer (torrent, peer);
+    g_hash_table_remove (torrent->h_peers, peer->peer_id);
+}
+
+/**
+ * Removes least recently announced peers, until torrent has max_peers
+ *
+ * @retval number of removed peers
+ */
+guint torrent_evict_peers (Torrent *torrent, guint max_peers)
+{
+    guint removed = 0;
+
+    while (g_queue_get_length (&torrent->q_peers) > max_peers) {
+        torrent_remove_lru_peer (torrent);
+        removed++;
+    }
+    mem_stats.evicted_peers += removed;
+
+    return removed;
+}
+
+/**
+ * Removes peers which haven't announced since deadline
+ *
+ * @retval number of removed peers
+ */
+guint torrent_expire_peers (Torrent *torrent, time_t deadline)
+{
+    Peer *peer;
+    guint removed = 0;
+
+    while ((peer = g_queue_peek_head (&torrent->q_peers)) && peer->access_time < deadline) {
+        torrent_remove_lru_peer (torrent);
+        removed++;
+    }
+
+    return removed;
+}
+
+static gint peer_access_time_cmp (gconstpointer a, gconstpointer b, G_GNUC_UNUSED gpointer user_data)
+{
+    const Peer *pa = (const Peer *) a;
+    const Peer *pb = (const Peer *) b;
+
+    return (pa->access_time > pb->access_time) - (pa->access_time < pb->access_time);
+}
+
+// restores access_time order of peers, after access_time was set directly
+void torrent_sort_peers (Torrent *torrent)
+{
+    g_queue_sort (&torrent->q_peers, peer_access_time_cmp, NULL);
+}
+
+GList *torrent_get_list_of_peers (Torrent *torrent, gint numwant)
+{
+    GList *l = NULL;
+    gint peers = 0;
+    GHashTableIter iter;
+    Peer *peer;
+
+    g_hash_table_iter_init (&iter, torrent->h_peers);
+    while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&peer)) {
+        if (peers > numwant)
+            break;
+
+        l = g_list_prepend (l, peer);
+
+        peers++;
+    }
+
+    l = g_list_reverse (l);
+
+    return l;
+}
+
+/**
+ * Returns up to numwant peers, preferring the requester's /24, then its region,
+ * and randomly sampled peers after that. Every step scans at most numwant peers
+ * plus the ones taken by previous steps, which are fewer than numwant.
+ */
+GList *torrent_get_list_of_local_peers (Torrent *torrent, const Peer *self, const struct in_addr *addr, gint numwant)
+{
+    GList *l = NULL;
+    guint32 subnet, region;
+    guint want, taken;
+
+    if (!torrent->a_peers || numwant <= 0)
+        return NULL;
+
+    want = numwant;
+    subnet = g_ntohl (addr->s_addr) & 0xFFFFFF00U;
+    region = region_map ? region_map_lookup (region_map, g_ntohl (addr->s_addr)) : 0;
+
+    taken = torrent_sample_bucket (g_hash_table_lookup (torrent->h_subnets, GUINT_TO_POINTER (subnet)),
+        &l, want, self, NULL, NULL);
+    locality_stats.subnet += taken;
+    want -= taken;
+
+    if (region) {
+        taken = torrent_sample_bucket (g_hash_table_lookup (torrent->h_regions, GUINT_TO_POINTER (region)),
+            &l, want, self, &subnet, NULL);
+        locality_stats.region += taken;
+        want -= taken;
+    }
+
+    taken = torrent_sample_bucket (torrent->a_peers, &l, want, self, &subnet, region ? &region : NULL);
+    locality_stats.random += taken;
+
+    return g_list_reverse (l);
+}
+/*}}}*/
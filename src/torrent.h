@@ -0,0 +1,150 @@
+/*
+ * Copyright (C) 2012-2013 Paul Ionkin <paul.ionkin@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#ifndef _TORRENT_H_
+#define _TORRENT_H_
+
+#include "global.h"
+#include "locality.h"
+
+typedef enum {
+    PS_leecher = 0,
+    PS_seeder = 1,
+} PeerStatus;
+
+// peer lists used by locality-aware selection
+typedef enum {
+    PB_all = 0,
+    PB_subnet = 1,
+    PB_region = 2,
+    PB_max = 3,
+} PeerBucket;
+
+typedef struct {
+    gchar *peer_id;
+    struct in_addr addr;
+    gint port;
+    PeerStatus status;
+    // g_str_hash of the announced key, 0: no key
+    guint32 key_hash;
+    time_t access_time;
+
+    gint64 uploaded;
+    gint64 downloaded;
+    gint64 left;
+
+    // replication: 0 for peers announced to this node,
+    // otherwise node_id of the tracker the peer was learned from
+    guint32 origin;
+    time_t expire_time;
+    time_t repl_time;
+
+    // Torrent's q_peers link, ordered by access_time
+    GList lru_link;
+
+    // locality: /24 network and region of addr, host byte order,
+    // and position of the peer in Torrent's buckets
+    guint32 subnet;
+    guint32 region;
+    guint bucket_idx[PB_max];
+} Peer;
+
+typedef struct {
+    // binary, compared by TorrentTable lookups
+    uint8_t info_hash_bin[SHA_DIGEST_LENGTH];
+    // hex
+    gchar *info_hash;
+    guint32 completed;
+    time_t access_time;
+
+    GHashTable *h_peers;
+    // least recently announced peers first
+    GQueue q_peers;
+    // latest peer by addr and port, only if deduplication is enabled
+    GHashTable *h_endpoints;
+
+    // link in the tracker-wide queue of torrents, ordered by access_time
+    GList lru_link;
+
+    // locality buckets, only if enabled: all peers,
+    // peers by subnet and by region (GPtrArray of Peer)
+    GPtrArray *a_peers;
+    GHashTable *h_subnets;
+    GHashTable *h_regions;
+} Torrent;
+
+// approximate memory used by torrents and peers, in bytes
+typedef struct {
+    guint64 bytes;
+    guint64 torrents;
+    guint64 peers;
+    guint64 evicted_peers;
+} TorrentMemStats;
+
+// peers returned by locality-aware selection
+typedef struct {
+    guint64 subnet;
+    guint64 region;
+    guint64 random;
+} TorrentLocalityStats;
+
+typedef enum {
+    AE_started = 0,
+    AE_stopped = 1,
+    AE_completed = 2,
+    AE_update = 3,
+} AnnounceEvent;
+
+Peer *peer_create (const gchar *peer_id, const struct in_addr *addr, gint port);
+void peer_destroy (Peer *peer);
+void peer_update (Peer *peer, gint64 uploaded, gint64 downloaded, gint64 left, AnnounceEvent ev);
+void peer_get_transfer_delta (const Peer *peer, gint64 uploaded, gint64 downloaded, guint64 *up_delta, guint64 *down_delta);
+uint8_t *peer_list_to_compact_val (GList *l_peers, size_t *len);
+
+// info_hash: binary
+Torrent *torrent_create (const uint8_t *info_hash);
+void torrent_destroy (Torrent *torrent);
+Peer *torrent_get_peer (Torrent *torrent, const gchar *peer_id);
+Peer *torrent_add_peer (Torrent *torrent, const gchar *peer_id, const struct in_addr *addr, gint port);
+// the peer last added with this address and port (host byte order), NULL if deduplication is disabled
+Peer *torrent_get_peer_by_endpoint (Torrent *torrent, const struct in_addr *addr, gint port);
+// moves peer to another address and port (host byte order)
+void torrent_set_peer_endpoint (Torrent *torrent, Peer *peer, const struct in_addr *addr, gint port);
+void torrent_remove_peer (Torrent *torrent, const gchar *peer_id);
+guint torrent_remove_peers_if (Torrent *torrent, GHRFunc func, gpointer user_data);
+void torrent_touch_peer (Torrent *torrent, Peer *peer);
+guint torrent_evict_peers (Torrent *torrent, guint max_peers);
+guint torrent_expire_peers (Torrent *torrent, time_t deadline);
+void torrent_sort_peers (Torrent *torrent);
+GList *torrent_get_list_of_peers (Torrent *torrent, gint numwant);
+GList *torrent_get_list_of_local_peers (Torrent *torrent, const Peer *self, const struct in_addr *addr, gint numwant);
+
+const TorrentMemStats *torrent_get_mem_stats (void);
+
+// must be called before any torrent is created, regions can be NULL
+void torrent_set_locality (gboolean enabled, const RegionMap *regions);
+const TorrentLocalityStats *torrent_get_locality_stats (void);
+// must be called before any torrent is created
+void torrent_set_dedup (gboolean enabled);
+
+// tracker-wide table of torrents, info_hash: binary
+Torrent *tracker_get_torrent (TrackerApp *app, const uint8_t *info_hash);
+Torrent *tracker_add_torrent (TrackerApp *app, const uint8_t *info_hash);
+void tracker_foreach_torrent (TrackerApp *app, GHFunc func, gpointer user_data);
+void tracker_touch_torrent (TrackerApp *app, Torrent *torrent);
+void tracker_remove_torrent (TrackerApp *app, Torrent *torrent);
+
+#endif
@@ -0,0 +1,237 @@
+/*
+ * Copyright (C) 2012-2013 Paul Ionkin <paul.ionkin@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include "torrent_table.h"
+
+#define TABLE_LOG "table"
+
+#define TABLE_MIN_SIZE 1024
+
+typedef struct {
+    guint64 hash;
+    // NULL: empty slot
+    Torrent *torrent;
+} TableSlot;
+
+struct _TorrentTable {
+    TableSlot *slots;
+    // number of slots - 1, number of slots is a power of 2
+    guint64 mask;
+    guint size;
+};
+
+TorrentTable *torrent_table_create (void)
+{
+    TorrentTable *table;
+
+    table = g_new0 (TorrentTable, 1);
+    table->slots = g_new0 (TableSlot, TABLE_MIN_SIZE);
+    table->mask = TABLE_MIN_SIZE - 1;
+
+    return table;
+}
+
+void torrent_table_destroy (TorrentTable *table)
+{
+    guint64 i;
+
+    for (i = 0; i <= table->mask; i++)
+        if (table->slots[i].torrent)
+            torrent_destroy (table->slots[i].torrent);
+
+    g_free (table->slots);
+    g_free (table);
+}
+
+guint torrent_table_size (const TorrentTable *table)
+{
+    return table->size;
+}
+
+Torrent *torrent_table_lookup (const TorrentTable *table, guint64 hash, const uint8_t *info_hash)
+{
+    guint64 i;
+
+    for (i = hash & table->mask; table->slots[i].torrent; i = (i + 1) & table->mask) {
+        if (table->slots[i].hash == hash &&
+            !memcmp (table->slots[i].torrent->info_hash_bin, info_hash, SHA_DIGEST_LENGTH))
+            return table->slots[i].torrent;
+    }
+
+    return NULL;
+}
+
+static void torrent_table_put (TableSlot *slots, guint64 mask, guint64 hash, Torrent *torrent)
+{
+    guint64 i;
+
+    for (i = hash & mask; slots[i].torrent; i = (i + 1) & mask)
+        ;
+
+    slots[i].hash = hash;
+    slots[i].torrent = torrent;
+}
+
+// doubles the number of slots, stalls the loop for a moment on big tables
+static void torrent_table_grow (TorrentTable *table)
+{
+    guint64 mask = table->mask * 2 + 1;
+    TableSlot *slots;
+    guint64 i;
+
+    slots = g_new0 (TableSlot, mask + 1);
+    for (i = 0; i <= table->mask; i++)
+        if (table->slots[i].torrent)
+            torrent_table_put (slots, mask, table->slots[i].hash, table->slots[i].torrent);
+
+    g_free (table->slots);
+    table->slots = slots;
+    table->mask = mask;
+
+    LOG_debug (TABLE_LOG, "Torrent table grown to %"G_GUINT64_FORMAT" slots", mask + 1);
+}
+
+void torrent_table_insert (TorrentTable *table, guint64 hash, Torrent *torrent)
+{
+    // load factor <= 3/4
+    if ((guint64) (table->size + 1) * 4 > (table->mask + 1) * 3)
+        torrent_table_grow (table);
+
+    torrent_table_put (table->slots, table->mask, hash, torrent);
+    table->size++;
+}
+
+// backward shift deletion: moves following entries of the cluster into the
+// hole unless that would put them before their home slot
+static void torrent_table_delete_slot (TorrentTable *table, guint64 hole)
+{
+    TableSlot *slots = table->slots;
+    guint64 j = hole;
+
+    torrent_destroy (slots[hole].torrent);
+
+    for (;;) {
+        guint64 home;
+
+        j = (j + 1) & table->mask;
+        if (!slots[j].torrent)
+            break;
+
+        home = slots[j].hash & table->mask;
+        // home is cyclically in (hole, j]: entry stays
+        if (hole <= j ? (hole < home && home <= j) : (hole < home || home <= j))
+            continue;
+
+        slots[hole] = slots[j];
+        hole = j;
+    }
+
+    slots[hole].torrent = NULL;
+    table->size--;
+}
+
+void torrent_table_remove (TorrentTable *table, guint64 hash, Torrent *torrent)
+{
+    guint64 i;
+
+    for (i = hash & table->mask; table->slots[i].torrent; i = (i + 1) & table->mask) {
+        if (table->slots[i].torrent == torrent) {
+            torrent_table_delete_slot (table, i);
+            return;
+        }
+    }
+}
+
+void torrent_table_prefetch (const TorrentTable *table, guint64 hash)
+{
+    __builtin_prefetch (&table->slots[hash & table->mask]);
+}
+
+// the slot is expected to be in cache already
+void torrent_table_prefetch_torrent (const TorrentTable *table, guint64 hash)
+{
+    guint64 i;
+
+    for (i = hash & table->mask; table->slots[i].torrent; i = (i + 1) & table->mask) {
+        if (table->slots[i].hash == hash) {
+            __builtin_prefetch (table->slots[i].torrent);
+            return;
+        }
+    }
+}
+
+void torrent_table_foreach (const TorrentTable *table, GHFunc func, gpointer user_data)
+{
+    guint64 i;
+
+    for (i = 0; i <= table->mask; i++)
+        if (table->slots[i].torrent)
+            func (table->slots[i].torrent->info_hash, table->slots[i].torrent, user_data);
+}
+
+guint torrent_table_foreach_remove (TorrentTable *table, GHRFunc func, gpointer user_data)
+{
+    guint64 start, n, i;
+    guint removed = 0;
+
+    // start right after an empty slot: no cluster wraps around the starting
+    // point, so deletion only moves entries that are not visited yet
+    for (start = 0; table->slots[start].torrent; start++)
+        ;
+
+    for (n = 1; n <= table->mask + 1; ) {
+        TableSlot *slot;
+
+        i = (start + n) & table->mask;
+        slot = &table->slots[i];
+        if (slot->torrent && func (slot->torrent->info_hash, slot->torrent, user_data)) {
+            torrent_table_delete_slot (table, i);
+            removed++;
+            // slot i may hold the next entry of the cluster now
+            continue;
+        }
+        n++;
+    }
+
+    return removed;
+}
+
+gboolean torrent_table_foreach_remove_slice (TorrentTable *table, guint64 *cursor, guint64 slots,
+    GHRFunc func, gpointer user_data, guint *removed)
+{
+    guint64 i = *cursor;
+    guint64 end = MIN (i + slots, table->mask + 1);
+
+    while (i < end) {
+        TableSlot *slot = &table->slots[i];
+
+        if (slot->torrent && func (slot->torrent->info_hash, slot->torrent, user_data)) {
+            torrent_table_delete_slot (table, i);
+            (*removed)++;
+            // slot i may hold the next entry of the cluster now
+            continue;
+        }
+        i++;
+    }
+
+    if (i > table->mask) {
+        *cursor = 0;
+        return TRUE;
+    }
+
+    *cursor = i;
+    return FALSE;
+}
@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2012-2013 Paul Ionkin <paul.ionkin@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#ifndef _TORRENT_TABLE_H_
+#define _TORRENT_TABLE_H_
+
+#include "global.h"
+#include "torrent.h"
+
+/*
+ * Torrents by binary info_hash: open addressing with linear probing, slots
+ * hold the 64 bit hash (sha1_hash64) and Torrent pointer. Callers hash once
+ * and can prefetch the slot, then the torrent, before the lookup.
+ * The table owns torrents, removed ones are destroyed.
+ */
+typedef struct _TorrentTable TorrentTable;
+
+TorrentTable *torrent_table_create (void);
+void torrent_table_destroy (TorrentTable *table);
+
+guint torrent_table_size (const TorrentTable *table);
+
+Torrent *torrent_table_lookup (const TorrentTable *table, guint64 hash, const uint8_t *info_hash);
+// torrent must not be in the table
+void torrent_table_insert (TorrentTable *table, guint64 hash, Torrent *torrent);
+void torrent_table_remove (TorrentTable *table, guint64 hash, Torrent *torrent);
+
+// cache hints: the slot of hash, the first torrent stored under hash
+void torrent_table_prefetch (const TorrentTable *table, guint64 hash);
+void torrent_table_prefetch_torrent (const TorrentTable *table, guint64 hash);
+
+// key: hex info_hash
+void torrent_table_foreach (const TorrentTable *table, GHFunc func, gpointer user_data);
+// removes torrents for which func returns TRUE, every torrent is visited once
+guint torrent_table_foreach_remove (TorrentTable *table, GHRFunc func, gpointer user_data);
+// the same over at most slots slots from *cursor, which is advanced and
+// reset to 0 once the table is passed, then TRUE is returned. Torrents
+// moved by inserts or removals between slices can be missed or visited twice
+gboolean torrent_table_foreach_remove_slice (TorrentTable *table, guint64 *cursor, guint64 slots,
+    GHRFunc func, gpointer user_data, guint *removed);
+
+#endif
@@ -0,0 +1,161 @@
+/*
+ * Copyright (C) 2012-2013 Paul Ionkin <paul.ionkin@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include "trace.h"
+
+#ifdef TRACING_ENABLED
+
+#include <sys/mman.h>
+#include <time.h>
+
+#define TRACE_LOG "trace"
+
+struct _Tracer {
+    gchar *path;
+    TraceFileHeader *hdr;
+    TraceRecord *records;
+    size_t map_len;
+
+    guint32 sample_every;
+    guint64 slow_ns;
+};
+
+static inline guint64 trace_now (void)
+{
+    struct timespec ts;
+
+    // served by vDSO, no syscall
+    clock_gettime (CLOCK_MONOTONIC_RAW, &ts);
+
+    return (guint64) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline guint trace_hist_bucket (guint64 ns)
+{
+    return ns ? MIN (64 - __builtin_clzll (ns), TRACE_HIST_BUCKETS - 1) : 0;
+}
+
+Tracer *tracer_create (ConfData *conf)
+{
+    Tracer *tracer;
+    guint32 n_records;
+    gint fd;
+    void *map;
+
+    n_records = MAX (1, conf_get_uint (conf, "trace.records"));
+
+    tracer = g_new0 (Tracer, 1);
+    tracer->path = g_strdup (conf_get_string (conf, "trace.file"));
+    tracer->sample_every = conf_get_uint (conf, "trace.sample_every");
+    tracer->slow_ns = (guint64) conf_get_uint (conf, "trace.slow_threshold_us") * 1000;
+    tracer->map_len = sizeof (TraceFileHeader) + (size_t) n_records * sizeof (TraceRecord);
+
+    fd = open (tracer->path, O_RDWR | O_CREAT | O_TRUNC, 0640);
+    if (fd < 0 || ftruncate (fd, tracer->map_len) != 0) {
+        LOG_err (TRACE_LOG, "Failed to create %s: %s", tracer->path, strerror (errno));
+        if (fd >= 0)
+            close (fd);
+        g_free (tracer->path);
+        g_free (tracer);
+        return NULL;
+    }
+
+    map = mmap (NULL, tracer->map_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close (fd);
+    if (map == MAP_FAILED) {
+        LOG_err (TRACE_LOG, "Failed to mmap %s: %s", tracer->path, strerror (errno));
+        g_free (tracer->path);
+        g_free (tracer);
+        return NULL;
+    }
+
+    tracer->hdr = (TraceFileHeader *) map;
+    tracer->records = (TraceRecord *) ((uint8_t *) map + sizeof (TraceFileHeader));
+
+    memcpy (tracer->hdr->magic, TRACE_FILE_MAGIC, sizeof (tracer->hdr->magic));
+    tracer->hdr->version = TRACE_FILE_VERSION;
+    tracer->hdr->n_phases = TP_max;
+    tracer->hdr->n_records = n_records;
+
+    LOG_msg (TRACE_LOG, "Tracing to %s: 1 in %u requests and requests above %"G_GUINT64_FORMAT" us",
+        tracer->path, tracer->sample_every, tracer->slow_ns / 1000);
+
+    return tracer;
+}
+
+void tracer_destroy (Tracer *tracer)
+{
+    munmap (tracer->hdr, tracer->map_len);
+    g_free (tracer->path);
+    g_free (tracer);
+}
+
+void trace_request_begin (TraceRequest *t)
+{
+    gint i;
+
+    t->start = trace_now ();
+    for (i = 0; i < TP_max; i++)
+        t->ts[i] = t->start;
+}
+
+void trace_request_phase (TraceRequest *t, TracePhase phase)
+{
+    t->ts[phase] = trace_now ();
+}
+
+void trace_request_end (Tracer *tracer, TraceRequest *t)
+{
+    TraceFileHeader *hdr;
+    guint32 phase_ns[TP_max];
+    guint64 prev, total, requests;
+    guint32 flags = 0;
+    gint i;
+
+    if (!tracer)
+        return;
+    hdr = tracer->hdr;
+
+    // phases which were not reached take no time
+    prev = t->start;
+    for (i = 0; i < TP_max; i++) {
+        guint64 d = t->ts[i] > prev ? t->ts[i] - prev : 0;
+
+        phase_ns[i] = MIN (d, G_MAXUINT32);
+        // pipeline network threads end traces concurrently
+        __atomic_fetch_add (&hdr->hist[i][trace_hist_bucket (d)], 1, __ATOMIC_RELAXED);
+        prev = MAX (prev, t->ts[i]);
+    }
+    total = prev - t->start;
+    __atomic_fetch_add (&hdr->hist[TP_max][trace_hist_bucket (total)], 1, __ATOMIC_RELAXED);
+    requests = __atomic_add_fetch (&hdr->requests, 1, __ATOMIC_RELAXED);
+
+    if (tracer->slow_ns && total >= tracer->slow_ns)
+        flags |= TRACE_FLAG_SLOW;
+    if (tracer->sample_every && requests % tracer->sample_every == 0)
+        flags |= TRACE_FLAG_SAMPLED;
+
+    if (flags) {
+        guint64 head = __atomic_fetch_add (&hdr->head, 1, __ATOMIC_RELAXED);
+        TraceRecord *rec = &tracer->records[head % hdr->n_records];
+
+        rec->start_ns = t->start;
+        memcpy (rec->phase_ns, phase_ns, sizeof (rec->phase_ns));
+        rec->flags = flags;
+    }
+}
+
+#endif
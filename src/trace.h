@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2012-2013 Paul Ionkin <paul.ionkin@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include "global.h"
+
+/*
+ * Announce phase tracing, built with --enable-tracing.
+ * Per-phase log2 histograms and a ring of sampled and slow requests are kept
+ * in a memory-mapped file (host byte order), decoded with tbfs_tracedump.
+ */
+
+typedef enum {
+    TP_parse = 0,
+    TP_lookup,
+    TP_peers,
+    TP_encode,
+    TP_send,
+    TP_max,
+} TracePhase;
+
+#define TRACE_PHASE_NAMES { "parse", "lookup", "peers", "encode", "send", "total" }
+
+#define TRACE_FILE_MAGIC "TBTR"
+#define TRACE_FILE_VERSION 1
+// bucket i counts durations of [2^(i-1), 2^i) nanoseconds
+#define TRACE_HIST_BUCKETS 64
+
+enum {
+    TRACE_FLAG_SAMPLED = 1 << 0,
+    TRACE_FLAG_SLOW = 1 << 1,
+};
+
+typedef struct {
+    char magic[4];
+    guint32 version;
+    guint32 n_phases;
+    guint32 n_records;
+    // records written so far, next one goes to head % n_records
+    guint64 head;
+    guint64 requests;
+    // last row is the total request time
+    guint64 hist[TP_max + 1][TRACE_HIST_BUCKETS];
+} TraceFileHeader;
+
+typedef struct {
+    // CLOCK_MONOTONIC_RAW, ns
+    guint64 start_ns;
+    guint32 phase_ns[TP_max];
+    guint32 flags;
+} TraceRecord;
+
+#ifdef TRACING_ENABLED
+
+typedef struct _Tracer Tracer;
+
+typedef struct {
+    guint64 start;
+    guint64 ts[TP_max];
+} TraceRequest;
+
+Tracer *tracer_create (ConfData *conf);
+void tracer_destroy (Tracer *tracer);
+
+void trace_request_begin (TraceRequest *t);
+void trace_request_phase (TraceRequest *t, TracePhase phase);
+// safe to call from several threads
+void trace_request_end (Tracer *tracer, TraceRequest *t);
+
+#define TRACE_DECLARE(t) TraceRequest t;
+#define TRACE_BEGIN(t) trace_request_begin (&(t))
+#define TRACE_PHASE(t, phase) trace_request_phase (&(t), (phase))
+#define TRACE_END(t, tracer) trace_request_end ((tracer), &(t))
+
+#else
+
+#define TRACE_DECLARE(t)
+#define TRACE_BEGIN(t)
+#define TRACE_PHASE(t, phase)
+#define TRACE_END(t, tracer)
+
+#endif
+
+#endif
@@ -0,0 +1,156 @@
+/*
+ * Copyright (C) 2012-2013 Paul Ionkin <paul.ionkin@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+/*
+ * Decodes trace file written by tracker built with --enable-tracing:
+ *   tbfs_tracedump [-n records] /tmp/tbfs_tracker.trace
+ * The file can be read while tracker is running.
+ */
+#include "trace.h"
+#include <sys/mman.h>
+
+static const gchar *phase_names[] = TRACE_PHASE_NAMES;
+
+// upper bound of the bucket containing given percentile, ns
+static guint64 hist_percentile (const guint64 *hist, guint64 count, gdouble pct)
+{
+    guint64 target, sum = 0;
+    gint i;
+
+    if (!count)
+        return 0;
+
+    target = (guint64) (count * pct / 100.0);
+    if (target >= count)
+        target = count - 1;
+
+    for (i = 0; i < TRACE_HIST_BUCKETS; i++) {
+        sum += hist[i];
+        if (sum > target)
+            return i ? 1ULL << i : 0;
+    }
+
+    return G_MAXUINT64;
+}
+
+static void print_histograms (const TraceFileHeader *hdr)
+{
+    gint i;
+
+    g_fprintf (stdout, "Requests: %"G_GUINT64_FORMAT", recorded: %"G_GUINT64_FORMAT"\n\n",
+        hdr->requests, hdr->head);
+    g_fprintf (stdout, "%-8s %12s %12s %12s %12s %12s\n", "phase", "p50 us", "p90 us", "p99 us", "p99.9 us", "max us");
+
+    for (i = 0; i <= TP_max; i++) {
+        const guint64 *hist = hdr->hist[i];
+        guint64 count = 0, max = 0;
+        gint b;
+
+        for (b = 0; b < TRACE_HIST_BUCKETS; b++) {
+            count += hist[b];
+            if (hist[b])
+                max = b ? 1ULL << b : 0;
+        }
+
+        g_fprintf (stdout, "%-8s %12.1f %12.1f %12.1f %12.1f %12.1f\n", phase_names[i],
+            hist_percentile (hist, count, 50) / 1000.0,
+            hist_percentile (hist, count, 90) / 1000.0,
+            hist_percentile (hist, count, 99) / 1000.0,
+            hist_percentile (hist, count, 99.9) / 1000.0,
+            max / 1000.0);
+    }
+}
+
+static void print_records (const TraceFileHeader *hdr, const TraceRecord *records, guint64 n)
+{
+    guint64 first, r;
+    gint i;
+
+    n = MIN (n, MIN (hdr->head, hdr->n_records));
+    first = hdr->head - n;
+
+    g_fprintf (stdout, "\n%-16s %-7s", "start ns", "flags");
+    for (i = 0; i < TP_max; i++)
+        g_fprintf (stdout, " %9s", phase_names[i]);
+    g_fprintf (stdout, " %9s\n", phase_names[TP_max]);
+
+    for (r = first; r < hdr->head; r++) {
+        const TraceRecord *rec = &records[r % hdr->n_records];
+        guint64 total = 0;
+
+        g_fprintf (stdout, "%-16"G_GUINT64_FORMAT" %-7s", rec->start_ns,
+            (rec->flags & TRACE_FLAG_SLOW) ? "slow" : "sampled");
+        for (i = 0; i < TP_max; i++) {
+            g_fprintf (stdout, " %9.1f", rec->phase_ns[i] / 1000.0);
+            total += rec->phase_ns[i];
+        }
+        g_fprintf (stdout, " %9.1f\n", total / 1000.0);
+    }
+}
+
+int main (int argc, char *argv[])
+{
+    GOptionContext *context;
+    GError *error = NULL;
+    gint n_records = 20;
+    const TraceFileHeader *hdr;
+    struct stat st;
+    void *map;
+    gint fd;
+    GOptionEntry entries[] = {
+        { "records", 'n', 0, G_OPTION_ARG_INT, &n_records, "Number of last records to print, default 20.", NULL },
+        { NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL }
+    };
+
+    context = g_option_context_new ("trace_file");
+    g_option_context_add_main_entries (context, entries, NULL);
+    if (!g_option_context_parse (context, &argc, &argv, &error) || argc < 2) {
+        g_fprintf (stderr, "Usage: %s [-n records] trace_file\n", argv[0]);
+        g_option_context_free (context);
+        return -1;
+    }
+    g_option_context_free (context);
+
+    fd = open (argv[1], O_RDONLY);
+    if (fd < 0 || fstat (fd, &st) != 0 || (size_t) st.st_size < sizeof (TraceFileHeader)) {
+        g_fprintf (stderr, "Failed to open %s\n", argv[1]);
+        return -1;
+    }
+
+    map = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close (fd);
+    if (map == MAP_FAILED) {
+        g_fprintf (stderr, "Failed to mmap %s: %s\n", argv[1], strerror (errno));
+        return -1;
+    }
+
+    hdr = (const TraceFileHeader *) map;
+    if (memcmp (hdr->magic, TRACE_FILE_MAGIC, sizeof (hdr->magic)) || hdr->version != TRACE_FILE_VERSION ||
+        hdr->n_phases != TP_max ||
+        (size_t) st.st_size < sizeof (TraceFileHeader) + (size_t) hdr->n_records * sizeof (TraceRecord)) {
+        g_fprintf (stderr, "Invalid trace file: %s\n", argv[1]);
+        munmap (map, st.st_size);
+        return -1;
+    }
+
+    print_histograms (hdr);
+    if (n_records > 0)
+        print_records (hdr, (const TraceRecord *) ((const uint8_t *) map + sizeof (TraceFileHeader)), n_records);
+
+    munmap (map, st.st_size);
+
+    return 0;
+}
@@ -0,0 +1,544 @@
+/*
+ * Copyright (C) 2012-2013 Paul Ionkin <paul.ionkin@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include "upgrade.h"
+#include "torrent.h"
+#include <sys/un.h>
+#include <sys/wait.h>
+
+/*
+ * Binary upgrade:
+ *  1. running tracker gets SIGUSR2, listens on "app.upgrade_socket" and
+ *     starts the new binary with the same arguments and --upgrade flag
+ *  2. new process connects, receives listening sockets (SCM_RIGHTS) and
+ *     the stream of torrents and peers
+ *  3. new process starts serving and sends the "ready" byte
+ *  4. old process stops accepting, finishes active requests and exits
+ */
+
+#define UPGRADE_MAGIC 0x54425553 // "TBUS"
+#define UPGRADE_VERSION 2
+// plain HTTP, replication and TLS listening sockets
+#define UPGRADE_MAX_FDS 3
+#define UPGRADE_FLUSH_SIZE (64 * 1024)
+#define UPGRADE_READY 'R'
+#define UPGRADE_CONNECT_RETRIES 50
+
+typedef enum {
+    UR_torrent = 'T',
+    UR_end = 'E',
+} UpgradeRecord;
+
+struct _Upgrade {
+    TrackerApp *app;
+    gchar **argv;
+    gchar *path;
+
+    struct event *ev_sigusr2;
+    struct event *ev_accept;
+    struct event *ev_ctl;
+    evutil_socket_t listen_fd;
+    evutil_socket_t ctl_fd;
+    pid_t child_pid;
+};
+
+#define UPGRADE_LOG "upgrade"
+
+static void upgrade_on_sigusr2_cb (evutil_socket_t sig, short events, void *ctx);
+static void upgrade_abort (Upgrade *upgrade);
+
+/*{{{ create / destroy */
+Upgrade *upgrade_create (TrackerApp *app, gchar **argv)
+{
+    Upgrade *upgrade;
+
+    upgrade = g_new0 (Upgrade, 1);
+    upgrade->app = app;
+    upgrade->argv = g_strdupv (argv);
+    upgrade->path = g_strdup (conf_get_string (tracker_app_get_conf (app), "app.upgrade_socket"));
+    upgrade->listen_fd = -1;
+    upgrade->ctl_fd = -1;
+
+    upgrade->ev_sigusr2 = evsignal_new (tracker_app_get_evbase (app), SIGUSR2, upgrade_on_sigusr2_cb, upgrade);
+    event_add (upgrade->ev_sigusr2, NULL);
+
+    return upgrade;
+}
+
+void upgrade_destroy (Upgrade *upgrade)
+{
+    upgrade_abort (upgrade);
+
+    if (upgrade->ev_sigusr2)
+        event_free (upgrade->ev_sigusr2);
+    g_strfreev (upgrade->argv);
+    g_free (upgrade->path);
+    g_free (upgrade);
+}
+
+static void upgrade_abort (Upgrade *upgrade)
+{
+    if (upgrade->ev_accept) {
+        event_free (upgrade->ev_accept);
+        upgrade->ev_accept = NULL;
+    }
+    if (upgrade->ev_ctl) {
+        event_free (upgrade->ev_ctl);
+        upgrade->ev_ctl = NULL;
+    }
+    if (upgrade->listen_fd >= 0) {
+        evutil_closesocket (upgrade->listen_fd);
+        unlink (upgrade->path);
+        upgrade->listen_fd = -1;
+    }
+    if (upgrade->ctl_fd >= 0) {
+        evutil_closesocket (upgrade->ctl_fd);
+        upgrade->ctl_fd = -1;
+    }
+    if (upgrade->child_pid > 0) {
+        waitpid (upgrade->child_pid, NULL, WNOHANG);
+        upgrade->child_pid = 0;
+    }
+}
+/*}}}*/
+
+/*{{{ state stream */
+static gboolean upgrade_write_all (gint fd, struct evbuffer *evb)
+{
+    while (evbuffer_get_length (evb) > 0) {
+        if (evbuffer_write (evb, fd) < 0 && errno != EINTR) {
+            LOG_err (UPGRADE_LOG, "Failed to send state: %s", strerror (errno));
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+typedef struct {
+    gint fd;
+    struct evbuffer *evb;
+    gboolean failed;
+    guint64 torrents;
+    guint64 peers;
+} UpgradeSendCtx;
+
+static void upgrade_send_torrent (G_GNUC_UNUSED gpointer key, gpointer value, gpointer user_data)
+{
+    Torrent *torrent = (Torrent *) value;
+    UpgradeSendCtx *ctx = (UpgradeSendCtx *) user_data;
+    GHashTableIter iter;
+    Peer *peer;
+    guint8 rec = UR_torrent;
+    guint32 tmp32;
+
+    if (ctx->failed)
+        return;
+
+    evbuffer_add (ctx->evb, &rec, 1);
+    evbuffer_add (ctx->evb, torrent->info_hash_bin, SHA_DIGEST_LENGTH);
+    tmp32 = g_htonl (torrent->completed);
+    evbuffer_add (ctx->evb, &tmp32, 4);
+    tmp32 = g_htonl (g_hash_table_size (torrent->h_peers));
+    evbuffer_add (ctx->evb, &tmp32, 4);
+
+    g_hash_table_iter_init (&iter, torrent->h_peers);
+    while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &peer)) {
+        guint8 id_len = (guint8) MIN (strlen (peer->peer_id), 255);
+        guint8 status = peer->status;
+        guint16 port = peer->port;
+        guint64 vals[5];
+        gint i;
+
+        vals[0] = peer->uploaded;
+        vals[1] = peer->downloaded;
+        vals[2] = peer->left;
+        vals[3] = peer->access_time;
+        vals[4] = peer->expire_time;
+        for (i = 0; i < 5; i++)
+            vals[i] = GUINT64_TO_BE (vals[i]);
+
+        evbuffer_add (ctx->evb, &id_len, 1);
+        evbuffer_add (ctx->evb, peer->peer_id, id_len);
+        evbuffer_add (ctx->evb, &peer->addr, 4);
+        evbuffer_add (ctx->evb, &port, 2);
+        evbuffer_add (ctx->evb, &status, 1);
+        evbuffer_add (ctx->evb, vals, sizeof (vals));
+        tmp32 = g_htonl (peer->origin);
+        evbuffer_add (ctx->evb, &tmp32, 4);
+
+        ctx->peers++;
+    }
+    ctx->torrents++;
+
+    if (evbuffer_get_length (ctx->evb) >= UPGRADE_FLUSH_SIZE && !upgrade_write_all (ctx->fd, ctx->evb))
+        ctx->failed = TRUE;
+}
+
+static gboolean upgrade_send_fds (gint fd, evutil_socket_t http_fd, evutil_socket_t repl_fd, evutil_socket_t https_fd)
+{
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    char cbuf[CMSG_SPACE (sizeof (int) * UPGRADE_MAX_FDS)];
+    guint32 hdr[2 + UPGRADE_MAX_FDS];
+    int fds[UPGRADE_MAX_FDS];
+    guint n = 0;
+
+    hdr[0] = g_htonl (UPGRADE_MAGIC);
+    hdr[1] = g_htonl (UPGRADE_VERSION);
+    hdr[2] = g_htonl (http_fd >= 0);
+    hdr[3] = g_htonl (repl_fd >= 0);
+    hdr[4] = g_htonl (https_fd >= 0);
+
+    if (http_fd >= 0)
+        fds[n++] = http_fd;
+    if (repl_fd >= 0)
+        fds[n++] = repl_fd;
+    if (https_fd >= 0)
+        fds[n++] = https_fd;
+
+    memset (&msg, 0, sizeof (msg));
+    iov.iov_base = hdr;
+    iov.iov_len = sizeof (hdr);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    if (n) {
+        memset (cbuf, 0, sizeof (cbuf));
+        msg.msg_control = cbuf;
+        msg.msg_controllen = CMSG_SPACE (sizeof (int) * n);
+        cmsg = CMSG_FIRSTHDR (&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN (sizeof (int) * n);
+        memcpy (CMSG_DATA (cmsg), fds, sizeof (int) * n);
+    }
+
+    if (sendmsg (fd, &msg, 0) != (ssize_t) sizeof (hdr)) {
+        LOG_err (UPGRADE_LOG, "Failed to send listening sockets: %s", strerror (errno));
+        return FALSE;
+    }
+
+    return TRUE;
+}
+/*}}}*/
+
+/*{{{ running process */
+static void upgrade_on_ctl_read_cb (evutil_socket_t fd, G_GNUC_UNUSED short events, void *ctx)
+{
+    Upgrade *upgrade = (Upgrade *) ctx;
+    gchar c = 0;
+    ssize_t r;
+
+    r = recv (fd, &c, 1, 0);
+    if (r < 0 && (errno == EAGAIN || errno == EINTR))
+        return;
+
+    if (r == 1 && c == UPGRADE_READY) {
+        LOG_msg (UPGRADE_LOG, "New process is serving requests, shutting down");
+        upgrade_abort (upgrade);
+        tracker_app_stop_accepting (upgrade->app);
+        return;
+    }
+
+    LOG_err (UPGRADE_LOG, "New process failed to start, upgrade is aborted");
+    upgrade_abort (upgrade);
+}
+
+static void upgrade_on_accept_cb (evutil_socket_t fd, G_GNUC_UNUSED short events, void *ctx)
+{
+    Upgrade *upgrade = (Upgrade *) ctx;
+    UpgradeSendCtx send_ctx;
+    evutil_socket_t http_fd, repl_fd, https_fd;
+    guint8 rec = UR_end;
+    gint ctl_fd;
+
+    ctl_fd = accept (fd, NULL, NULL);
+    if (ctl_fd < 0)
+        return;
+    evutil_make_socket_closeonexec (ctl_fd);
+
+    // only one new process is expected
+    event_free (upgrade->ev_accept);
+    upgrade->ev_accept = NULL;
+    evutil_closesocket (upgrade->listen_fd);
+    upgrade->listen_fd = -1;
+    unlink (upgrade->path);
+
+    upgrade->ctl_fd = ctl_fd;
+
+    tracker_app_get_listen_fds (upgrade->app, &http_fd, &repl_fd, &https_fd);
+    if (!upgrade_send_fds (ctl_fd, http_fd, repl_fd, https_fd)) {
+        upgrade_abort (upgrade);
+        return;
+    }
+
+    // torrents are sent synchronously, new connections wait in the listen queue
+    memset (&send_ctx, 0, sizeof (send_ctx));
+    send_ctx.fd = ctl_fd;
+    send_ctx.evb = evbuffer_new ();
+    tracker_foreach_torrent (upgrade->app, upgrade_send_torrent, &send_ctx);
+    evbuffer_add (send_ctx.evb, &rec, 1);
+    if (send_ctx.failed || !upgrade_write_all (ctl_fd, send_ctx.evb)) {
+        evbuffer_free (send_ctx.evb);
+        upgrade_abort (upgrade);
+        return;
+    }
+    evbuffer_free (send_ctx.evb);
+
+    LOG_msg (UPGRADE_LOG, "Sent %"G_GUINT64_FORMAT" torrents, %"G_GUINT64_FORMAT" peers, waiting for new process",
+        send_ctx.torrents, send_ctx.peers);
+
+    evutil_make_socket_nonblocking (ctl_fd);
+    upgrade->ev_ctl = event_new (tracker_app_get_evbase (upgrade->app), ctl_fd, EV_READ | EV_PERSIST,
+        upgrade_on_ctl_read_cb, upgrade);
+    event_add (upgrade->ev_ctl, NULL);
+}
+
+static void upgrade_on_sigusr2_cb (G_GNUC_UNUSED evutil_socket_t sig, G_GNUC_UNUSED short events, void *ctx)
+{
+    Upgrade *upgrade = (Upgrade *) ctx;
+    struct sockaddr_un sun;
+    GPtrArray *a_argv;
+    gint i;
+
+    if (upgrade->listen_fd >= 0 || upgrade->ctl_fd >= 0) {
+        LOG_err (UPGRADE_LOG, "Upgrade is already in progress !");
+        return;
+    }
+
+    if (strlen (upgrade->path) >= sizeof (sun.sun_path)) {
+        LOG_err (UPGRADE_LOG, "Upgrade socket path is too long: %s", upgrade->path);
+        return;
+    }
+
+    memset (&sun, 0, sizeof (sun));
+    sun.sun_family = AF_UNIX;
+    strcpy (sun.sun_path, upgrade->path);
+    unlink (upgrade->path);
+
+    upgrade->listen_fd = socket (AF_UNIX, SOCK_STREAM, 0);
+    if (upgrade->listen_fd < 0 || bind (upgrade->listen_fd, (struct sockaddr *) &sun, sizeof (sun)) < 0 ||
+        listen (upgrade->listen_fd, 1) < 0) {
+        LOG_err (UPGRADE_LOG, "Failed to listen on %s: %s", upgrade->path, strerror (errno));
+        upgrade_abort (upgrade);
+        return;
+    }
+    evutil_make_socket_closeonexec (upgrade->listen_fd);
+
+    upgrade->ev_accept = event_new (tracker_app_get_evbase (upgrade->app), upgrade->listen_fd, EV_READ,
+        upgrade_on_accept_cb, upgrade);
+    event_add (upgrade->ev_accept, NULL);
+
+    // the same command line, plus --upgrade
+    a_argv = g_ptr_array_new ();
+    for (i = 0; upgrade->argv[i]; i++) {
+        if (g_strcmp0 (upgrade->argv[i], "--upgrade"))
+            g_ptr_array_add (a_argv, upgrade->argv[i]);
+    }
+    g_ptr_array_add (a_argv, (gpointer) "--upgrade");
+    g_ptr_array_add (a_argv, NULL);
+
+    LOG_msg (UPGRADE_LOG, "Starting new process: %s", upgrade->argv[0]);
+
+    upgrade->child_pid = fork ();
+    if (upgrade->child_pid == 0) {
+        execvp (upgrade->argv[0], (gchar **) a_argv->pdata);
+        _exit (1);
+    }
+    g_ptr_array_free (a_argv, TRUE);
+
+    if (upgrade->child_pid < 0) {
+        LOG_err (UPGRADE_LOG, "Failed to start new process: %s", strerror (errno));
+        upgrade_abort (upgrade);
+    }
+}
+/*}}}*/
+
+/*{{{ new process */
+static gboolean upgrade_recv_fds (gint fd, evutil_socket_t *http_fd, evutil_socket_t *repl_fd, evutil_socket_t *https_fd)
+{
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    char cbuf[CMSG_SPACE (sizeof (int) * UPGRADE_MAX_FDS)];
+    guint32 hdr[2 + UPGRADE_MAX_FDS];
+    int fds[UPGRADE_MAX_FDS] = { -1, -1, -1 };
+    guint n = 0;
+
+    memset (&msg, 0, sizeof (msg));
+    iov.iov_base = hdr;
+    iov.iov_len = sizeof (hdr);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof (cbuf);
+
+    // received copies must not leak into the next --upgrade exec either
+    if (recvmsg (fd, &msg, MSG_CMSG_CLOEXEC) != (ssize_t) sizeof (hdr) ||
+        g_ntohl (hdr[0]) != UPGRADE_MAGIC || g_ntohl (hdr[1]) != UPGRADE_VERSION) {
+        LOG_err (UPGRADE_LOG, "Failed to receive listening sockets !");
+        return FALSE;
+    }
+
+    for (cmsg = CMSG_FIRSTHDR (&msg); cmsg; cmsg = CMSG_NXTHDR (&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            n = (cmsg->cmsg_len - CMSG_LEN (0)) / sizeof (int);
+            memcpy (fds, CMSG_DATA (cmsg), sizeof (int) * MIN (n, UPGRADE_MAX_FDS));
+        }
+    }
+
+    if (n != g_ntohl (hdr[2]) + g_ntohl (hdr[3]) + g_ntohl (hdr[4])) {
+        LOG_err (UPGRADE_LOG, "Unexpected number of sockets: %u", n);
+        return FALSE;
+    }
+
+    n = 0;
+    *http_fd = g_ntohl (hdr[2]) ? fds[n++] : -1;
+    *repl_fd = g_ntohl (hdr[3]) ? fds[n++] : -1;
+    *https_fd = g_ntohl (hdr[4]) ? fds[n++] : -1;
+
+    return TRUE;
+}
+
+static gboolean upgrade_recv_state (TrackerApp *app, gint fd)
+{
+    FILE *f;
+    guint64 torrents = 0, peers = 0;
+    gboolean ok = FALSE;
+
+    f = fdopen (dup (fd), "r");
+    if (!f)
+        return FALSE;
+
+    for (;;) {
+        guint8 rec;
+        uint8_t info_hash[SHA_DIGEST_LENGTH];
+        guint32 completed, n_peers, i;
+        Torrent *torrent;
+
+        if (fread (&rec, 1, 1, f) != 1)
+            break;
+        if (rec == UR_end) {
+            ok = TRUE;
+            break;
+        }
+        if (rec != UR_torrent ||
+            fread (info_hash, SHA_DIGEST_LENGTH, 1, f) != 1 ||
+            fread (&completed, 4, 1, f) != 1 || fread (&n_peers, 4, 1, f) != 1)
+            break;
+
+        torrent = tracker_get_torrent (app, info_hash);
+        if (!torrent)
+            torrent = tracker_add_torrent (app, info_hash);
+        if (!torrent) {
+            LOG_err (UPGRADE_LOG, "Memory budget is exhausted !");
+            goto out;
+        }
+        torrent->completed = g_ntohl (completed);
+
+        n_peers = g_ntohl (n_peers);
+        for (i = 0; i < n_peers; i++) {
+            guint8 id_len, status;
+            gchar peer_id[256];
+            struct in_addr addr;
+            guint16 port;
+            guint64 vals[5];
+            guint32 origin;
+            Peer *peer;
+
+            if (fread (&id_len, 1, 1, f) != 1 || fread (peer_id, 1, id_len, f) != id_len ||
+                fread (&addr, 4, 1, f) != 1 || fread (&port, 2, 1, f) != 1 || fread (&status, 1, 1, f) != 1 ||
+                fread (vals, sizeof (vals), 1, f) != 1 || fread (&origin, 4, 1, f) != 1)
+                goto out;
+            peer_id[id_len] = '\0';
+
+            peer = torrent_get_peer (torrent, peer_id);
+            if (!peer)
+                peer = torrent_add_peer (torrent, peer_id, &addr, g_ntohs (port));
+            peer->status = status == PS_seeder ? PS_seeder : PS_leecher;
+            peer->uploaded = GUINT64_FROM_BE (vals[0]);
+            peer->downloaded = GUINT64_FROM_BE (vals[1]);
+            peer->left = GUINT64_FROM_BE (vals[2]);
+            peer->access_time = GUINT64_FROM_BE (vals[3]);
+            peer->expire_time = GUINT64_FROM_BE (vals[4]);
+            peer->origin = g_ntohl (origin);
+            peers++;
+        }
+        // peers are sent in hash table order
+        torrent_sort_peers (torrent);
+        torrents++;
+    }
+
+out:
+    fclose (f);
+
+    if (ok)
+        LOG_msg (UPGRADE_LOG, "Received %"G_GUINT64_FORMAT" torrents, %"G_GUINT64_FORMAT" peers", torrents, peers);
+    else
+        LOG_err (UPGRADE_LOG, "Failed to receive torrents !");
+
+    return ok;
+}
+
+gint upgrade_receive (TrackerApp *app, const gchar *path, evutil_socket_t *http_fd, evutil_socket_t *repl_fd,
+    evutil_socket_t *https_fd)
+{
+    struct sockaddr_un sun;
+    gint fd, i;
+
+    if (strlen (path) >= sizeof (sun.sun_path))
+        return -1;
+
+    memset (&sun, 0, sizeof (sun));
+    sun.sun_family = AF_UNIX;
+    strcpy (sun.sun_path, path);
+
+    fd = socket (AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    evutil_make_socket_closeonexec (fd);
+
+    for (i = 0; ; i++) {
+        if (connect (fd, (struct sockaddr *) &sun, sizeof (sun)) == 0)
+            break;
+        if (i == UPGRADE_CONNECT_RETRIES) {
+            LOG_err (UPGRADE_LOG, "Failed to connect to running tracker via %s: %s", path, strerror (errno));
+            close (fd);
+            return -1;
+        }
+        g_usleep (100000);
+    }
+
+    if (!upgrade_recv_fds (fd, http_fd, repl_fd, https_fd) || !upgrade_recv_state (app, fd)) {
+        close (fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+void upgrade_send_ready (gint ctl_fd)
+{
+    gchar c = UPGRADE_READY;
+
+    if (send (ctl_fd, &c, 1, 0) != 1)
+        LOG_err (UPGRADE_LOG, "Failed to notify running tracker: %s", strerror (errno));
+
+    close (ctl_fd);
+}
+/*}}}*/
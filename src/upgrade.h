@@ -0,0 +1,35 @@
+/*
+ * Copyright (C) 2012-2013 Paul Ionkin <paul.ionkin@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#ifndef _UPGRADE_H_
+#define _UPGRADE_H_
+
+#include "global.h"
+
+typedef struct _Upgrade Upgrade;
+
+// running process: on SIGUSR2 starts new binary and hands over to it
+Upgrade *upgrade_create (TrackerApp *app, gchar **argv);
+void upgrade_destroy (Upgrade *upgrade);
+
+// new process: receives listening sockets and torrents from running tracker,
+// returns control connection or -1
+gint upgrade_receive (TrackerApp *app, const gchar *path, evutil_socket_t *http_fd, evutil_socket_t *repl_fd,
+    evutil_socket_t *https_fd);
+// new process is serving, the old one can stop accepting
+void upgrade_send_ready (gint ctl_fd);
+
+#endif
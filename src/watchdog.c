@@ -0,0 +1,226 @@
+/*
+ * Copyright (C) 2012-2013 Paul Ionkin <paul.ionkin@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include "watchdog.h"
+#include <pthread.h>
+
+/*
+ * The event loop bumps a heartbeat from a short periodic timer, its delay
+ * is the loop lag. The watchdog thread checks the heartbeat and when it's
+ * older than the threshold, sends WATCHDOG_SIGNAL to the loop thread, which
+ * appends its backtrace to watchdog.file. One backtrace per stall.
+ */
+
+#define WD_LOG "watchdog"
+#define WATCHDOG_HEARTBEAT_MS 10
+// SIGUSR2 starts upgrade
+#define WATCHDOG_SIGNAL SIGUSR1
+#define WATCHDOG_MAX_FRAMES 64
+
+struct _Watchdog {
+    TrackerApp *app;
+    gchar *path;
+    gint64 threshold_us;
+
+    pthread_t loop_thread;
+    struct sigaction old_action;
+
+    // monotonic time of the last heartbeat, written by the loop
+    gint64 heartbeat_us;
+    struct event *ev_heartbeat;
+    WatchdogStats stats;
+
+    GMutex lock;
+    GCond cond;
+    gboolean stop;
+    GThread *thread;
+};
+
+// written to from the signal handler
+static gint stall_fd = -1;
+
+static void watchdog_on_signal (G_GNUC_UNUSED int sig)
+{
+    void *frames[WATCHDOG_MAX_FRAMES];
+    gint saved_errno = errno;
+    gint n;
+
+    n = backtrace (frames, G_N_ELEMENTS (frames));
+    if (stall_fd >= 0)
+        backtrace_symbols_fd (frames, n, stall_fd);
+
+    errno = saved_errno;
+}
+
+static void watchdog_on_heartbeat_cb (G_GNUC_UNUSED evutil_socket_t fd, G_GNUC_UNUSED short event, void *ctx)
+{
+    Watchdog *wd = (Watchdog *) ctx;
+    gint64 now = g_get_monotonic_time ();
+    gint64 elapsed = now - __atomic_load_n (&wd->heartbeat_us, __ATOMIC_RELAXED);
+    guint64 lag = elapsed > WATCHDOG_HEARTBEAT_MS * 1000 ? elapsed - WATCHDOG_HEARTBEAT_MS * 1000 : 0;
+    guint bucket = lag ? 64 - __builtin_clzll (lag) : 0;
+
+    wd->stats.lag_hist[MIN (bucket, WATCHDOG_LAG_BUCKETS - 1)]++;
+    wd->stats.lag_max_us = MAX (wd->stats.lag_max_us, lag);
+    if ((gint64) lag >= wd->threshold_us)
+        wd->stats.stalls++;
+
+    __atomic_store_n (&wd->heartbeat_us, now, __ATOMIC_RELEASE);
+}
+
+static void watchdog_report (Watchdog *wd, gint64 stalled_us)
+{
+    gchar buf[128];
+    gint len;
+
+    len = g_snprintf (buf, sizeof (buf), "%ld: event loop stalled for %"G_GINT64_FORMAT" ms, backtrace:\n",
+        (long) time (NULL), stalled_us / 1000);
+    if (write (stall_fd, buf, MIN (len, (gint) sizeof (buf) - 1)) < 0)
+        LOG_err (WD_LOG, "Failed to write to %s: %s", wd->path, strerror (errno));
+
+    pthread_kill (wd->loop_thread, WATCHDOG_SIGNAL);
+
+    // logger itself could be what blocks the loop, report it last
+    LOG_err (WD_LOG, "Event loop stalled for %"G_GINT64_FORMAT" ms, backtrace is written to %s", stalled_us / 1000, wd->path);
+}
+
+static gpointer watchdog_thread (gpointer data)
+{
+    Watchdog *wd = (Watchdog *) data;
+    gint64 check_us = MAX (wd->threshold_us / 4, 1000);
+    gint64 reported = 0;
+
+    g_mutex_lock (&wd->lock);
+    while (!wd->stop) {
+        gint64 end_time = g_get_monotonic_time () + check_us;
+        gint64 heartbeat;
+
+        while (!wd->stop && g_cond_wait_until (&wd->cond, &wd->lock, end_time));
+        if (wd->stop)
+            break;
+        g_mutex_unlock (&wd->lock);
+
+        heartbeat = __atomic_load_n (&wd->heartbeat_us, __ATOMIC_ACQUIRE);
+        if (g_get_monotonic_time () - heartbeat > wd->threshold_us && heartbeat != reported) {
+            reported = heartbeat;
+            watchdog_report (wd, g_get_monotonic_time () - heartbeat);
+        }
+
+        g_mutex_lock (&wd->lock);
+    }
+    g_mutex_unlock (&wd->lock);
+
+    return NULL;
+}
+
+Watchdog *watchdog_create (TrackerApp *app)
+{
+    ConfData *conf = tracker_app_get_conf (app);
+    Watchdog *wd;
+    struct sigaction action;
+    struct timeval tv = { 0, WATCHDOG_HEARTBEAT_MS * 1000 };
+    void *frames[1];
+
+    if (stall_fd >= 0) {
+        LOG_err (WD_LOG, "Watchdog is already running !");
+        return NULL;
+    }
+
+    wd = g_new0 (Watchdog, 1);
+    wd->app = app;
+    wd->path = g_strdup (conf_get_string (conf, "watchdog.file"));
+    wd->threshold_us = (gint64) MAX (conf_get_uint (conf, "watchdog.threshold_ms"), 1) * 1000;
+    wd->loop_thread = pthread_self ();
+
+    stall_fd = open (wd->path, O_WRONLY | O_APPEND | O_CREAT, 0640);
+    if (stall_fd < 0) {
+        LOG_err (WD_LOG, "Failed to open %s: %s", wd->path, strerror (errno));
+        g_free (wd->path);
+        g_free (wd);
+        return NULL;
+    }
+
+    // first backtrace () call loads libgcc, which is not safe in a signal handler
+    backtrace (frames, G_N_ELEMENTS (frames));
+
+    memset (&action, 0, sizeof (action));
+    action.sa_handler = watchdog_on_signal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset (&action.sa_mask);
+    sigaction (WATCHDOG_SIGNAL, &action, &wd->old_action);
+
+    wd->heartbeat_us = g_get_monotonic_time ();
+    wd->ev_heartbeat = event_new (tracker_app_get_evbase (app), -1, EV_PERSIST, watchdog_on_heartbeat_cb, wd);
+    // lag as seen by announces
+    event_priority_set (wd->ev_heartbeat, TRACKER_PRIO_ANNOUNCE);
+    event_add (wd->ev_heartbeat, &tv);
+
+    g_mutex_init (&wd->lock);
+    g_cond_init (&wd->cond);
+    wd->thread = g_thread_new ("watchdog", watchdog_thread, wd);
+
+    LOG_msg (WD_LOG, "Watchdog is running, stall threshold: %"G_GINT64_FORMAT" ms", wd->threshold_us / 1000);
+
+    return wd;
+}
+
+void watchdog_destroy (Watchdog *wd)
+{
+    g_mutex_lock (&wd->lock);
+    wd->stop = TRUE;
+    g_cond_signal (&wd->cond);
+    g_mutex_unlock (&wd->lock);
+    g_thread_join (wd->thread);
+
+    g_mutex_clear (&wd->lock);
+    g_cond_clear (&wd->cond);
+
+    event_free (wd->ev_heartbeat);
+    sigaction (WATCHDOG_SIGNAL, &wd->old_action, NULL);
+    close (stall_fd);
+    stall_fd = -1;
+
+    g_free (wd->path);
+    g_free (wd);
+}
+
+const WatchdogStats *watchdog_get_stats (const Watchdog *wd)
+{
+    return &wd->stats;
+}
+
+guint64 watchdog_get_lag_percentile (const Watchdog *wd, gdouble pct)
+{
+    guint64 count = 0, target, sum = 0;
+    gint i;
+
+    for (i = 0; i < WATCHDOG_LAG_BUCKETS; i++)
+        count += wd->stats.lag_hist[i];
+    if (!count)
+        return 0;
+
+    target = (guint64) (count * pct / 100.0);
+    if (target >= count)
+        target = count - 1;
+
+    for (i = 0; i < WATCHDOG_LAG_BUCKETS; i++) {
+        sum += wd->stats.lag_hist[i];
+        if (sum > target)
+            return i ? MIN (1ULL << i, wd->stats.lag_max_us) : 0;
+    }
+
+    return wd->stats.lag_max_us;
+}
@@ -0,0 +1,45 @@
+/*
+ * Copyright (C) 2012-2013 Paul Ionkin <paul.ionkin@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#ifndef _WATCHDOG_H_
+#define _WATCHDOG_H_
+
+#include "global.h"
+
+// bucket i counts lags in [2^(i-1), 2^i) us, bucket 0 - lags under 1 us
+#define WATCHDOG_LAG_BUCKETS 32
+
+typedef struct {
+    guint64 lag_hist[WATCHDOG_LAG_BUCKETS];
+    guint64 lag_max_us;
+    // lags over watchdog.threshold_ms
+    guint64 stalls;
+} WatchdogStats;
+
+typedef struct _Watchdog Watchdog;
+
+/*
+ * Starts heartbeat timer in the event loop and the watchdog thread.
+ * Must be called from the thread running the event loop.
+ */
+Watchdog *watchdog_create (TrackerApp *app);
+void watchdog_destroy (Watchdog *wd);
+
+const WatchdogStats *watchdog_get_stats (const Watchdog *wd);
+// upper bound of the histogram bucket, at most max lag, us
+guint64 watchdog_get_lag_percentile (const Watchdog *wd, gdouble pct);
+
+#endif